@@ -0,0 +1,219 @@
+"""Throughput benchmark for wordcount, run by `make bench`.
+
+Generates reproducible corpora (fixed seeds) under bench_data/, times
+wordcount in each counting mode against GNU wc on the same input, and prints
+one JSON document with GB/s and cycles/byte per run. Files are read once
+before timing, so the numbers are for data in the page cache.
+
+Cycles come from `perf stat` when it is available; otherwise they are
+estimated from wall time at the clock rate in /proc/cpuinfo, which the JSON
+records as "cycles_source".
+"""
+import argparse
+import json
+import os
+import platform
+import random
+import shutil
+import subprocess
+import sys
+import time
+from pathlib import Path
+
+HERE = Path(__file__).resolve().parent
+BINARY = str(HERE / "wordcount")
+
+# Bumped whenever a generator changes, so stale corpora are rebuilt
+CORPUS_VERSION = 1
+
+WORDS = (b"the of and to in a is that for it as was with be by on not he this are or his "
+         b"from at which but have an they you were her she there been one all we their "
+         b"counting buffer kernel throughput latency vector newline whitespace").split()
+UTF8_WORDS = [w.encode() for w in
+              "der die und über straße café naïve año 日本語 テキスト 中文 字符 "
+              "русский текст ελληνικά κείμενο عربي नमस्ते 한국어 😀".split()]
+UTF8_SPACES = [b" ", "\u00a0".encode(), "\u2009".encode(), "\u3000".encode(), b"\n"]
+
+
+def prose(rng, size, words, seps, line_words):
+    """Words from `words` joined by `seps`, a newline every ~line_words words"""
+    out = bytearray()
+    while len(out) < size:
+        n = rng.randrange(1, 2 * line_words)
+        line = [rng.choice(words)]
+        for _ in range(n - 1):
+            line += [rng.choice(seps), rng.choice(words)]
+        out += b"".join(line) + b"\n"
+    return bytes(out[:size])
+
+
+def gen_ascii(rng, size):
+    return prose(rng, size, WORDS, [b" "] * 12 + [b", ", b". ", b"\t"], 12)
+
+
+def gen_long_lines(rng, size):
+    # About one newline per MiB
+    return prose(rng, size, WORDS, [b" "], 180000)
+
+
+def gen_whitespace(rng, size):
+    return bytes(rng.choice(b"     \t\n\r\v\f") for _ in range(size))
+
+
+def gen_binary(rng, size):
+    return rng.randbytes(size)
+
+
+def gen_utf8(rng, size):
+    return prose(rng, size, UTF8_WORDS + WORDS, UTF8_SPACES, 10)
+
+
+CORPORA = {
+    "ascii_prose": gen_ascii,
+    "long_lines": gen_long_lines,
+    "whitespace": gen_whitespace,
+    "binary": gen_binary,
+    "utf8": gen_utf8,
+}
+
+# (name, wordcount args, wc args, wc locale); None for wc means no counterpart
+MODES = [
+    ("default", [], [], "C"),
+    ("lines", ["-l"], ["-l"], "C"),
+    ("words", ["-w"], ["-w"], "C"),
+    ("bytes", ["-c"], ["-c"], "C"),
+    ("chars", ["-m"], ["-m"], "C.UTF-8"),
+    ("unicode_words", ["-w", "--unicode-spaces"], None, None),
+    ("default_1_thread", ["-j", "1"], None, None),
+]
+
+
+def corpus_path(data_dir, name, size):
+    return data_dir / f"{name}-{size}-v{CORPUS_VERSION}.txt"
+
+
+def ensure_corpus(data_dir, name, size):
+    path = corpus_path(data_dir, name, size)
+    if not path.exists():
+        # Generate a 4 MiB piece and repeat it: still reproducible, and fast
+        # enough in Python for corpora of hundreds of MiB. Text is cut after
+        # a newline so no UTF-8 character is split at the seams.
+        rng = random.Random(f"{name}-{CORPUS_VERSION}")
+        piece = CORPORA[name](rng, min(size, 4 << 20))
+        tmp = path.with_suffix(".tmp")
+        with open(tmp, "wb") as f:
+            written = 0
+            while written < size:
+                chunk = piece[:size - written]
+                if name != "binary":
+                    if b"\n" not in chunk:
+                        break
+                    chunk = chunk[:chunk.rindex(b"\n") + 1]
+                f.write(chunk)
+                written += len(chunk)
+        tmp.rename(path)
+    return path
+
+
+def cpu_mhz():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("cpu MHz"):
+                    return float(line.split(":")[1])
+    except OSError:
+        pass
+    return None
+
+
+def run_once(cmd, env, use_perf):
+    """(seconds, cycles or None, stdout) for one run of cmd"""
+    if use_perf:
+        cmd = ["perf", "stat", "-x", ",", "-e", "cycles", "--"] + cmd
+    start = time.perf_counter()
+    result = subprocess.run(cmd, env=env, capture_output=True, check=True)
+    seconds = time.perf_counter() - start
+    cycles = None
+    if use_perf:
+        for line in result.stderr.decode(errors="replace").splitlines():
+            fields = line.split(",")
+            if len(fields) > 2 and fields[2].startswith("cycles") and fields[0].isdigit():
+                cycles = int(fields[0])
+    return seconds, cycles, result.stdout
+
+
+def measure(cmd, path, size, repeat, locale, use_perf, mhz):
+    env = {**os.environ, "LC_ALL": locale} if locale else dict(os.environ)
+    best = None
+    output = None
+    for _ in range(repeat):
+        seconds, cycles, output = run_once(cmd + [str(path)], env, use_perf)
+        if best is None or seconds < best[0]:
+            best = (seconds, cycles)
+
+    seconds, cycles = best
+    if cycles is None and mhz:
+        cycles = seconds * mhz * 1e6
+    return {
+        "seconds": round(seconds, 6),
+        "gb_per_s": round(size / seconds / 1e9, 3),
+        "cycles_per_byte": round(cycles / size, 4) if cycles else None,
+    }, output.split()[:-1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--size-mb", type=int, default=int(os.environ.get("BENCH_MB", 256)),
+                        help="corpus size in MiB (default: $BENCH_MB or 256)")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per measurement; the best is kept")
+    parser.add_argument("--data-dir", default=str(HERE / "bench_data"), help="where corpora are kept")
+    parser.add_argument("--corpus", action="append", choices=sorted(CORPORA), help="only these corpora")
+    parser.add_argument("--out", help="also write the JSON here")
+    args = parser.parse_args()
+
+    size = args.size_mb << 20
+    data_dir = Path(args.data_dir)
+    data_dir.mkdir(exist_ok=True)
+    use_perf = shutil.which("perf") is not None and \
+        subprocess.run(["perf", "stat", "-e", "cycles", "--", "true"], capture_output=True).returncode == 0
+    mhz = cpu_mhz()
+    wc = shutil.which("wc")
+
+    results = []
+    for name in args.corpus or CORPORA:
+        path = ensure_corpus(data_dir, name, size)
+        nbytes = path.stat().st_size
+        # Warm the page cache
+        subprocess.run(["cat", str(path)], stdout=subprocess.DEVNULL, check=True)
+
+        for mode, wc_args, gnu_args, locale in MODES:
+            ours, our_counts = measure([BINARY] + wc_args, path, nbytes, args.repeat, None, use_perf, mhz)
+            row = {"corpus": name, "mode": mode, "args": wc_args, "bytes": nbytes, "wordcount": ours}
+            if wc and gnu_args is not None:
+                theirs, their_counts = measure([wc] + gnu_args, path, nbytes, args.repeat, locale, use_perf, mhz)
+                row["gnu_wc"] = theirs
+                row["speedup"] = round(theirs["seconds"] / ours["seconds"], 2)
+                # Word and character rules differ from GNU wc on non-ASCII input
+                row["counts_match"] = our_counts == their_counts
+            results.append(row)
+            print(f"{name:12} {mode:17} {ours['gb_per_s']:8.2f} GB/s", file=sys.stderr)
+
+    report = {
+        "machine": {
+            "platform": platform.platform(),
+            "cpus": os.cpu_count(),
+            "cpu_mhz": mhz,
+            "cycles_source": "perf" if use_perf else "wall time x cpu MHz",
+        },
+        "corpus_mib": args.size_mb,
+        "repeat": args.repeat,
+        "results": results,
+    }
+    text = json.dumps(report, indent=2)
+    print(text)
+    if args.out:
+        Path(args.out).write_text(text + "\n")
+
+
+if __name__ == "__main__":
+    main()
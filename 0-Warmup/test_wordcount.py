@@ -149,6 +149,20 @@ class TestOptions:
         assert parts[0] == "2"  # lines
         assert parts[1] == "4"  # words
 
+    def test_stdin_redirected_from_file(self, sample_file):
+        """Test that a regular file on stdin counts the same as a pipe"""
+        with open(sample_file, "rb") as f:
+            redirected = subprocess.run([BINARY], stdin=f, capture_output=True, text=True)
+        piped = subprocess.run(
+            [BINARY],
+            input=sample_file.read_text(),
+            capture_output=True,
+            text=True
+        )
+
+        assert redirected.returncode == 0
+        assert redirected.stdout == piped.stdout
+
 
 class TestMultipleFiles:
     """Test handling multiple input files"""
@@ -183,6 +197,43 @@ class TestMultipleFiles:
         # Check that no line ends with "total" (avoid matching "total" in directory paths)
         assert not any(line.endswith(" total") for line in lines)
 
+    def test_many_files_keep_argv_order(self, tmp_path):
+        """Test that the worker pool prints files in argv order"""
+        files = []
+        for i in range(200):
+            file = tmp_path / f"f{i}.txt"
+            file.write_text("word " * (i % 17) + "\n" * (i % 5))
+            files.append(str(file))
+
+        # Without io_uring, -j 1 counts the files one by one
+        env = {**os.environ, "WORDCOUNT_URING": "0"}
+        parallel = subprocess.run([BINARY, "-j", "4"] + files, capture_output=True, text=True, env=env)
+        serial = subprocess.run([BINARY, "-j", "1"] + files, capture_output=True, text=True, env=env)
+
+        assert parallel.returncode == 0
+        assert parallel.stdout == serial.stdout
+        lines = parallel.stdout.strip().split('\n')
+        assert [line.split()[-1] for line in lines] == files + ["total"]
+
+    def test_many_files_keep_argv_order_uring(self, tmp_path):
+        """Test that io_uring prints files in argv order as they complete out of order"""
+        files = []
+        for i in range(200):
+            file = tmp_path / f"f{i}.txt"
+            # Large files among small ones finish after later submissions
+            file.write_text("word " * (50000 if i % 40 == 3 else i % 17) + "\n" * (i % 5))
+            files.append(str(file))
+
+        uring = subprocess.run([BINARY, "-j", "1"] + files, capture_output=True, text=True,
+                               env={**os.environ, "WORDCOUNT_URING": "1"})
+        serial = subprocess.run([BINARY, "-j", "1"] + files, capture_output=True, text=True,
+                                env={**os.environ, "WORDCOUNT_URING": "0"})
+
+        assert uring.returncode == 0
+        assert uring.stdout == serial.stdout
+        lines = uring.stdout.strip().split('\n')
+        assert [line.split()[-1] for line in lines] == files + ["total"]
+
 
 class TestErrorHandling:
     """Test error cases"""
@@ -257,3 +308,556 @@ class TestEdgeCases:
         assert result.returncode == 0
         output = result.stdout.strip()
         assert output == "2"
+
+
+def reference_counts(data):
+    """Byte-at-a-time model of count_stream() using C-locale isspace()"""
+    whitespace = b" \t\n\v\f\r"
+    words = 0
+    in_word = False
+    for byte in data:
+        if byte in whitespace:
+            in_word = False
+        elif not in_word:
+            in_word = True
+            words += 1
+    return [data.count(b"\n"), words, len(data)]
+
+
+class TestKernels:
+    """Test that every counting kernel matches the byte-at-a-time result"""
+
+    @pytest.fixture
+    def mixed_file(self, tmp_path):
+        """Random text, whitespace runs and high bytes across many blocks"""
+        import random
+        rng = random.Random(1234)
+        alphabet = b"ab \t\n\v\f\r\x00\x7f\x80\xa0\xff"
+        data = bytes(rng.choice(alphabet) for _ in range(300007))
+        # Long word and long whitespace run crossing a block boundary
+        data += b"x" * 262150 + b" " * 70 + b"tail"
+        file = tmp_path / "mixed.bin"
+        file.write_bytes(data)
+        return file, data
+
+    @pytest.mark.parametrize("kernel", ["scalar", "sse2", "avx2"])
+    def test_kernel_matches_reference(self, mixed_file, kernel):
+        """Test each kernel against the reference model"""
+        file, data = mixed_file
+        result = subprocess.run(
+            [BINARY, str(file)],
+            capture_output=True,
+            text=True,
+            env={**os.environ, "WORDCOUNT_KERNEL": kernel}
+        )
+
+        assert result.returncode == 0
+        parts = result.stdout.split()
+        assert [int(p) for p in parts[:3]] == reference_counts(data)
+
+    def test_piped_blocks_match_reference(self, mixed_file):
+        """Test that words spanning read() blocks are counted once"""
+        file, data = mixed_file
+        result = subprocess.run([BINARY], input=data, capture_output=True)
+
+        assert result.returncode == 0
+        assert [int(p) for p in result.stdout.split()] == reference_counts(data)
+
+    @pytest.mark.parametrize("kernel", ["scalar", "sse2", "avx2"])
+    @pytest.mark.parametrize("flags", [["-l"], ["-w"], ["-c"], ["-l", "-w"], ["-w", "-c"]])
+    def test_flag_specialized_kernels(self, mixed_file, kernel, flags):
+        """Test the kernel for each flag combination, from a file and from a pipe"""
+        file, data = mixed_file
+        lines, words, chars = reference_counts(data)
+        expected = [n for flag, n in (("-l", lines), ("-w", words), ("-c", chars)) if flag in flags]
+        env = {**os.environ, "WORDCOUNT_KERNEL": kernel}
+        from_file = subprocess.run([BINARY, *flags, str(file)], capture_output=True, env=env)
+        from_pipe = subprocess.run([BINARY, *flags], input=data, capture_output=True, env=env)
+
+        assert [int(p) for p in from_file.stdout.split()[:-1]] == expected
+        assert [int(p) for p in from_pipe.stdout.split()] == expected
+
+    def test_bytes_of_partly_read_stdin(self, mixed_file):
+        """Test that -c on a regular-file stdin counts from the current offset"""
+        file, data = mixed_file
+        result = subprocess.run(f"(head -c 1000 >/dev/null; {BINARY} -c) < {file}",
+                                shell=True, capture_output=True)
+
+        assert int(result.stdout) == len(data) - 1000
+
+    @pytest.mark.parametrize("flags", [[], ["-j", "4"]])
+    def test_counts_of_partly_read_stdin(self, mixed_file, flags):
+        """Test that a regular-file stdin is counted from the current offset"""
+        file, data = mixed_file
+        cut = data.index(b"\n", 1000) + 1
+        lines, words, chars = reference_counts(data[cut:])
+        result = subprocess.run(f"(head -c {cut} >/dev/null; {BINARY} {' '.join(flags)}) < {file}",
+                                shell=True, capture_output=True)
+
+        assert [int(p) for p in result.stdout.split()] == [lines, words, chars]
+
+
+class TestParallel:
+    """Test that -j splits a file across threads without changing the counts"""
+
+    @pytest.fixture
+    def large_file(self, tmp_path):
+        """12 MiB file with words, spaces and newlines on the range boundaries"""
+        import re
+        mib = 1024 * 1024
+        data = bytearray(b"lorem ipsum\tdolor\n" * (12 * mib // 18 + 1))[:12 * mib]
+        data[4 * mib - 3:4 * mib + 3] = b"STRADL"   # word across boundary 1
+        data[8 * mib - 1:8 * mib + 1] = b" x"       # word starts at boundary 2
+        file = tmp_path / "large.txt"
+        file.write_bytes(bytes(data))
+        words = len(re.findall(rb"[^ \t\n\v\f\r]+", bytes(data)))
+        return file, [data.count(b"\n"), words, len(data)]
+
+    @pytest.mark.parametrize("jobs", ["1", "2", "3", "5"])
+    def test_parallel_matches_serial(self, large_file, jobs):
+        """Test that boundary words are merged back into single words"""
+        file, expected = large_file
+        result = subprocess.run(
+            [BINARY, "-j", jobs, str(file)],
+            capture_output=True,
+            text=True
+        )
+
+        assert result.returncode == 0
+        assert [int(p) for p in result.stdout.split()[:3]] == expected
+
+    def test_invalid_thread_count(self, sample_file):
+        """Test that -j rejects non-positive counts"""
+        result = subprocess.run(
+            [BINARY, "-j", "0", str(sample_file)],
+            capture_output=True,
+            text=True
+        )
+
+        assert result.returncode != 0
+        assert "usage" in result.stderr.lower()
+
+
+class TestFollow:
+    """Test --follow on a growing and rotating file"""
+
+    @staticmethod
+    def read_counts(proc, timeout=5):
+        """Read the next line printed by a --follow process"""
+        import select
+        ready, _, _ = select.select([proc.stdout], [], [], timeout)
+        assert ready, "Timed out waiting for --follow output"
+        return [int(p) for p in proc.stdout.readline().split()[:3]]
+
+    def test_follow_appends_and_rotation(self, tmp_path):
+        """Test that appends, split words and rotation are all counted once"""
+        log = tmp_path / "app.log"
+        log.write_text("one two\n")
+        proc = subprocess.Popen(
+            [BINARY, "--follow", "--interval", "0.05", str(log)],
+            stdout=subprocess.PIPE,
+            text=True
+        )
+        try:
+            assert self.read_counts(proc) == [1, 2, 8]
+
+            with open(log, "a") as f:
+                f.write("three fo")
+            assert self.read_counts(proc) == [1, 4, 16]
+
+            with open(log, "a") as f:
+                f.write("ur\n")
+            assert self.read_counts(proc) == [2, 4, 19]
+
+            log.rename(tmp_path / "app.log.1")
+            log.write_text("new file\n")
+            assert self.read_counts(proc) == [3, 6, 28]
+        finally:
+            proc.terminate()
+            proc.wait(timeout=5)
+
+        assert proc.returncode == 0
+
+    def test_follow_needs_one_file(self, multi_files):
+        """Test that --follow rejects more than one file"""
+        file1, file2 = multi_files
+        result = subprocess.run(
+            [BINARY, "--follow", str(file1), str(file2)],
+            capture_output=True,
+            text=True
+        )
+
+        assert result.returncode != 0
+
+
+class TestCache:
+    """Test the --cache sidecar"""
+
+    def run_cached(self, cache, *files):
+        result = subprocess.run(
+            [BINARY, "--cache", str(cache)] + [str(f) for f in files],
+            capture_output=True,
+            text=True
+        )
+        assert result.returncode == 0
+        return [[int(p) for p in line.split()[:3]] for line in result.stdout.strip().split('\n')]
+
+    def test_unchanged_file_answered_from_cache(self, tmp_path):
+        """Test that a file with the same size and mtime is not recounted"""
+        file = tmp_path / "log.txt"
+        cache = tmp_path / "counts.cache"
+        file.write_text("alpha beta\ngamma\n")
+        assert self.run_cached(cache, file) == [[2, 3, 17]]
+        assert cache.read_bytes()[:8] == b"WCCACHE\0"
+
+        # Same size and mtime: the cached counts win over the new content
+        st = file.stat()
+        file.write_text("alpha_beta_gamma\n")
+        os.utime(file, ns=(st.st_atime_ns, st.st_mtime_ns))
+        assert self.run_cached(cache, file) == [[2, 3, 17]]
+
+        # A new mtime forces a recount
+        os.utime(file, ns=(st.st_atime_ns, st.st_mtime_ns + 1000))
+        assert self.run_cached(cache, file) == [[1, 1, 17]]
+
+    def test_appended_file_resumes_from_prefix(self, tmp_path):
+        """Test that growth is counted on top of the cached prefix"""
+        file = tmp_path / "log.txt"
+        cache = tmp_path / "counts.cache"
+        file.write_bytes(b"word " * 2000 + b"spl")
+        assert self.run_cached(cache, file) == [[0, 2001, 10003]]
+
+        with open(file, "ab") as f:
+            f.write(b"it\nend\n")
+        assert self.run_cached(cache, file) == [[2, 2002, 10010]]
+
+    def test_rewritten_file_is_recounted(self, tmp_path):
+        """Test that a grown file whose prefix changed is counted from scratch"""
+        file = tmp_path / "log.txt"
+        cache = tmp_path / "counts.cache"
+        file.write_text("a b c\n")
+        self.run_cached(cache, file)
+
+        file.write_text("abc\nlonger content\n")
+        assert self.run_cached(cache, file) == [[2, 3, 19]]
+
+    def test_full_cache_table_is_not_probed_forever(self, tmp_path):
+        """Test a cache whose every slot is used despite its stored count"""
+        import struct
+        file = tmp_path / "log.txt"
+        cache = tmp_path / "counts.cache"
+        file.write_text("a b c\n")
+        header = b"WCCACHE\0" + struct.pack("=IIQQ", 1, 72, 16, 3)
+        records = b"".join(struct.pack("=QQQqqqqQBBB5x", 1 << 60, i, 1, 0, 0, 0, 0, 0, 1, 0, 0)
+                           for i in range(16))
+        cache.write_bytes(header + records)
+
+        result = subprocess.run([BINARY, "--cache", str(cache), str(file)],
+                                capture_output=True, text=True, timeout=10)
+        assert result.returncode == 0
+        assert [int(x) for x in result.stdout.split()[:3]] == [1, 3, 6]
+        assert self.run_cached(cache, file) == [[1, 3, 6]]
+
+
+class TestTop:
+    """Test --top K word frequencies"""
+
+    @staticmethod
+    def expected_top(data, k):
+        """Most frequent whitespace-separated tokens, ties in byte order"""
+        import re
+        from collections import Counter
+        counts = Counter(re.findall(rb"[^ \t\n\v\f\r]+", data))
+        ranked = sorted(counts.items(), key=lambda item: (-item[1], item[0]))
+        return [(n, word) for word, n in ranked[:k]]
+
+    @staticmethod
+    def parse_top(stdout):
+        rows = []
+        for line in stdout.strip().split(b"\n"):
+            count, word = line.split(None, 1)
+            rows.append((int(count), word))
+        return rows
+
+    def test_top_words_in_order(self, tmp_path):
+        """Test ranking and tie-breaking by word"""
+        data = b"b a c b\na b\tb\n\nc d"
+        file = tmp_path / "words.txt"
+        file.write_bytes(data)
+        result = subprocess.run([BINARY, "--top", "3", str(file)], capture_output=True)
+
+        assert result.returncode == 0
+        assert self.parse_top(result.stdout) == [(4, b"b"), (2, b"a"), (2, b"c")]
+
+    def test_top_stdin_long_words(self):
+        """Test that words longer than a read block are carried across reads"""
+        data = (b"w" * 600000 + b" short " + b"w" * 600000 + b"\nshort") * 3
+        result = subprocess.run([BINARY, "--top", "5"], input=data, capture_output=True)
+
+        assert result.returncode == 0
+        assert self.parse_top(result.stdout) == self.expected_top(data, 5)
+
+    def test_top_k_beyond_distinct_words(self):
+        """Test that a K far larger than the input only lists the words there are"""
+        result = subprocess.run([BINARY, "--top", "100000000000"], input=b"a b c b",
+                                capture_output=True)
+
+        assert result.returncode == 0
+        assert self.parse_top(result.stdout) == [(2, b"b"), (1, b"a"), (1, b"c")]
+
+    @pytest.mark.parametrize("jobs", ["1", "3"])
+    def test_top_parallel_ranges(self, tmp_path, jobs):
+        """Test that ranges of one large file never cut a word in two"""
+        import random
+        rng = random.Random(7)
+        vocab = [b"alpha", b"beta", b"gamma", b"delta", b"x" * 40]
+        seps = [b" ", b"\n", b"\t\t"]
+        data = b"".join(rng.choice(vocab) + rng.choice(seps) for _ in range(800000))
+        file = tmp_path / "large.txt"
+        file.write_bytes(data)
+        result = subprocess.run([BINARY, "-j", jobs, "--top", "10", str(file)], capture_output=True)
+
+        assert result.returncode == 0
+        assert self.parse_top(result.stdout) == self.expected_top(data, 10)
+
+    def test_top_multiple_files(self, multi_files):
+        """Test that per-worker tables are merged across files"""
+        file1, file2 = multi_files
+        result = subprocess.run([BINARY, "-j", "2", "--top", "2", str(file1), str(file2)],
+                                capture_output=True)
+
+        assert result.returncode == 0
+        assert self.parse_top(result.stdout) == [(2, b"file"), (1, b"First")]
+
+
+class TestDistinct:
+    """Test --distinct word estimates"""
+
+    @staticmethod
+    def parse_distinct(line):
+        """(estimate, error %) from a row such as '  1  3  6  3 +/-0.81% file'"""
+        fields = line.split()
+        error = next(f for f in fields if f.startswith(b"+/-"))
+        return int(fields[fields.index(error) - 1]), float(error[3:-1])
+
+    def test_small_counts_are_exact(self):
+        """Test that a few distinct words are counted exactly"""
+        result = subprocess.run([BINARY, "--distinct"], input=b"a b a c\nb d\n", capture_output=True)
+
+        assert result.returncode == 0
+        assert self.parse_distinct(result.stdout) == (4, 0.81)
+
+    @pytest.mark.parametrize("jobs", ["1", "3"])
+    def test_estimate_within_error_bound(self, tmp_path, jobs):
+        """Test a large file, split across threads, against the exact count"""
+        import random
+        rng = random.Random(11)
+        words = [b"w%d" % rng.randrange(150000) for _ in range(1500000)]
+        file = tmp_path / "large.txt"
+        file.write_bytes(b" ".join(words) + b"\n")
+        result = subprocess.run([BINARY, "-j", jobs, "--distinct", str(file)], capture_output=True)
+
+        assert result.returncode == 0
+        exact = len(set(words))
+        estimate, error = self.parse_distinct(result.stdout)
+        # Four standard errors
+        assert abs(estimate - exact) <= exact * 4 * error / 100
+
+    def test_files_merge_into_total(self, tmp_path):
+        """Test that per-file sketches merge, not add, into the total row"""
+        file1 = tmp_path / "one.txt"
+        file2 = tmp_path / "two.txt"
+        file1.write_bytes(b"x y shared\n")
+        file2.write_bytes(b"shared z\n")
+        result = subprocess.run([BINARY, "-j", "2", "--distinct=10", str(file1), str(file2)],
+                                capture_output=True)
+
+        assert result.returncode == 0
+        rows = result.stdout.strip().split(b"\n")
+        assert [self.parse_distinct(row)[0] for row in rows] == [3, 2, 4]
+        assert rows[2].endswith(b"total")
+
+    def test_invalid_precision(self, sample_file):
+        """Test that a precision outside the supported range is rejected"""
+        result = subprocess.run([BINARY, "--distinct=30", sample_file], capture_output=True)
+
+        assert result.returncode == 1
+        assert b"Invalid precision" in result.stderr
+
+
+class TestEstimate:
+    """Test --estimate sampled counts"""
+
+    @staticmethod
+    def parse_estimate(stdout):
+        """[(count, margin), ...] for the columns of a single row"""
+        fields = stdout.split()
+        return [(int(fields[i]), int(fields[i + 1][3:])) for i in range(0, len(fields) - 1, 2)
+                if fields[i + 1].startswith(b"+/-")]
+
+    @staticmethod
+    def exact_counts(data):
+        # bytes.split() splits on the same six whitespace bytes
+        return [data.count(b"\n"), len(data.split()), len(data)]
+
+    @pytest.fixture
+    def lines_file(self, tmp_path):
+        import random
+        rng = random.Random(3)
+        lines = [b" ".join(b"w" * rng.randrange(1, 12) for _ in range(rng.randrange(0, 20)))
+                 for _ in range(300000)]
+        file = tmp_path / "lines.txt"
+        file.write_bytes(b"\n".join(lines) + b"\n")
+        return file
+
+    def test_full_sample_is_exact(self, lines_file):
+        """Test that sampling every block gives the exact counts"""
+        result = subprocess.run([BINARY, "--estimate=1", str(lines_file)], capture_output=True)
+
+        assert result.returncode == 0
+        expected = self.exact_counts(lines_file.read_bytes())
+        assert self.parse_estimate(result.stdout) == [(n, 0) for n in expected]
+
+    def test_sample_close_to_exact(self, lines_file):
+        """Test a 5% sample: chars come from fstat, lines and words are close"""
+        result = subprocess.run([BINARY, "--estimate=0.05", str(lines_file)], capture_output=True)
+
+        assert result.returncode == 0
+        lines, words, chars = self.exact_counts(lines_file.read_bytes())
+        columns = self.parse_estimate(result.stdout)
+        assert columns[2] == (chars, 0)
+        for (estimate, margin), exact in zip(columns[:2], (lines, words)):
+            assert 0 < margin < exact * 0.05
+            assert abs(estimate - exact) < exact * 0.05
+
+    def test_pipe_rejected(self):
+        """Test that stdin must be seekable"""
+        result = subprocess.run([BINARY, "--estimate"], input=b"a b\n", capture_output=True)
+
+        assert result.returncode == 1
+        assert b"regular file" in result.stderr
+
+
+@pytest.fixture(scope="module")
+def utf8_file(tmp_path_factory):
+    """Random UTF-8 text with multi-byte letters and every Unicode space.
+    It has no U+001C..U+001F, so str.split() splits exactly where
+    --unicode-spaces should."""
+    import random
+    rng = random.Random(5)
+    pool = list("abc xyz\t\n\u00e9\u3042\u6f22\u20ac\u2010\u200b\u3001\U0001F600")
+    pool += list("\u0085\u00a0\u1680\u2028\u2029\u202f\u205f\u3000")
+    pool += [chr(c) for c in range(0x2000, 0x200b)]
+    text = "".join(rng.choice(pool) for _ in range(4000000))
+    file = tmp_path_factory.mktemp("utf8") / "utf8.txt"
+    file.write_bytes(text.encode())
+    return file, text
+
+
+class TestUtf8:
+    """Test -m character counts and --unicode-spaces"""
+
+    @pytest.mark.parametrize("kernel", ["scalar", "sse2", "avx2"])
+    @pytest.mark.parametrize("jobs", ["1", "3"])
+    def test_kernel_matches_decoded_text(self, utf8_file, kernel, jobs):
+        """Test characters and Unicode-space words on every kernel, also split across threads"""
+        file, text = utf8_file
+        result = subprocess.run([BINARY, "-j", jobs, "-l", "-w", "-m", "-c", "--unicode-spaces", str(file)],
+                                capture_output=True, env={**os.environ, "WORDCOUNT_KERNEL": kernel})
+
+        assert result.returncode == 0
+        data = text.encode()
+        expected = [text.count("\n"), len(text.split()), len(text), len(data)]
+        assert [int(n) for n in result.stdout.split()[:4]] == expected
+
+    def test_piped_spaces_split_across_reads(self, utf8_file):
+        """Test multi-byte spaces cut by read boundaries; ASCII-only words without the option"""
+        file, text = utf8_file
+        data = text.encode()
+        spaced = subprocess.run([BINARY, "-w", "-m", "--unicode-spaces"], input=data, capture_output=True)
+        plain = subprocess.run([BINARY, "-w"], input=data, capture_output=True)
+
+        assert [int(n) for n in spaced.stdout.split()] == [len(text.split()), len(text)]
+        assert int(plain.stdout) == len(data.split())
+
+    @pytest.mark.parametrize("jobs", ["1", "3"])
+    def test_word_consumers_split_at_unicode_spaces(self, utf8_file, jobs):
+        """Test that --top and --distinct use the same words as -w --unicode-spaces"""
+        from collections import Counter
+        file, text = utf8_file
+        top = subprocess.run([BINARY, "-j", jobs, "--unicode-spaces", "--top", "5", str(file)],
+                             capture_output=True)
+        distinct = subprocess.run([BINARY, "-w", "--unicode-spaces", "--distinct"],
+                                  input="a\u00a0b a\u3000c\n".encode(), capture_output=True)
+
+        counts = Counter(word.encode() for word in text.split())
+        ranked = sorted(counts.items(), key=lambda item: (-item[1], item[0]))
+        assert TestTop.parse_top(top.stdout) == [(n, word) for word, n in ranked[:5]]
+        assert TestDistinct.parse_distinct(distinct.stdout) == (3, 0.81)
+        assert int(distinct.stdout.split()[0]) == 4
+
+
+class TestFiles0From:
+    """Test --files0-from lists and the io_uring reader used for long ones"""
+
+    @pytest.fixture
+    def many_files(self, tmp_path):
+        files = []
+        for i in range(200):
+            file = tmp_path / f"f{i}.txt"
+            # Every 50th file takes several 128 KiB reads
+            repeat = 40000 if i % 50 == 7 else i % 17
+            file.write_text("word " * repeat + "\n" * (i % 5))
+            files.append(str(file))
+        return files
+
+    @pytest.mark.parametrize("uring", ["1", "0"])
+    def test_list_matches_operands(self, many_files, uring):
+        """Test that a listed run prints what the same files as operands do"""
+        env = {**os.environ, "WORDCOUNT_URING": uring}
+        listed = subprocess.run([BINARY, "-j", "1", "--files0-from", "-"], input="\0".join(many_files),
+                                capture_output=True, text=True, env=env)
+        operands = subprocess.run([BINARY, "-j", "1"] + many_files, capture_output=True, text=True,
+                                  env={**os.environ, "WORDCOUNT_URING": "0"})
+
+        assert listed.returncode == 0
+        assert listed.stdout == operands.stdout
+        lines = listed.stdout.strip().split('\n')
+        assert [line.split()[-1] for line in lines] == many_files + ["total"]
+
+    @pytest.mark.parametrize("uring", ["1", "0"])
+    def test_error_stops_after_earlier_files(self, tmp_path, many_files, uring):
+        """Test that the files before an unreadable one are printed, and no total"""
+        many_files[120] = str(tmp_path / "missing.txt")
+        many_files[150] = str(tmp_path)
+        listing = tmp_path / "list"
+        listing.write_text("\0".join(many_files) + "\0")
+        result = subprocess.run([BINARY, "-j", "1", "--files0-from", str(listing)], capture_output=True, text=True,
+                                env={**os.environ, "WORDCOUNT_URING": uring})
+
+        assert result.returncode == 1
+        assert len(result.stdout.strip().split('\n')) == 120
+        assert result.stderr == f"Error: cannot open file '{many_files[120]}'\n"
+
+    def test_invalid_lists(self, sample_file):
+        """Test zero-length names and lists combined with file operands"""
+        empty_name = subprocess.run([BINARY, "--files0-from", "-"], input=f"{sample_file}\0\0",
+                                    capture_output=True, text=True)
+        with_operand = subprocess.run([BINARY, "--files0-from", "-", str(sample_file)], input="",
+                                      capture_output=True, text=True)
+        empty_list = subprocess.run([BINARY, "--files0-from", "-"], input="", capture_output=True, text=True)
+        empty_top = subprocess.run([BINARY, "--top", "3", "--files0-from", "-"], input="",
+                                   capture_output=True, text=True)
+        empty_estimate = subprocess.run([BINARY, "--estimate", "--files0-from", "-"], input="",
+                                        capture_output=True, text=True)
+
+        assert empty_name.returncode == 1
+        assert "zero-length file name" in empty_name.stderr
+        assert with_operand.returncode == 1
+        assert "cannot be combined" in with_operand.stderr
+        assert empty_list.returncode == 0
+        assert empty_list.stdout == ""
+        assert empty_top.returncode == 0
+        assert empty_top.stdout == ""
+        assert empty_estimate.returncode == 0
+        assert empty_estimate.stdout == ""
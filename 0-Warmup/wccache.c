@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "wccache.h"
+
+struct Cache {
+    char *path;
+    const CacheHeader *map;     // NULL when starting empty
+    size_t map_len;
+    const CacheRecord *table;
+    uint64_t capacity;
+
+    // Records stored during this run, written out by cache_save()
+    pthread_mutex_t lock;
+    CacheRecord *pending;
+    size_t npending;
+    size_t pending_cap;
+};
+
+static int64_t mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static uint64_t key_hash(uint64_t dev, uint64_t ino) {
+    // splitmix64 finalizer over both halves of the key
+    uint64_t h = dev * 0x9e3779b97f4a7c15ULL ^ ino;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// FNV-1a over the CACHE_TAIL_SZ bytes that end at size
+static bool tail_hash(int fd, uint64_t size, uint64_t *hash) {
+    unsigned char buf[CACHE_TAIL_SZ];
+    uint64_t start = size > CACHE_TAIL_SZ ? size - CACHE_TAIL_SZ : 0;
+    size_t len = (size_t)(size - start);
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, (off_t)(start + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t)n;
+    }
+
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ buf[i]) * 0x100000001b3ULL;
+    }
+    *hash = h;
+    return true;
+}
+
+static bool header_valid(const CacheHeader *hdr, size_t len) {
+    if (len < sizeof(CacheHeader) ||
+        memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != CACHE_VERSION ||
+        hdr->record_size != sizeof(CacheRecord) ||
+        hdr->capacity == 0 || (hdr->capacity & (hdr->capacity - 1)) != 0 ||
+        hdr->count >= hdr->capacity) {
+        return false;
+    }
+    return hdr->capacity <= (len - sizeof(CacheHeader)) / sizeof(CacheRecord) &&
+           len == sizeof(CacheHeader) + hdr->capacity * sizeof(CacheRecord);
+}
+
+Cache *cache_open(const char *path) {
+    Cache *cache = calloc(1, sizeof(Cache));
+    if (!cache || !(cache->path = strdup(path))) {
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0) {
+        return cache;
+    }
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            if (header_valid(map, (size_t)st.st_size)) {
+                cache->map = map;
+                cache->map_len = (size_t)st.st_size;
+                cache->table = (const CacheRecord *)(cache->map + 1);
+                cache->capacity = cache->map->capacity;
+                madvise(map, cache->map_len, MADV_RANDOM);
+            } else {
+                munmap(map, (size_t)st.st_size);
+            }
+        }
+    }
+
+    close(fd);
+    return cache;
+}
+
+// Probe an open-addressing table for (dev, ino); returns the matching slot
+// or the empty slot where it would go, or capacity if every slot holds
+// another file (a damaged cache whose count does not match its table).
+static size_t probe(const CacheRecord *table, uint64_t capacity, uint64_t dev, uint64_t ino) {
+    size_t mask = (size_t)capacity - 1;
+    size_t slot = (size_t)key_hash(dev, ino) & mask;
+
+    for (uint64_t n = 0; n < capacity; n++) {
+        if (!table[slot].used || (table[slot].dev == dev && table[slot].ino == ino)) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return (size_t)capacity;
+}
+
+bool cache_lookup(Cache *cache, const struct stat *st, CacheRecord *rec) {
+    if (!cache->table) {
+        return false;
+    }
+
+    size_t slot = probe(cache->table, cache->capacity, (uint64_t)st->st_dev, (uint64_t)st->st_ino);
+    if (slot == cache->capacity || !cache->table[slot].used) {
+        return false;
+    }
+    *rec = cache->table[slot];
+    return true;
+}
+
+bool cache_is_current(const CacheRecord *rec, const struct stat *st) {
+    return rec->size == (uint64_t)st->st_size && rec->mtime_ns == mtime_ns(st);
+}
+
+bool cache_prefix_matches(const CacheRecord *rec, int fd) {
+    uint64_t hash;
+    return tail_hash(fd, rec->size, &hash) && hash == rec->tail_hash;
+}
+
+WordCounterState cache_state(const CacheRecord *rec) {
+    WordCounterState state = {
+        {(long)rec->lines, (long)rec->words, (long)rec->chars, 0},
+        rec->in_word,
+        rec->starts_word,
+        0
+    };
+    return state;
+}
+
+void cache_store(Cache *cache, int fd, const struct stat *st, const WordCounterState *state) {
+    struct stat after;
+    CacheRecord rec;
+
+    // Skip files that changed underneath the count
+    if (fstat(fd, &after) != 0 || after.st_size != st->st_size || mtime_ns(&after) != mtime_ns(st)) {
+        return;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.dev = (uint64_t)st->st_dev;
+    rec.ino = (uint64_t)st->st_ino;
+    rec.size = (uint64_t)st->st_size;
+    rec.mtime_ns = mtime_ns(st);
+    rec.lines = state->counts.lines;
+    rec.words = state->counts.words;
+    rec.chars = state->counts.chars;
+    rec.in_word = state->in_word;
+    rec.starts_word = state->starts_word;
+    rec.used = 1;
+    if (!tail_hash(fd, rec.size, &rec.tail_hash)) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->npending == cache->pending_cap) {
+        size_t cap = cache->pending_cap ? cache->pending_cap * 2 : 64;
+        CacheRecord *grown = realloc(cache->pending, cap * sizeof(CacheRecord));
+        if (!grown) {
+            pthread_mutex_unlock(&cache->lock);
+            return;
+        }
+        cache->pending = grown;
+        cache->pending_cap = cap;
+    }
+    cache->pending[cache->npending++] = rec;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static void table_insert(CacheRecord *table, uint64_t capacity, const CacheRecord *rec, uint64_t *count) {
+    size_t i = probe(table, capacity, rec->dev, rec->ino);
+    if (i == capacity) {
+        return;
+    }
+
+    CacheRecord *slot = &table[i];
+    if (!slot->used) {
+        (*count)++;
+    }
+    *slot = *rec;
+}
+
+int cache_save(Cache *cache) {
+    if (cache->npending == 0) {
+        return 0;
+    }
+
+    // Size the table by the records actually there, not the stored count
+    uint64_t old_count = 0;
+    for (uint64_t i = 0; i < cache->capacity; i++) {
+        old_count += cache->table[i].used != 0;
+    }
+    uint64_t capacity = 16;
+    while (capacity < 2 * (old_count + cache->npending)) {
+        capacity *= 2;
+    }
+
+    size_t len = sizeof(CacheHeader) + capacity * sizeof(CacheRecord);
+    CacheHeader *hdr = calloc(1, len);
+    if (!hdr) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    CacheRecord *table = (CacheRecord *)(hdr + 1);
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < cache->capacity; i++) {
+        if (cache->table[i].used) {
+            table_insert(table, capacity, &cache->table[i], &count);
+        }
+    }
+    for (size_t i = 0; i < cache->npending; i++) {
+        table_insert(table, capacity, &cache->pending[i], &count);
+    }
+
+    memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version = CACHE_VERSION;
+    hdr->record_size = sizeof(CacheRecord);
+    hdr->capacity = capacity;
+    hdr->count = count;
+
+    char *tmp_path = malloc(strlen(cache->path) + 32);
+    if (!tmp_path) {
+        free(hdr);
+        errno = ENOMEM;
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp.%ld", cache->path, (long)getpid());
+
+    int rc = -1;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        const char *p = (const char *)hdr;
+        size_t left = len;
+        while (left > 0) {
+            ssize_t n = write(fd, p, left);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            p += n;
+            left -= (size_t)n;
+        }
+        if (close(fd) == 0 && left == 0 && rename(tmp_path, cache->path) == 0) {
+            rc = 0;
+        } else {
+            unlink(tmp_path);
+        }
+    }
+
+    free(tmp_path);
+    free(hdr);
+    return rc;
+}
+
+void cache_close(Cache *cache) {
+    if (cache->map) {
+        munmap((void *)cache->map, cache->map_len);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->pending);
+    free(cache->path);
+    free(cache);
+}
@@ -0,0 +1,114 @@
+#ifndef __WCCACHE_H__
+#define __WCCACHE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "wclib.h"
+
+//===================================================================
+// PERSISTENT COUNTS CACHE (--cache FILE)
+//===================================================================
+
+// On-disk layout, native byte order, meant to be mapped read-only:
+//
+//   CacheHeader
+//   CacheRecord[capacity]    open-addressing table keyed by (dev, ino)
+//
+// A record answers for a file only while its size and mtime_ns still
+// match. A record for a smaller size is the counter state of a prefix,
+// which an append-only file can resume from.
+#define CACHE_MAGIC     "WCCACHE\0"
+#define CACHE_VERSION   1
+
+// Bytes hashed just before the cached size to check a prefix is unchanged
+#define CACHE_TAIL_SZ   4096
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;      // power of two
+    uint64_t count;
+} CacheHeader;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t lines;
+    int64_t words;
+    int64_t chars;
+    uint64_t tail_hash;     // hash of the CACHE_TAIL_SZ bytes before size
+    uint8_t used;
+    uint8_t in_word;
+    uint8_t starts_word;
+    uint8_t pad[5];
+} CacheRecord;
+
+typedef struct Cache Cache;
+
+/**
+ * cache_open - Map an existing cache file, or start an empty cache
+ *
+ * A missing, foreign or corrupt file is treated as an empty cache and
+ * replaced by cache_save().
+ *
+ * Returns: cache handle, or NULL if out of memory
+ */
+Cache *cache_open(const char *path);
+
+/**
+ * cache_lookup - Find the record for the file st describes
+ *
+ * Thread safe. The record may be for an older size or mtime; the caller
+ * decides whether it is current (cache_is_current) or a resumable prefix.
+ *
+ * Returns: true if a record for (st_dev, st_ino) was found
+ */
+bool cache_lookup(Cache *cache, const struct stat *st, CacheRecord *rec);
+
+/**
+ * cache_is_current - True if rec describes the file exactly as st does
+ */
+bool cache_is_current(const CacheRecord *rec, const struct stat *st);
+
+/**
+ * cache_prefix_matches - True if fd still starts with the bytes rec saw
+ *
+ * Only the CACHE_TAIL_SZ bytes before rec->size are compared, which
+ * catches files that were rewritten rather than appended to.
+ */
+bool cache_prefix_matches(const CacheRecord *rec, int fd);
+
+/**
+ * cache_state - Counter state stored in a record
+ */
+WordCounterState cache_state(const CacheRecord *rec);
+
+/**
+ * cache_store - Remember the final counter state for fd
+ *
+ * Thread safe. st must be the fd's stat from before counting started;
+ * nothing is stored if the file changed while it was being counted.
+ */
+void cache_store(Cache *cache, int fd, const struct stat *st, const WordCounterState *state);
+
+/**
+ * cache_save - Write the cache with all stored records, if any changed
+ *
+ * The new table is written to a temporary file and renamed over the
+ * old one, so readers never see a partial table.
+ *
+ * Returns: 0 on success, -1 on error (errno set)
+ */
+int cache_save(Cache *cache);
+
+/**
+ * cache_close - Unmap and free the cache (without saving)
+ */
+void cache_close(Cache *cache);
+
+#endif
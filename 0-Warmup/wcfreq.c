@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wclib.h"
+#include "wcfreq.h"
+
+#define FREQ_INITIAL_CAPACITY 1024
+
+static void *arena_alloc(Arena *arena, size_t len) {
+    ArenaBlock *block = arena->head;
+
+    if (!block || block->size - block->used < len) {
+        // Big words get a block of their own behind the current one, so
+        // the space left in the current block is not wasted
+        bool dedicated = len > ARENA_BLOCK_SZ / 4;
+        size_t size = dedicated ? len : ARENA_BLOCK_SZ;
+
+        block = malloc(sizeof(ArenaBlock) + size);
+        if (!block) {
+            return NULL;
+        }
+        block->size = size;
+        block->used = 0;
+        if (dedicated && arena->head) {
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+
+    void *p = block->data + block->used;
+    block->used += len;
+    return p;
+}
+
+static void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->head;
+
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+static uint32_t hash_word(const unsigned char *word, size_t len) {
+    uint32_t h = (uint32_t)wc_hash(word, len);
+
+    // 0 marks an empty slot
+    return h ? h : 1;
+}
+
+int freq_init(FreqTable *table) {
+    table->capacity = FREQ_INITIAL_CAPACITY;
+    table->count = 0;
+    table->arena.head = NULL;
+    table->slots = calloc(table->capacity, sizeof(FreqEntry));
+    return table->slots ? 0 : -1;
+}
+
+static int freq_grow(FreqTable *table) {
+    size_t capacity = table->capacity * 2;
+    FreqEntry *slots = calloc(capacity, sizeof(FreqEntry));
+    if (!slots) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        FreqEntry *e = &table->slots[i];
+        if (e->hash) {
+            size_t slot = e->hash & (capacity - 1);
+            while (slots[slot].hash) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = *e;
+        }
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
+}
+
+static int freq_add_hashed(FreqTable *table, const unsigned char *word, size_t len, uint32_t hash, long n) {
+    size_t mask = table->capacity - 1;
+    size_t slot = hash & mask;
+
+    for (;;) {
+        FreqEntry *e = &table->slots[slot];
+        if (!e->hash) {
+            break;
+        }
+        if (e->hash == hash && e->len == len && memcmp(e->word, word, len) == 0) {
+            e->count += n;
+            return 0;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if ((table->count + 1) * 4 > table->capacity * 3) {
+        if (freq_grow(table) != 0) {
+            return -1;
+        }
+        return freq_add_hashed(table, word, len, hash, n);
+    }
+
+    unsigned char *copy = arena_alloc(&table->arena, len);
+    if (!copy && len > 0) {
+        return -1;
+    }
+    memcpy(copy, word, len);
+
+    FreqEntry *e = &table->slots[slot];
+    e->word = copy;
+    e->len = len;
+    e->hash = hash;
+    e->count = n;
+    table->count++;
+    return 0;
+}
+
+int freq_add(FreqTable *table, const unsigned char *word, size_t len, long n) {
+    return freq_add_hashed(table, word, len, hash_word(word, len), n);
+}
+
+int freq_add_words(FreqTable *table, const unsigned char *buf, size_t len, bool unicode_spaces) {
+    size_t i = 0;
+    size_t n;
+
+    while (i < len) {
+        while (i < len && (n = wc_space_len(buf + i, len - i, unicode_spaces)) > 0) {
+            i += n;
+        }
+        size_t start = i;
+        while (i < len && wc_space_len(buf + i, len - i, unicode_spaces) == 0) {
+            i++;
+        }
+        if (i > start && freq_add(table, buf + start, i - start, 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int freq_merge(FreqTable *dst, const FreqTable *src) {
+    for (size_t i = 0; i < src->capacity; i++) {
+        const FreqEntry *e = &src->slots[i];
+        if (e->hash && freq_add_hashed(dst, e->word, e->len, e->hash, e->count) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// True if a should be listed before b
+static bool ranks_before(const FreqEntry *a, const FreqEntry *b) {
+    if (a->count != b->count) {
+        return a->count > b->count;
+    }
+
+    size_t common = a->len < b->len ? a->len : b->len;
+    int cmp = memcmp(a->word, b->word, common);
+    return cmp != 0 ? cmp < 0 : a->len < b->len;
+}
+
+// Keep the best k entries in a binary min-heap whose root is the worst
+// of them, so each candidate costs O(log k).
+static void sift_down(FreqEntry *heap, size_t n, size_t i) {
+    for (;;) {
+        size_t worst = i;
+        size_t l = 2 * i + 1;
+        size_t r = l + 1;
+
+        if (l < n && ranks_before(&heap[worst], &heap[l])) {
+            worst = l;
+        }
+        if (r < n && ranks_before(&heap[worst], &heap[r])) {
+            worst = r;
+        }
+        if (worst == i) {
+            return;
+        }
+        FreqEntry tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+size_t freq_top(const FreqTable *table, size_t k, FreqEntry *out) {
+    size_t n = 0;
+
+    if (k == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        const FreqEntry *e = &table->slots[i];
+        if (!e->hash) {
+            continue;
+        }
+        if (n < k) {
+            out[n++] = *e;
+            if (n == k) {
+                for (size_t j = k / 2; j-- > 0;) {
+                    sift_down(out, k, j);
+                }
+            }
+        } else if (ranks_before(e, &out[0])) {
+            out[0] = *e;
+            sift_down(out, k, 0);
+        }
+    }
+
+    if (n < k) {
+        for (size_t j = n / 2; j-- > 0;) {
+            sift_down(out, n, j);
+        }
+    }
+
+    // Pop the worst to the back until the heap is empty: best first
+    for (size_t end = n; end > 1; end--) {
+        FreqEntry tmp = out[0];
+        out[0] = out[end - 1];
+        out[end - 1] = tmp;
+        sift_down(out, end - 1, 0);
+    }
+    return n;
+}
+
+void freq_free(FreqTable *table) {
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    arena_free(&table->arena);
+}
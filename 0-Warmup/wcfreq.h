@@ -0,0 +1,90 @@
+#ifndef __WCFREQ_H__
+#define __WCFREQ_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//===================================================================
+// WORD FREQUENCY TABLE (--top K)
+//===================================================================
+
+// Words are copied into a bump arena of ARENA_BLOCK_SZ blocks and are
+// never freed individually; the whole arena goes with the table.
+#define ARENA_BLOCK_SZ (1024 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    unsigned char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+} Arena;
+
+typedef struct {
+    const unsigned char *word;  // points into the table's arena
+    size_t len;
+    uint32_t hash;              // low bits of the word hash, 0 = empty slot
+    long count;
+} FreqEntry;
+
+// Open-addressing table with linear probing, kept at most 3/4 full
+typedef struct {
+    FreqEntry *slots;
+    size_t capacity;            // power of two
+    size_t count;
+    Arena arena;
+} FreqTable;
+
+/**
+ * freq_init - Set up an empty table
+ *
+ * Returns: 0 on success, -1 if out of memory
+ */
+int freq_init(FreqTable *table);
+
+/**
+ * freq_add - Add n occurrences of one word
+ *
+ * Returns: 0 on success, -1 if out of memory
+ */
+int freq_add(FreqTable *table, const unsigned char *word, size_t len, long n);
+
+/**
+ * freq_add_words - Add every word in buf
+ *
+ * Uses the same word boundaries as the line/word counter (wc_space_len),
+ * including the multi-byte Unicode spaces if unicode_spaces is set. The
+ * buffer is treated as complete: a word running into its end ends there,
+ * so callers must split streams at ASCII whitespace.
+ *
+ * Returns: 0 on success, -1 if out of memory
+ */
+int freq_add_words(FreqTable *table, const unsigned char *buf, size_t len, bool unicode_spaces);
+
+/**
+ * freq_merge - Add every word count of src into dst
+ *
+ * Returns: 0 on success, -1 if out of memory
+ */
+int freq_merge(FreqTable *dst, const FreqTable *src);
+
+/**
+ * freq_top - The k most frequent words, most frequent first
+ *
+ * Ties are broken by byte order of the words. out must hold k entries;
+ * the entries point into the table and stay valid until freq_free().
+ *
+ * Returns: number of entries written (less than k if the table is smaller)
+ */
+size_t freq_top(const FreqTable *table, size_t k, FreqEntry *out);
+
+/**
+ * freq_free - Release the table and its arena
+ */
+void freq_free(FreqTable *table);
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "wclib.h"
+#include "wchll.h"
+
+int hll_init(HyperLogLog *hll, int precision) {
+    if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION) {
+        return -1;
+    }
+
+    hll->precision = precision;
+    hll->registers = calloc((size_t)1 << precision, 1);
+    return hll->registers ? 0 : -1;
+}
+
+// The top `precision` bits pick a register; the register keeps the longest
+// run of leading zeros (+1) seen in the remaining bits.
+static void hll_add_hash(HyperLogLog *hll, uint64_t hash) {
+    int p = hll->precision;
+    size_t idx = (size_t)(hash >> (64 - p));
+    // The sentinel bit caps the rank at 64 - p + 1
+    uint64_t rest = (hash << p) | ((uint64_t)1 << (p - 1));
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+
+    if (rank > hll->registers[idx]) {
+        hll->registers[idx] = rank;
+    }
+}
+
+void hll_add(HyperLogLog *hll, const unsigned char *word, size_t len) {
+    hll_add_hash(hll, wc_hash(word, len));
+}
+
+int hll_add_words(HyperLogLog *hll, const unsigned char *buf, size_t len, bool unicode_spaces) {
+    size_t i = 0;
+    size_t n;
+
+    while (i < len) {
+        while (i < len && (n = wc_space_len(buf + i, len - i, unicode_spaces)) > 0) {
+            i += n;
+        }
+        size_t start = i;
+        while (i < len && wc_space_len(buf + i, len - i, unicode_spaces) == 0) {
+            i++;
+        }
+        if (i > start) {
+            hll_add(hll, buf + start, i - start);
+        }
+    }
+    return 0;
+}
+
+void hll_merge(HyperLogLog *dst, const HyperLogLog *src) {
+    size_t m = (size_t)1 << dst->precision;
+
+    for (size_t i = 0; i < m; i++) {
+        if (src->registers[i] > dst->registers[i]) {
+            dst->registers[i] = src->registers[i];
+        }
+    }
+}
+
+// Flajolet et al. raw estimate with the linear-counting correction for
+// small cardinalities. With 64-bit hashes no large-range correction is needed.
+double hll_estimate(const HyperLogLog *hll) {
+    size_t m = (size_t)1 << hll->precision;
+    double sum = 0;
+    size_t zeros = 0;
+
+    for (size_t i = 0; i < m; i++) {
+        sum += ldexp(1.0, -hll->registers[i]);
+        zeros += hll->registers[i] == 0;
+    }
+
+    double alpha;
+    switch (m) {
+        case 16:  alpha = 0.673; break;
+        case 32:  alpha = 0.697; break;
+        case 64:  alpha = 0.709; break;
+        default:  alpha = 0.7213 / (1.0 + 1.079 / m); break;
+    }
+
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log((double)m / zeros);
+    }
+    return estimate;
+}
+
+double hll_error(const HyperLogLog *hll) {
+    return 1.04 / sqrt((double)((size_t)1 << hll->precision));
+}
+
+void hll_clear(HyperLogLog *hll) {
+    if (hll->registers) {
+        memset(hll->registers, 0, (size_t)1 << hll->precision);
+    }
+}
+
+void hll_free(HyperLogLog *hll) {
+    free(hll->registers);
+    hll->registers = NULL;
+}
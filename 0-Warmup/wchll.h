@@ -0,0 +1,69 @@
+#ifndef __WCHLL_H__
+#define __WCHLL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//===================================================================
+// DISTINCT WORD ESTIMATE (--distinct, HyperLogLog)
+//===================================================================
+
+// 2^precision one-byte registers: 16 KiB at the default precision, with a
+// relative standard error of 1.04 / sqrt(2^precision) = 0.81%
+#define HLL_MIN_PRECISION       4
+#define HLL_MAX_PRECISION       18
+#define HLL_DEFAULT_PRECISION   14
+
+typedef struct {
+    int precision;
+    uint8_t *registers;
+} HyperLogLog;
+
+/**
+ * hll_init - Set up an empty sketch
+ *
+ * Returns: 0 on success, -1 if out of memory or precision out of range
+ */
+int hll_init(HyperLogLog *hll, int precision);
+
+/**
+ * hll_add - Add one word
+ */
+void hll_add(HyperLogLog *hll, const unsigned char *word, size_t len);
+
+/**
+ * hll_add_words - Add every word in buf
+ *
+ * Same word boundaries and buffer rules as freq_add_words().
+ *
+ * Returns: 0 (cannot fail; matches the freq_add_words() signature)
+ */
+int hll_add_words(HyperLogLog *hll, const unsigned char *buf, size_t len, bool unicode_spaces);
+
+/**
+ * hll_merge - Fold src into dst; both must have the same precision
+ */
+void hll_merge(HyperLogLog *dst, const HyperLogLog *src);
+
+/**
+ * hll_estimate - Estimated number of distinct words added
+ */
+double hll_estimate(const HyperLogLog *hll);
+
+/**
+ * hll_error - Relative standard error of the estimate (e.g. 0.0081)
+ */
+double hll_error(const HyperLogLog *hll);
+
+/**
+ * hll_clear - Empty the sketch for reuse; a no-op on a released one
+ */
+void hll_clear(HyperLogLog *hll);
+
+/**
+ * hll_free - Release the registers
+ */
+void hll_free(HyperLogLog *hll);
+
+#endif
@@ -0,0 +1,570 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "wclib.h"
+
+// A kernel counts whatever the mode asks for among newlines, word starts
+// and UTF-8 lead bytes in one block, continuing from and updating st's word
+// state. chars are added up by wc_feed().
+typedef void (*count_kernel_t)(const unsigned char *buf, size_t len, WordCounterState *st);
+
+enum { SPACE_NO, SPACE_PREFIX, SPACE_FULL };
+
+// Classify a UTF-8 byte sequence (packed big-endian, one to three bytes)
+// against the multi-byte Unicode spaces: U+0085, U+00A0, U+1680,
+// U+2000..U+200A, U+2028, U+2029, U+202F, U+205F and U+3000.
+static inline int unicode_space_match(uint32_t seq) {
+    switch (seq) {
+    case 0xC2: case 0xE1: case 0xE2: case 0xE3:
+    case 0xE19A: case 0xE280: case 0xE281: case 0xE380:
+        return SPACE_PREFIX;
+    case 0xC285: case 0xC2A0: case 0xE19A80: case 0xE280A8:
+    case 0xE280A9: case 0xE280AF: case 0xE2819F: case 0xE38080:
+        return SPACE_FULL;
+    }
+    return seq >= 0xE28080 && seq <= 0xE2808A ? SPACE_FULL : SPACE_NO;
+}
+
+size_t wc_unicode_space_len(const unsigned char *buf, size_t len) {
+    uint32_t seq = 0;
+
+    for (size_t i = 0; i < len && i < 3; i++) {
+        seq = seq << 8 | buf[i];
+        int match = unicode_space_match(seq);
+        if (match != SPACE_PREFIX) {
+            return match == SPACE_FULL ? i + 1 : 0;
+        }
+    }
+    return 0;
+}
+
+// The kernels below are written once over a constant mode and inlined into
+// one function per mode, so unused features cost nothing: -l alone is a
+// newline count, -c alone does not look at the bytes at all.
+static inline __attribute__((always_inline))
+void count_scalar(const unsigned char *buf, size_t len, WordCounterState *st, unsigned mode) {
+    if (!(mode & (WC_LINES | WC_WORDS | WC_CODEPOINTS))) {
+        return;
+    }
+
+    long lines = 0;
+    long words = 0;
+    long codepoints = 0;
+    bool w = st->in_word;
+    uint32_t pending = st->pending;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = buf[i];
+
+        if (mode & WC_LINES) {
+            lines += c == '\n';
+        }
+        if (mode & WC_CODEPOINTS) {
+            codepoints += (c & 0xC0) != 0x80;
+        }
+        if (!(mode & WC_WORDS)) {
+            continue;
+        }
+
+        if (mode & WC_UNICODE_SPACES) {
+            if (pending) {
+                uint32_t seq = pending << 8 | c;
+                int match = unicode_space_match(seq);
+                if (match == SPACE_PREFIX) {
+                    pending = seq;
+                    continue;
+                }
+                pending = 0;
+                if (match == SPACE_FULL) {
+                    w = false;
+                    continue;
+                }
+                // The prefix was some other character; c stands on its own
+                if (!w) {
+                    w = true;
+                    words++;
+                }
+            }
+            if (unicode_space_match(c) == SPACE_PREFIX) {
+                pending = c;
+                continue;
+            }
+        }
+
+        if (wc_is_space(c)) {
+            w = false;
+        } else if (!w) {
+            w = true;
+            words++;
+        }
+    }
+
+    st->counts.lines += lines;
+    st->counts.words += words;
+    st->counts.codepoints += codepoints;
+    st->in_word = w;
+    st->pending = pending;
+}
+
+// Instantiate name_<mode> for every mode from core(buf, len, st, mode)
+#define DEFINE_MODE_KERNEL(name, core, attr, mode) \
+    attr static void name##_##mode(const unsigned char *buf, size_t len, WordCounterState *st) { \
+        core(buf, len, st, mode); \
+    }
+#define DEFINE_MODE_KERNELS(name, core, attr) \
+    DEFINE_MODE_KERNEL(name, core, attr, 0)  DEFINE_MODE_KERNEL(name, core, attr, 1)  \
+    DEFINE_MODE_KERNEL(name, core, attr, 2)  DEFINE_MODE_KERNEL(name, core, attr, 3)  \
+    DEFINE_MODE_KERNEL(name, core, attr, 4)  DEFINE_MODE_KERNEL(name, core, attr, 5)  \
+    DEFINE_MODE_KERNEL(name, core, attr, 6)  DEFINE_MODE_KERNEL(name, core, attr, 7)  \
+    DEFINE_MODE_KERNEL(name, core, attr, 8)  DEFINE_MODE_KERNEL(name, core, attr, 9)  \
+    DEFINE_MODE_KERNEL(name, core, attr, 10) DEFINE_MODE_KERNEL(name, core, attr, 11) \
+    DEFINE_MODE_KERNEL(name, core, attr, 12) DEFINE_MODE_KERNEL(name, core, attr, 13) \
+    DEFINE_MODE_KERNEL(name, core, attr, 14) DEFINE_MODE_KERNEL(name, core, attr, 15)
+#define MODE_KERNELS(name) { \
+    name##_0, name##_1, name##_2,  name##_3,  name##_4,  name##_5,  name##_6,  name##_7, \
+    name##_8, name##_9, name##_10, name##_11, name##_12, name##_13, name##_14, name##_15}
+
+DEFINE_MODE_KERNELS(count_block_scalar, count_scalar, )
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Fold the whitespace bitmask of one 64-byte chunk into the word count. A
+// word starts at every non-space byte whose predecessor is a space; bit 0's
+// predecessor is the last byte of the previous chunk.
+static inline void count_word_starts(uint64_t ws_mask, WordCounterState *st) {
+    uint64_t prev_ws = (ws_mask << 1) | (st->in_word ? 0 : 1);
+
+    st->counts.words += __builtin_popcountll(~ws_mask & prev_ws);
+    st->in_word = !(ws_mask >> 63);
+}
+
+// Every byte of a multi-byte space counts as whitespace, so word starts stay
+// byte transitions. s2/s3 mark where 2- and 3-byte spaces begin; the bytes
+// they spill into the next chunk are returned in *carry.
+static inline uint64_t spread_spaces(uint64_t s2, uint64_t s3, uint64_t *carry) {
+    uint64_t in_chunk = *carry | s2 | (s2 << 1) | s3 | (s3 << 1) | (s3 << 2);
+
+    *carry = (s2 >> 63) | (s3 >> 63) | (s3 >> 62);
+    return in_chunk;
+}
+
+// Unicode spaces whose sequences begin in the 16 (32) bytes at p, which
+// must have two readable bytes past them, as 2-byte and 3-byte start masks
+__attribute__((target("sse2")))
+static inline void unicode_spaces_sse2(const unsigned char *p, uint32_t *s2, uint32_t *s3) {
+    __m128i b0 = _mm_loadu_si128((const __m128i *)p);
+    __m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+    __m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+#define EQ(x, c) _mm_cmpeq_epi8(x, _mm_set1_epi8((char)(c)))
+    __m128i t = _mm_sub_epi8(b2, _mm_set1_epi8((char)0x80));
+    __m128i en_spaces = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(0x0A)), t),
+                                     _mm_or_si128(_mm_or_si128(EQ(b2, 0xA8), EQ(b2, 0xA9)), EQ(b2, 0xAF)));
+    __m128i two = _mm_and_si128(EQ(b0, 0xC2), _mm_or_si128(EQ(b1, 0x85), EQ(b1, 0xA0)));
+    __m128i three = _mm_and_si128(_mm_and_si128(EQ(b0, 0xE2), EQ(b1, 0x80)), en_spaces);
+    three = _mm_or_si128(three, _mm_and_si128(_mm_and_si128(EQ(b0, 0xE1), EQ(b1, 0x9A)), EQ(b2, 0x80)));
+    three = _mm_or_si128(three, _mm_and_si128(_mm_and_si128(EQ(b0, 0xE2), EQ(b1, 0x81)), EQ(b2, 0x9F)));
+    three = _mm_or_si128(three, _mm_and_si128(_mm_and_si128(EQ(b0, 0xE3), EQ(b1, 0x80)), EQ(b2, 0x80)));
+#undef EQ
+    *s2 = (uint16_t)_mm_movemask_epi8(two);
+    *s3 = (uint16_t)_mm_movemask_epi8(three);
+}
+
+__attribute__((target("avx2")))
+static inline void unicode_spaces_avx2(const unsigned char *p, uint32_t *s2, uint32_t *s3) {
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+    __m256i b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+#define EQ(x, c) _mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)(c)))
+    __m256i t = _mm256_sub_epi8(b2, _mm256_set1_epi8((char)0x80));
+    __m256i en_spaces = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(0x0A)), t),
+                                        _mm256_or_si256(_mm256_or_si256(EQ(b2, 0xA8), EQ(b2, 0xA9)), EQ(b2, 0xAF)));
+    __m256i two = _mm256_and_si256(EQ(b0, 0xC2), _mm256_or_si256(EQ(b1, 0x85), EQ(b1, 0xA0)));
+    __m256i three = _mm256_and_si256(_mm256_and_si256(EQ(b0, 0xE2), EQ(b1, 0x80)), en_spaces);
+    three = _mm256_or_si256(three, _mm256_and_si256(_mm256_and_si256(EQ(b0, 0xE1), EQ(b1, 0x9A)), EQ(b2, 0x80)));
+    three = _mm256_or_si256(three, _mm256_and_si256(_mm256_and_si256(EQ(b0, 0xE2), EQ(b1, 0x81)), EQ(b2, 0x9F)));
+    three = _mm256_or_si256(three, _mm256_and_si256(_mm256_and_si256(EQ(b0, 0xE3), EQ(b1, 0x80)), EQ(b2, 0x80)));
+#undef EQ
+    *s2 = (uint32_t)_mm256_movemask_epi8(two);
+    *s3 = (uint32_t)_mm256_movemask_epi8(three);
+}
+
+// Shared driver for the vector kernels. Counting newlines alone needs no
+// bitmasks and has its own loop. A multi-byte space left open by the
+// previous feed is finished in scalar code first; in WC_UNICODE_SPACES mode
+// the loop also stops two bytes early so the lookahead loads stay in bounds,
+// then skips the tail bytes of a space that spilled out of the last chunk.
+#define VECTOR_KERNEL_BODY(WIDTH, classify, spaces, newlines)                  \
+    if (!(mode & (WC_WORDS | WC_CODEPOINTS))) {                                \
+        if (mode & WC_LINES) {                                                 \
+            st->counts.lines += newlines(buf, len);                            \
+        }                                                                      \
+        return;                                                                \
+    }                                                                          \
+    if (!(mode & WC_WORDS)) {                                                  \
+        mode &= ~WC_UNICODE_SPACES;                                            \
+    }                                                                          \
+    size_t i = 0;                                                              \
+    size_t lookahead = (mode & WC_UNICODE_SPACES) ? 2 : 0;                     \
+    uint64_t carry = 0;                                                        \
+                                                                               \
+    while ((mode & WC_UNICODE_SPACES) && st->pending && i < len) {             \
+        count_scalar(buf + i++, 1, st, mode);                                  \
+    }                                                                          \
+    for (; i + 64 + lookahead <= len; i += 64) {                               \
+        uint64_t nl_mask = 0;                                                  \
+        uint64_t ws_mask = 0;                                                  \
+        uint64_t lead_mask = 0;                                                \
+        uint64_t high_mask = 0;                                                \
+                                                                               \
+        for (int k = 0; k < 64 / WIDTH; k++) {                                 \
+            uint32_t nl, ws, lead, high;                                       \
+            classify(buf + i + WIDTH * k, &nl, &ws, &lead, &high, mode);       \
+            nl_mask |= (uint64_t)nl << (WIDTH * k);                            \
+            ws_mask |= (uint64_t)ws << (WIDTH * k);                            \
+            lead_mask |= (uint64_t)lead << (WIDTH * k);                        \
+            high_mask |= (uint64_t)high << (WIDTH * k);                        \
+        }                                                                      \
+        if (mode & WC_LINES) {                                                 \
+            st->counts.lines += __builtin_popcountll(nl_mask);                 \
+        }                                                                      \
+        if (mode & WC_CODEPOINTS) {                                            \
+            st->counts.codepoints += __builtin_popcountll(lead_mask);          \
+        }                                                                      \
+        if (mode & WC_UNICODE_SPACES) {                                        \
+            uint64_t s2 = 0;                                                   \
+            uint64_t s3 = 0;                                                   \
+            /* Only chunks with a byte in 0xC2..0xE3 can hold a space */       \
+            if (high_mask) {                                                   \
+                for (int k = 0; k < 64 / WIDTH; k++) {                         \
+                    uint32_t m2, m3;                                           \
+                    spaces(buf + i + WIDTH * k, &m2, &m3);                     \
+                    s2 |= (uint64_t)m2 << (WIDTH * k);                         \
+                    s3 |= (uint64_t)m3 << (WIDTH * k);                         \
+                }                                                              \
+            }                                                                  \
+            ws_mask |= spread_spaces(s2, s3, &carry);                          \
+        }                                                                      \
+        if (mode & WC_WORDS) {                                                 \
+            count_word_starts(ws_mask, st);                                    \
+        }                                                                      \
+    }                                                                          \
+    i += (size_t)__builtin_popcountll(carry);                                  \
+    count_scalar(buf + i, len - i, st, mode);
+
+__attribute__((target("sse2"), always_inline))
+static inline void classify_sse2(const unsigned char *p, uint32_t *nl, uint32_t *ws,
+                                 uint32_t *lead, uint32_t *high, unsigned mode) {
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    // '\t'..'\r' is a contiguous range: x - '\t' <= 4 (unsigned)
+    __m128i t = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                 _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t));
+
+    *nl = (mode & WC_LINES) ? (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))) : 0;
+    *ws = (mode & WC_WORDS) ? (uint16_t)_mm_movemask_epi8(space) : 0;
+    // Signed, continuation bytes 0x80..0xBF are the only ones below -64
+    *lead = (mode & WC_CODEPOINTS) ? (uint16_t)_mm_movemask_epi8(_mm_cmpgt_epi8(x, _mm_set1_epi8(-65))) : 0;
+    if (mode & WC_UNICODE_SPACES) {
+        __m128i h = _mm_sub_epi8(x, _mm_set1_epi8((char)0xC2));
+        *high = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(h, _mm_set1_epi8(0xE3 - 0xC2)), h));
+    } else {
+        *high = 0;
+    }
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void classify_avx2(const unsigned char *p, uint32_t *nl, uint32_t *ws,
+                                 uint32_t *lead, uint32_t *high, unsigned mode) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+    __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                    _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8('\r' - '\t')), t));
+
+    *nl = (mode & WC_LINES) ? (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'))) : 0;
+    *ws = (mode & WC_WORDS) ? (uint32_t)_mm256_movemask_epi8(space) : 0;
+    *lead = (mode & WC_CODEPOINTS) ? (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(-65))) : 0;
+    if (mode & WC_UNICODE_SPACES) {
+        __m256i h = _mm256_sub_epi8(x, _mm256_set1_epi8((char)0xC2));
+        *high = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(h, _mm256_set1_epi8(0xE3 - 0xC2)), h));
+    } else {
+        *high = 0;
+    }
+}
+
+// Newlines only: byte-wise match counters, summed into 64-bit lanes every
+// 255 vectors before they can wrap
+__attribute__((target("sse2")))
+static long count_newlines_sse2(const unsigned char *buf, size_t len) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        size_t stop = len - i > 255 * 16 ? i + 255 * 16 : len;
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 16 <= stop; i += 16) {
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i)), newline));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, _mm_setzero_si128()));
+    }
+
+    long lines = _mm_cvtsi128_si64(total) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+    for (; i < len; i++) {
+        lines += buf[i] == '\n';
+    }
+    return lines;
+}
+
+__attribute__((target("avx2")))
+static long count_newlines_avx2(const unsigned char *buf, size_t len) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        size_t stop = len - i > 255 * 32 ? i + 255 * 32 : len;
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 32 <= stop; i += 32) {
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), newline));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+    }
+
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    long lines = _mm_cvtsi128_si64(half) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(half, half));
+    for (; i < len; i++) {
+        lines += buf[i] == '\n';
+    }
+    return lines;
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline void count_sse2(const unsigned char *buf, size_t len, WordCounterState *st, unsigned mode) {
+    VECTOR_KERNEL_BODY(16, classify_sse2, unicode_spaces_sse2, count_newlines_sse2)
+}
+
+__attribute__((target("avx2,popcnt"), always_inline))
+static inline void count_avx2(const unsigned char *buf, size_t len, WordCounterState *st, unsigned mode) {
+    VECTOR_KERNEL_BODY(32, classify_avx2, unicode_spaces_avx2, count_newlines_avx2)
+}
+
+DEFINE_MODE_KERNELS(count_block_sse2, count_sse2, __attribute__((target("sse2"))))
+DEFINE_MODE_KERNELS(count_block_avx2, count_avx2, __attribute__((target("avx2,popcnt"))))
+#endif
+
+typedef struct {
+    const char *name;
+    count_kernel_t fn[WC_MODES];
+} Kernel;
+
+static const Kernel kernels[] = {
+    {"scalar", MODE_KERNELS(count_block_scalar)},
+#if defined(__x86_64__) || defined(__i386__)
+    {"sse2", MODE_KERNELS(count_block_sse2)},
+    {"avx2", MODE_KERNELS(count_block_avx2)},
+#endif
+};
+
+// Kernel and mode used by every counter, set once by wc_select_kernel()
+// and wc_select_mode(); active_fn is the specialization they resolve to
+static const Kernel *active_kernel = NULL;
+static unsigned active_mode = WC_LINES | WC_WORDS;
+static count_kernel_t active_fn = NULL;
+static pthread_once_t default_kernel_once = PTHREAD_ONCE_INIT;
+
+static bool kernel_supported(const Kernel *kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (strcmp(kernel->name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    }
+    if (strcmp(kernel->name, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return strcmp(kernel->name, "scalar") == 0;
+}
+
+const char *wc_select_kernel(const char *name) {
+    size_t nkernels = sizeof(kernels) / sizeof(kernels[0]);
+    const Kernel *best = &kernels[0];
+
+    for (size_t i = 0; i < nkernels; i++) {
+        if (!kernel_supported(&kernels[i])) {
+            continue;
+        }
+        if (name && strcmp(name, kernels[i].name) == 0) {
+            best = &kernels[i];
+            break;
+        }
+        // The table is ordered from narrowest to widest
+        best = &kernels[i];
+    }
+
+    active_kernel = best;
+    active_fn = active_kernel->fn[active_mode];
+    return active_kernel->name;
+}
+
+void wc_select_mode(unsigned mode) {
+    if (!(mode & WC_WORDS)) {
+        mode &= ~WC_UNICODE_SPACES;
+    }
+    active_mode = mode & (WC_MODES - 1);
+    if (active_kernel) {
+        active_fn = active_kernel->fn[active_mode];
+    }
+}
+
+static void select_default_kernel(void) {
+    if (!active_kernel) {
+        wc_select_kernel(NULL);
+    }
+}
+
+struct WordCounter {
+    WordCounterState state;
+};
+
+WordCounter *wc_init(void) {
+    pthread_once(&default_kernel_once, select_default_kernel);
+    return calloc(1, sizeof(WordCounter));
+}
+
+// Whether the first character of buf is part of a word. A multi-byte
+// space cut off by the end of buf is taken to be a space.
+static bool first_in_word(const unsigned char *buf, size_t len) {
+    if (active_mode & WC_UNICODE_SPACES) {
+        uint32_t seq = 0;
+        for (size_t i = 0; i < len && i < 3; i++) {
+            seq = seq << 8 | buf[i];
+            int match = unicode_space_match(seq);
+            if (match != SPACE_PREFIX) {
+                return match == SPACE_NO && (i > 0 || !wc_is_space(buf[0]));
+            }
+        }
+        return false;
+    }
+    return !wc_is_space(buf[0]);
+}
+
+// A space prefix still open at the end of the stream was some other
+// (truncated) character
+static void finish_pending(WordCounterState *st) {
+    if (st->pending) {
+        if (!st->in_word) {
+            st->counts.words++;
+        }
+        st->in_word = true;
+        st->pending = 0;
+    }
+}
+
+void wc_feed(WordCounter *wc, const void *buf, size_t len) {
+    WordCounterState *st = &wc->state;
+    const unsigned char *bytes = buf;
+
+    if (len == 0) {
+        return;
+    }
+    if (st->counts.chars == 0) {
+        st->starts_word = first_in_word(bytes, len);
+    }
+
+    st->counts.chars += (long)len;
+    active_fn(bytes, len, st);
+}
+
+Counts wc_counts(const WordCounter *wc) {
+    WordCounterState st = wc->state;
+
+    finish_pending(&st);
+    return st.counts;
+}
+
+size_t wc_boundary(const void *buf, size_t len, size_t pos) {
+    const unsigned char *bytes = buf;
+
+    if (active_mode & WC_UNICODE_SPACES) {
+        while (pos < len && (bytes[pos] & 0xC0) == 0x80) {
+            pos++;
+        }
+    }
+    return pos;
+}
+
+WordCounterState wc_save(const WordCounter *wc) {
+    return wc->state;
+}
+
+WordCounter *wc_restore(const WordCounterState *state) {
+    WordCounter *wc = wc_init();
+    if (wc) {
+        wc->state = *state;
+    }
+    return wc;
+}
+
+// Each counter starts as if it followed whitespace, so a word straddling the
+// boundary was counted by both sides; take one back when dst ended inside a
+// word and src began inside one.
+void wc_append(WordCounter *dst, const WordCounter *src) {
+    WordCounterState *d = &dst->state;
+    const WordCounterState *s = &src->state;
+
+    if (s->counts.chars == 0) {
+        return;
+    }
+    if (d->counts.chars == 0) {
+        *d = *s;
+        return;
+    }
+
+    finish_pending(d);
+    d->counts.lines += s->counts.lines;
+    d->counts.words += s->counts.words;
+    d->counts.chars += s->counts.chars;
+    d->counts.codepoints += s->counts.codepoints;
+    if (d->in_word && s->starts_word) {
+        d->counts.words--;
+    }
+    d->in_word = s->in_word;
+    d->pending = s->pending;
+}
+
+Counts wc_finish(WordCounter *wc) {
+    Counts counts = wc_counts(wc);
+
+    free(wc);
+    return counts;
+}
+
+// Multiply/xor-shift over eight bytes at a time, then a splitmix64 finalizer
+// so the high bits (which HyperLogLog uses) are as well mixed as the low ones
+uint64_t wc_hash(const void *buf, size_t len) {
+    const unsigned char *bytes = buf;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, bytes + i, 8);
+        h = (h ^ v) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    if (i < len) {
+        uint64_t v = 0;
+        memcpy(&v, bytes + i, len - i);
+        h = (h ^ v) * 0xc4ceb9fe1a85ec53ULL;
+    }
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
@@ -0,0 +1,148 @@
+#ifndef __WCLIB_H__
+#define __WCLIB_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//===================================================================
+// INCREMENTAL LINE/WORD/CHARACTER COUNTER (libwc.a)
+//===================================================================
+
+typedef struct {
+    long lines;
+    long words;
+    long chars;         // bytes
+    long codepoints;    // UTF-8 characters, in WC_CODEPOINTS mode only
+} Counts;
+
+// Word separators are exactly the bytes isspace() accepts in the "C" locale:
+// ' ', '\t', '\n', '\v', '\f' and '\r'. Everything else is part of a word.
+static inline bool wc_is_space(unsigned char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+/**
+ * wc_unicode_space_len - Length of the multi-byte Unicode space (see
+ * wc_select_mode()) that starts buf, or 0 if it starts with none
+ */
+size_t wc_unicode_space_len(const unsigned char *buf, size_t len);
+
+// Length of the word separator that starts buf (len > 0): 1 for an ASCII
+// space, 2 or 3 for a multi-byte Unicode space when unicode_spaces is set,
+// 0 for a byte of a word. Used by the word-level consumers, which split
+// buffers the same way the counters do.
+static inline size_t wc_space_len(const unsigned char *buf, size_t len, bool unicode_spaces) {
+    if (wc_is_space(buf[0])) {
+        return 1;
+    }
+    return unicode_spaces && buf[0] >= 0xC2 ? wc_unicode_space_len(buf, len) : 0;
+}
+
+// Opaque counter state. A counter accepts any number of wc_feed() calls
+// and gives the same result as counting the concatenated bytes at once;
+// words that span two feeds are counted once.
+typedef struct WordCounter WordCounter;
+
+// Everything needed to resume a counter later, e.g. from a persistent cache
+typedef struct {
+    Counts counts;
+    bool in_word;       // last byte fed was part of a word
+    bool starts_word;   // first character fed was part of a word
+    uint32_t pending;   // bytes of a possible multi-byte space not yet complete
+} WordCounterState;
+
+// What counters count, see wc_select_mode(). Bytes are always counted.
+#define WC_LINES            0x1     // count newlines
+#define WC_WORDS            0x2     // count words
+#define WC_CODEPOINTS       0x4     // count UTF-8 characters (non-continuation bytes)
+#define WC_UNICODE_SPACES   0x8     // multi-byte Unicode spaces also separate words
+#define WC_MODES            16
+
+/**
+ * wc_select_kernel - Choose the counting kernel used by all counters
+ *
+ * name is "scalar", "sse2" or "avx2", or NULL for the widest kernel the
+ * CPU supports. A kernel the CPU lacks falls back to the best available
+ * one. Call this before creating counters; if it is never called, the
+ * first wc_init() selects automatically.
+ *
+ * Returns: name of the kernel in use
+ */
+const char *wc_select_kernel(const char *name);
+
+/**
+ * wc_select_mode - Choose what all counters count
+ *
+ * mode is a combination of the WC_* flags above (default: WC_LINES |
+ * WC_WORDS); each combination has its own kernel, so counts that are not
+ * asked for cost nothing and are left at zero. With WC_UNICODE_SPACES,
+ * U+0085, U+00A0, U+1680, U+2000..U+200A, U+2028, U+2029, U+202F, U+205F and
+ * U+3000 separate words like the ASCII spaces do. Call this before creating
+ * counters.
+ */
+void wc_select_mode(unsigned mode);
+
+/**
+ * wc_init - Create a counter with all counts at zero
+ *
+ * Returns: new counter, or NULL if out of memory
+ */
+WordCounter *wc_init(void);
+
+/**
+ * wc_feed - Count the next len bytes of the stream
+ */
+void wc_feed(WordCounter *wc, const void *buf, size_t len);
+
+/**
+ * wc_counts - Counts for everything fed so far, without finishing
+ */
+Counts wc_counts(const WordCounter *wc);
+
+/**
+ * wc_append - Merge a counter for the bytes that directly follow dst's
+ *
+ * Used to combine counters that ran over adjacent ranges of one stream,
+ * e.g. on different threads. A word straddling the boundary is counted
+ * once. src is left unchanged and must still be finished.
+ */
+void wc_append(WordCounter *dst, const WordCounter *src);
+
+/**
+ * wc_boundary - First position at or after pos where buf may be split
+ *
+ * Counters for the two sides of the split can be merged with wc_append().
+ * Any position works unless WC_UNICODE_SPACES is on, when the split must
+ * fall between UTF-8 characters.
+ */
+size_t wc_boundary(const void *buf, size_t len, size_t pos);
+
+/**
+ * wc_save - Snapshot the counter's state
+ */
+WordCounterState wc_save(const WordCounter *wc);
+
+/**
+ * wc_restore - Create a counter that continues from a saved state
+ *
+ * Feeding it the bytes that followed the saved ones gives the same result
+ * as never having stopped.
+ *
+ * Returns: new counter, or NULL if out of memory
+ */
+WordCounter *wc_restore(const WordCounterState *state);
+
+/**
+ * wc_hash - 64-bit hash of a word, for word-level modes (--top, --distinct)
+ */
+uint64_t wc_hash(const void *buf, size_t len);
+
+/**
+ * wc_finish - Release the counter
+ *
+ * Returns: final counts for everything fed
+ */
+Counts wc_finish(WordCounter *wc);
+
+#endif
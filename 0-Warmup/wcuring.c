@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "wcuring.h"
+
+typedef enum {
+    SLOT_IDLE,
+    SLOT_OPENING,
+    SLOT_READING
+} SlotState;
+
+// One file being read: its openat() or its next read() is in flight
+typedef struct {
+    SlotState state;
+    size_t idx;
+    int fd;
+    unsigned char *buf;
+} Slot;
+
+struct UringReader {
+    int ring_fd;
+    unsigned depth;
+
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;               // same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned to_submit;
+    Slot *slots;
+    unsigned char *buffers;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nargs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static bool ops_supported(int ring_fd) {
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    bool ok = false;
+
+    if (probe && sys_io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        ok = probe->last_op >= IORING_OP_OPENAT && probe->last_op >= IORING_OP_READ &&
+             (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+             (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+UringReader *uring_open(unsigned depth) {
+    struct io_uring_params params;
+    UringReader *r = calloc(1, sizeof(UringReader));
+    if (!r) {
+        return NULL;
+    }
+
+    memset(&params, 0, sizeof(params));
+    r->ring_fd = sys_io_uring_setup(depth, &params);
+    if (r->ring_fd < 0) {
+        free(r);
+        return NULL;
+    }
+    r->depth = depth;
+    r->sq_map = r->cq_map = r->sqes = MAP_FAILED;
+    if (!ops_supported(r->ring_fd)) {
+        uring_close(r);
+        return NULL;
+    }
+
+    r->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_len > r->sq_map_len) {
+            r->sq_map_len = r->cq_map_len;
+        }
+        r->cq_map_len = r->sq_map_len;
+    }
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_map != MAP_FAILED) {
+        r->cq_map = (params.features & IORING_FEAT_SINGLE_MMAP) ? r->sq_map :
+                    mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->ring_fd, IORING_OFF_CQ_RING);
+    }
+    r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->ring_fd, IORING_OFF_SQES);
+
+    r->slots = calloc(depth, sizeof(Slot));
+    r->buffers = malloc((size_t)depth * URING_BUFFER_SZ);
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED ||
+        !r->slots || !r->buffers) {
+        uring_close(r);
+        return NULL;
+    }
+
+    unsigned char *sq = r->sq_map;
+    unsigned char *cq = r->cq_map;
+    r->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + params.sq_off.array);
+    r->cq_head = (unsigned *)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    for (unsigned i = 0; i < depth; i++) {
+        r->slots[i].buf = r->buffers + (size_t)i * URING_BUFFER_SZ;
+        r->slots[i].fd = -1;
+    }
+    return r;
+}
+
+// Queue one request; it is handed to the kernel by the next io_uring_enter().
+// Every slot has at most one request in flight, so the queue never fills.
+static struct io_uring_sqe *queue_sqe(UringReader *r, unsigned slot) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = slot;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    return sqe;
+}
+
+static void queue_open(UringReader *r, unsigned slot, const char *path) {
+    struct io_uring_sqe *sqe = queue_sqe(r, slot);
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+static void queue_read(UringReader *r, unsigned slot) {
+    struct io_uring_sqe *sqe = queue_sqe(r, slot);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = r->slots[slot].fd;
+    sqe->addr = (uint64_t)(uintptr_t)r->slots[slot].buf;
+    sqe->len = URING_BUFFER_SZ;
+    // Read from the current file position, which also works for pipes
+    sqe->off = (uint64_t)-1;
+}
+
+int uring_read_files(UringReader *r, char **paths, size_t npaths,
+                     uring_data_fn data, uring_done_fn done, void *ctx) {
+    size_t next = 0;
+    unsigned active = 0;
+    bool stop = false;
+    int rc = 0;
+
+    for (unsigned s = 0; s < r->depth && next < npaths; s++) {
+        r->slots[s].state = SLOT_OPENING;
+        r->slots[s].idx = next;
+        queue_open(r, s, paths[next++]);
+        active++;
+    }
+
+    while (active > 0) {
+        // One system call both submits everything queued and waits
+        int n = sys_io_uring_enter(r->ring_fd, r->to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            // Nothing more will complete; give back what is still open
+            rc = -1;
+            break;
+        }
+        r->to_submit -= (unsigned)n;
+
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            unsigned s = (unsigned)cqe->user_data;
+            Slot *slot = &r->slots[s];
+            int res = cqe->res;
+            bool finished = false;
+            bool open_failed = false;
+
+            if (slot->state == SLOT_OPENING) {
+                if (res < 0) {
+                    finished = open_failed = true;
+                } else {
+                    slot->fd = res;
+                    slot->state = SLOT_READING;
+                    if (!stop) {
+                        queue_read(r, s);
+                    } else {
+                        finished = true;
+                    }
+                }
+            } else if (res > 0 && !stop) {
+                data(ctx, slot->idx, slot->buf, (size_t)res);
+                queue_read(r, s);
+            } else {
+                finished = true;
+            }
+
+            if (!finished) {
+                continue;
+            }
+            if (slot->fd >= 0) {
+                close(slot->fd);
+                slot->fd = -1;
+            }
+            if (!stop && !done(ctx, slot->idx, res < 0 ? -res : 0, open_failed)) {
+                stop = true;
+            }
+            if (!stop && next < npaths) {
+                slot->state = SLOT_OPENING;
+                slot->idx = next;
+                queue_open(r, s, paths[next++]);
+            } else {
+                slot->state = SLOT_IDLE;
+                active--;
+            }
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    for (unsigned s = 0; s < r->depth; s++) {
+        if (r->slots[s].fd >= 0) {
+            close(r->slots[s].fd);
+            r->slots[s].fd = -1;
+        }
+        r->slots[s].state = SLOT_IDLE;
+    }
+    return rc;
+}
+
+void uring_close(UringReader *r) {
+    if (r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqes_len);
+    }
+    if (r->cq_map != MAP_FAILED && r->cq_map != r->sq_map) {
+        munmap(r->cq_map, r->cq_map_len);
+    }
+    if (r->sq_map != MAP_FAILED) {
+        munmap(r->sq_map, r->sq_map_len);
+    }
+    close(r->ring_fd);
+    free(r->slots);
+    free(r->buffers);
+    free(r);
+}
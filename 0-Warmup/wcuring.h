@@ -0,0 +1,55 @@
+#ifndef __WCURING_H__
+#define __WCURING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+//===================================================================
+// BATCHED FILE READER (io_uring, for long file lists)
+//===================================================================
+
+// Files open at once, each with one openat() or read() in flight
+#define URING_DEPTH     64
+
+// Read size per file and request
+#define URING_BUFFER_SZ (128 * 1024)
+
+typedef struct UringReader UringReader;
+
+// Called with the next bytes of file idx, in file order, as reads complete
+typedef void (*uring_data_fn)(void *ctx, size_t idx, const unsigned char *buf, size_t len);
+
+// Called once file idx is read to the end (err == 0) or failed (err is an
+// errno value; open_failed tells which step). Files finish in any order.
+// Return false to stop reading further files.
+typedef bool (*uring_done_fn)(void *ctx, size_t idx, int err, bool open_failed);
+
+/**
+ * uring_open - Set up a ring that can open and read files
+ *
+ * Uses the raw io_uring system calls, so no liburing is needed.
+ *
+ * Returns: reader, or NULL if io_uring is unavailable (old kernel,
+ * seccomp, missing IORING_OP_OPENAT/READ); the caller should then read
+ * the files some other way
+ */
+UringReader *uring_open(unsigned depth);
+
+/**
+ * uring_read_files - Read every path, keeping up to depth files in flight
+ *
+ * Paths are opened in order; each file's data arrives in order, but
+ * different files interleave. Returns only after every request it issued
+ * has completed, also when done() stopped it early.
+ *
+ * Returns: 0 on success, -1 if the ring itself failed (errno set)
+ */
+int uring_read_files(UringReader *reader, char **paths, size_t npaths,
+                     uring_data_fn data, uring_done_fn done, void *ctx);
+
+/**
+ * uring_close - Tear down the ring and free the reader
+ */
+void uring_close(UringReader *reader);
+
+#endif
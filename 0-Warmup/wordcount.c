@@ -1,57 +1,616 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/inotify.h>
+
+#include "wclib.h"
+#include "wccache.h"
+#include "wcfreq.h"
+#include "wchll.h"
+#include "wcuring.h"
 
 void print_usage(const char *program_name) {
-    fprintf(stderr, "Usage: %s [-l] [-w] [-c] [file ...]\n", program_name);
+    fprintf(stderr, "Usage: %s [-l] [-w] [-m] [-c] [-j N] [--cache FILE] [--distinct[=P]] [file ...]\n", program_name);
+    fprintf(stderr, "       %s [-l] [-w] [-m] [-c] [-j N] [--cache FILE] [--distinct[=P]] --files0-from FILE\n", program_name);
+    fprintf(stderr, "       %s [-l] [-w] [-m] [-c] --follow [--interval SEC] file\n", program_name);
+    fprintf(stderr, "       %s [-l] [-w] [-m] [-c] --estimate[=FRACTION] [file ...]\n", program_name);
+    fprintf(stderr, "       %s [-j N] --top K [file ...]\n", program_name);
     fprintf(stderr, "Count lines, words, and characters in files or stdin\n");
     fprintf(stderr, "  -l    count lines\n");
     fprintf(stderr, "  -w    count words\n");
-    fprintf(stderr, "  -c    count characters\n");
-    fprintf(stderr, "  If no options specified, counts all three\n");
+    fprintf(stderr, "  -m    count UTF-8 characters\n");
+    fprintf(stderr, "  -c    count characters (bytes)\n");
+    fprintf(stderr, "  -j N  count large files on N threads (default: online CPUs)\n");
+    fprintf(stderr, "  --unicode-spaces  also split words at Unicode spaces such as U+00A0, U+3000\n");
+    fprintf(stderr, "  --cache FILE    reuse counts of unchanged or appended-to files\n");
+    fprintf(stderr, "  --files0-from FILE  count the NUL-separated file names in FILE (- for stdin)\n");
+    fprintf(stderr, "  --distinct[=P]  also estimate distinct words, 2^P registers (%d-%d, default: %d)\n",
+            HLL_MIN_PRECISION, HLL_MAX_PRECISION, HLL_DEFAULT_PRECISION);
+    fprintf(stderr, "  --estimate[=FRACTION]  extrapolate counts from a random FRACTION of\n");
+    fprintf(stderr, "                  64 KiB blocks, with 95%% margins (default: 0.01)\n");
+    fprintf(stderr, "  --top K         list the K most frequent words instead of counts\n");
+    fprintf(stderr, "  --follow        keep counting as the file grows, across rotations\n");
+    fprintf(stderr, "  --interval SEC  how often --follow prints updated counts (default: 1)\n");
+    fprintf(stderr, "  If no options specified, counts lines, words and characters (bytes)\n");
     fprintf(stderr, "  If no files specified, reads from stdin\n");
 }
 
+// Size of each block read from pipes and special files
+#define READ_BUFFER_SZ (256 * 1024)
+
+static WordCounter *new_counter(void) {
+    WordCounter *wc = wc_init();
+    if (!wc) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return wc;
+}
+
+static unsigned char *new_read_buffer(void) {
+    unsigned char *buf = malloc(READ_BUFFER_SZ);
+    if (!buf) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return buf;
+}
+
+// Feed everything from the current offset up to end of file into wc
+static bool feed_until_eof(int fd, WordCounter *wc, unsigned char *buf) {
+    ssize_t n;
+
+    while ((n = read(fd, buf, READ_BUFFER_SZ)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        wc_feed(wc, buf, (size_t)n);
+    }
+    return true;
+}
+
+static void check_alloc(int rc) {
+    if (rc != 0) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+}
+
+static void new_sketch(HyperLogLog *hll, int precision) {
+    check_alloc(hll_init(hll, precision));
+}
+
+// Word-level consumers (--top, --distinct) take buffers that start and end
+// on word boundaries; they return nonzero when out of memory.
+typedef int (*words_fn)(void *ctx, const unsigned char *buf, size_t len);
+
+// Set by main() for --unicode-spaces. Word-level consumers split at the
+// multi-byte spaces themselves, even when words are not being counted.
+static bool unicode_words = false;
+
+static int freq_words(void *ctx, const unsigned char *buf, size_t len) {
+    return freq_add_words(ctx, buf, len, unicode_words);
+}
+
+static int hll_words(void *ctx, const unsigned char *buf, size_t len) {
+    return hll_add_words(ctx, buf, len, unicode_words);
+}
+
+// Read fd to end of file, feeding every new block to wc (if any) and every
+// complete word to add_words. Blocks are cut after their last whitespace
+// byte and the unfinished word is carried into the next read, growing the
+// buffer when a single word outgrows it.
+static bool scan_stream(int fd, WordCounter *wc, words_fn add_words, void *ctx) {
+    size_t cap = READ_BUFFER_SZ;
+    size_t have = 0;
+    unsigned char *buf = new_read_buffer();
+    bool ok = true;
+
+    for (;;) {
+        if (have == cap) {
+            unsigned char *grown = realloc(buf, cap * 2);
+            check_alloc(grown ? 0 : -1);
+            buf = grown;
+            cap *= 2;
+        }
+
+        ssize_t n = read(fd, buf + have, cap - have);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        if (wc) {
+            wc_feed(wc, buf + have, (size_t)n);
+        }
+
+        size_t end = have + (size_t)n;
+        size_t cut = end;
+        while (cut > have && !wc_is_space(buf[cut - 1])) {
+            cut--;
+        }
+        if (cut == have) {
+            // No whitespace in the new bytes: the carried word goes on
+            have = end;
+            continue;
+        }
+
+        check_alloc(add_words(ctx, buf, cut));
+        memmove(buf, buf + cut, end - cut);
+        have = end - cut;
+    }
+
+    check_alloc(add_words(ctx, buf, have));
+    free(buf);
+    return ok;
+}
+
+// Pages of a mapped file that was truncated while it is counted raise
+// SIGBUS. A thread reading a mapping sets bus_guard, and the handler jumps
+// back to it so the file is reported as unreadable; any other SIGBUS is
+// fatal as usual.
+static _Thread_local sigjmp_buf *bus_guard;
+
+static void bus_signal(int sig) {
+    if (bus_guard) {
+        siglongjmp(*bus_guard, 1);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// Ranges smaller than this are not worth a thread of their own
+#define MIN_RANGE_SZ (4 * 1024 * 1024)
+#define MAX_JOBS 256
+
+// Bytes [start, end) of a buffer of len bytes
 typedef struct {
-    long lines;
-    long words;
-    long chars;
-} Counts;
-
-Counts count_stream(FILE *fp) {
-    Counts counts = {0, 0, 0};
-    int c;
-    bool in_word = false;
-    
-    while ((c = fgetc(fp)) != EOF) {
-        counts.chars++;
-        
-        if (c == '\n') {
-            counts.lines++;
+    const unsigned char *buf;
+    size_t len;
+    size_t start;
+    size_t end;
+    WordCounter *wc;
+    HyperLogLog *hll;   // optional
+    bool failed;        // the mapping shrank under the range
+} Range;
+
+static void *count_range(void *arg) {
+    Range *range = arg;
+    const unsigned char *buf = range->buf;
+    sigjmp_buf guard;
+
+    if (sigsetjmp(guard, 1)) {
+        bus_guard = NULL;
+        range->failed = true;
+        return NULL;
+    }
+    bus_guard = &guard;
+
+    wc_feed(range->wc, buf + range->start, range->end - range->start);
+
+    if (range->hll) {
+        // A range owns the words that start inside it: skip the tail of a
+        // word begun in the previous range, finish the last one past end.
+        // ASCII whitespace is a safe place to stop even with Unicode
+        // spaces, which contain no ASCII bytes.
+        size_t first = range->start;
+        size_t last = range->end;
+        if (first > 0 && !wc_is_space(buf[first - 1])) {
+            while (first < last && !wc_is_space(buf[first])) {
+                first++;
+            }
         }
-        
-        if (isspace(c)) {
-            in_word = false;
-        } else if (!in_word) {
-            in_word = true;
-            counts.words++;
+        while (last < range->len && !wc_is_space(buf[last])) {
+            last++;
         }
+        hll_add_words(range->hll, buf + first, last - first, unicode_words);
     }
-    
-    return counts;
+    bus_guard = NULL;
+    return NULL;
+}
+
+// Split buf into byte ranges, count each on its own thread and merge them
+// into wc (and hll, if given) in order; wc_append() fixes up words
+// straddling a boundary. The first range is fed straight into wc and hll.
+// Returns false if part of buf could not be read.
+static bool feed_buffer_parallel(WordCounter *wc, HyperLogLog *hll,
+                                 const unsigned char *buf, size_t len, long threads) {
+    size_t nranges = len / MIN_RANGE_SZ;
+    if (nranges > (size_t)threads) {
+        nranges = (size_t)threads;
+    }
+    if (nranges < 2) {
+        Range whole = {buf, len, 0, len, wc, hll, false};
+        count_range(&whole);
+        return !whole.failed;
+    }
+
+    Range ranges[MAX_JOBS];
+    HyperLogLog sketches[MAX_JOBS];
+    pthread_t tids[MAX_JOBS];
+    bool started[MAX_JOBS];
+    size_t step = len / nranges;
+
+    // Finding the boundaries reads buf too
+    sigjmp_buf guard;
+    if (sigsetjmp(guard, 1)) {
+        bus_guard = NULL;
+        return false;
+    }
+    bus_guard = &guard;
+    for (size_t r = 0; r < nranges; r++) {
+        ranges[r].start = r == 0 ? 0 : wc_boundary(buf, len, r * step);
+        ranges[r].end = (r == nranges - 1) ? len : wc_boundary(buf, len, (r + 1) * step);
+    }
+    bus_guard = NULL;
+
+    for (size_t r = 0; r < nranges; r++) {
+        ranges[r].buf = buf;
+        ranges[r].len = len;
+        ranges[r].wc = r == 0 ? wc : new_counter();
+        ranges[r].hll = NULL;
+        ranges[r].failed = false;
+        if (hll) {
+            if (r == 0) {
+                ranges[r].hll = hll;
+            } else {
+                new_sketch(&sketches[r], hll->precision);
+                ranges[r].hll = &sketches[r];
+            }
+        }
+        // The calling thread takes the first range itself
+        started[r] = r > 0 && pthread_create(&tids[r], NULL, count_range, &ranges[r]) == 0;
+    }
+
+    count_range(&ranges[0]);
+    bool ok = !ranges[0].failed;
+
+    for (size_t r = 1; r < nranges; r++) {
+        if (started[r]) {
+            pthread_join(tids[r], NULL);
+        } else {
+            count_range(&ranges[r]);
+        }
+        ok = ok && !ranges[r].failed;
+        wc_append(wc, ranges[r].wc);
+        wc_finish(ranges[r].wc);
+        if (hll) {
+            hll_merge(hll, &sketches[r]);
+            hll_free(&sketches[r]);
+        }
+    }
+    return ok;
+}
+
+// Feed fd from offset to end of file into wc, and its words into hll if
+// given. Regular files are mapped and counted in place, which skips the copy
+// into a userspace buffer, and may be split across up to `threads` threads.
+// Stdin, pipes, special files and failed mappings go through read() into a
+// large block instead.
+static bool feed_fd(int fd, off_t offset, long threads, WordCounter *wc, HyperLogLog *hll) {
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > offset &&
+        (uintmax_t)st.st_size <= SIZE_MAX) {
+        size_t len = (size_t)st.st_size;
+        unsigned char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED) {
+            madvise(map, len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+            madvise(map, len, MADV_HUGEPAGE);
+#endif
+            bool ok = feed_buffer_parallel(wc, hll, map + offset, len - (size_t)offset, threads);
+            munmap(map, len);
+            return ok;
+        }
+    }
+
+    if (offset > 0 && lseek(fd, offset, SEEK_SET) < 0) {
+        return false;
+    }
+    if (hll) {
+        return scan_stream(fd, wc, hll_words, hll);
+    }
+
+    unsigned char *buf = new_read_buffer();
+    bool ok = feed_until_eof(fd, wc, buf);
+    free(buf);
+    return ok;
+}
+
+// Set by main() when only bytes are counted (-c): a regular file's size
+// then is the whole answer
+static bool bytes_only = false;
+
+static bool count_fd(int fd, long threads, HyperLogLog *hll, Counts *counts) {
+    struct stat st;
+    off_t pos;
+
+    // Zero-sized regular files (e.g. in /proc) may still have contents. The
+    // offset matters for a stdin that was partly read before.
+    if (bytes_only && !hll && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (pos = lseek(fd, 0, SEEK_CUR)) >= 0 && pos <= st.st_size) {
+        *counts = (Counts){0, 0, (long)(st.st_size - pos), 0};
+        return true;
+    }
+
+    // A stdin that was partly read is counted from where it stands
+    pos = lseek(fd, 0, SEEK_CUR);
+    WordCounter *wc = new_counter();
+    bool ok = feed_fd(fd, pos > 0 ? pos : 0, threads, wc, hll);
+
+    *counts = wc_finish(wc);
+    return ok;
+}
+
+// Count a regular file through the cache: a current record is used as is, a
+// record for an unchanged prefix of a file that has grown is resumed from,
+// and the final state is stored for the next run.
+static bool count_fd_cached(int fd, const struct stat *st, long threads, Cache *cache, Counts *counts) {
+    CacheRecord rec;
+    WordCounter *wc = NULL;
+    off_t offset = 0;
+
+    if (cache_lookup(cache, st, &rec)) {
+        if (cache_is_current(&rec, st)) {
+            *counts = cache_state(&rec).counts;
+            return true;
+        }
+        if (rec.size < (uint64_t)st->st_size && cache_prefix_matches(&rec, fd)) {
+            WordCounterState state = cache_state(&rec);
+            wc = wc_restore(&state);
+            offset = (off_t)rec.size;
+        }
+    }
+    if (!wc) {
+        offset = 0;
+        wc = new_counter();
+    }
+
+    bool ok = feed_fd(fd, offset, threads, wc, NULL);
+    if (ok) {
+        WordCounterState state = wc_save(wc);
+        cache_store(cache, fd, st, &state);
+    }
+
+    *counts = wc_finish(wc);
+    return ok;
+}
+
+typedef enum {
+    COUNT_OK,
+    COUNT_ERR_OPEN,
+    COUNT_ERR_READ,
+    COUNT_ERR_NOT_REGULAR
+} CountStatus;
+
+// Count path, adding its words to hll if given. The cache only holds
+// counts, so it is bypassed when a distinct estimate is wanted.
+static CountStatus count_path(const char *path, long threads, Cache *cache, HyperLogLog *hll, Counts *counts) {
+    struct stat st;
+    CacheRecord rec;
+
+    if (hll) {
+        cache = NULL;
+    }
+
+    // A current cache record answers without opening the file at all
+    if (cache && stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+        cache_lookup(cache, &st, &rec) && cache_is_current(&rec, &st)) {
+        *counts = cache_state(&rec).counts;
+        return COUNT_OK;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return COUNT_ERR_OPEN;
+    }
+
+    bool ok;
+    if (cache && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        ok = count_fd_cached(fd, &st, threads, cache, counts);
+    } else {
+        ok = count_fd(fd, threads, hll, counts);
+    }
+    close(fd);
+    return ok ? COUNT_OK : COUNT_ERR_READ;
+}
+
+static void report_error(const char *path, CountStatus status) {
+    if (status == COUNT_ERR_OPEN) {
+        fprintf(stderr, "Error: cannot open file '%s'\n", path);
+    } else {
+        fprintf(stderr, "Error: cannot read file '%s'\n", path);
+    }
+}
+
+// Files a worker may run ahead of the next one to be printed, per worker.
+// Results land in a ring of this many slots, so memory stays flat no matter
+// how many files are on the command line.
+#define REORDER_SLOTS_PER_JOB 4
+
+typedef struct {
+    Counts counts;
+    HyperLogLog distinct;
+    CountStatus status;
+    bool done;
+} FileResult;
+
+// Worker pool that counts files concurrently while main() prints them in
+// argv order. File i may only start once i < next_print + nslots, so its ring
+// slot (i % nslots) has already been consumed by the printer.
+typedef struct {
+    char **files;
+    int nfiles;
+    Cache *cache;
+    int distinct_precision;     // 0 without --distinct
+    int next_file;
+    int next_print;
+    bool stop;
+    FileResult *slots;
+    int nslots;
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;
+    pthread_cond_t slot_done;
+} FilePool;
+
+static void *file_pool_worker(void *arg) {
+    FilePool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->next_file < pool->nfiles &&
+               pool->next_file >= pool->next_print + pool->nslots) {
+            pthread_cond_wait(&pool->slot_free, &pool->lock);
+        }
+        if (pool->stop || pool->next_file >= pool->nfiles) {
+            break;
+        }
+        int idx = pool->next_file++;
+        pthread_mutex_unlock(&pool->lock);
+
+        // The pool already keeps every thread busy; count each file serially
+        Counts counts;
+        HyperLogLog distinct = {0, NULL};
+        if (pool->distinct_precision) {
+            new_sketch(&distinct, pool->distinct_precision);
+        }
+        CountStatus status = count_path(pool->files[idx], 1, pool->cache,
+                                        distinct.registers ? &distinct : NULL, &counts);
+
+        pthread_mutex_lock(&pool->lock);
+        FileResult *slot = &pool->slots[idx % pool->nslots];
+        slot->counts = counts;
+        slot->distinct = distinct;
+        slot->status = status;
+        slot->done = true;
+        pthread_cond_broadcast(&pool->slot_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void file_pool_stop(FilePool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->slot_free);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int t = 0; t < pool->nthreads; t++) {
+        pthread_join(pool->threads[t], NULL);
+    }
+
+    for (int i = 0; i < pool->nslots; i++) {
+        if (pool->slots[i].done) {
+            hll_free(&pool->slots[i].distinct);
+        }
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->slot_free);
+    pthread_cond_destroy(&pool->slot_done);
+    free(pool->slots);
+    free(pool->threads);
 }
 
-void print_counts(Counts counts, bool show_lines, bool show_words, bool show_chars, const char *filename) {
+// Start up to `threads` workers over files. Returns false if no worker could
+// be started, in which case the caller counts the files itself.
+static bool file_pool_start(FilePool *pool, char **files, int nfiles, long threads,
+                            Cache *cache, int distinct_precision) {
+    memset(pool, 0, sizeof(*pool));
+    pool->files = files;
+    pool->nfiles = nfiles;
+    pool->cache = cache;
+    pool->distinct_precision = distinct_precision;
+    pool->nslots = (int)threads * REORDER_SLOTS_PER_JOB;
+    pool->slots = calloc(pool->nslots, sizeof(FileResult));
+    pool->threads = calloc(threads, sizeof(pthread_t));
+    if (!pool->slots || !pool->threads) {
+        free(pool->slots);
+        free(pool->threads);
+        return false;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->slot_free, NULL);
+    pthread_cond_init(&pool->slot_done, NULL);
+
+    for (long t = 0; t < threads; t++) {
+        if (pthread_create(&pool->threads[pool->nthreads], NULL, file_pool_worker, pool) == 0) {
+            pool->nthreads++;
+        }
+    }
+
+    if (pool->nthreads == 0) {
+        file_pool_stop(pool);
+        return false;
+    }
+    return true;
+}
+
+// Block until file idx (which must be the next one in order) is counted.
+// Ownership of the file's distinct sketch passes to the caller.
+static CountStatus file_pool_wait(FilePool *pool, int idx, Counts *counts, HyperLogLog *distinct) {
+    FileResult *slot = &pool->slots[idx % pool->nslots];
+
+    pthread_mutex_lock(&pool->lock);
+    while (!slot->done) {
+        pthread_cond_wait(&pool->slot_done, &pool->lock);
+    }
+    *counts = slot->counts;
+    *distinct = slot->distinct;
+    CountStatus status = slot->status;
+    slot->done = false;
+    pool->next_print = idx + 1;
+    pthread_cond_broadcast(&pool->slot_free);
+    pthread_mutex_unlock(&pool->lock);
+
+    return status;
+}
+
+// Columns are 8 wide, but always keep one space so counts of 8+ digits
+// from large files do not run together.
+// With --distinct, the estimated number of distinct words follows the
+// counts, with its relative standard error.
+void print_counts(Counts counts, const HyperLogLog *distinct, bool show_lines, bool show_words,
+                  bool show_codepoints, bool show_chars, const char *filename) {
     if (show_lines) {
-        printf("%8ld", counts.lines);
+        printf(" %7ld", counts.lines);
     }
     if (show_words) {
-        printf("%8ld", counts.words);
+        printf(" %7ld", counts.words);
+    }
+    if (show_codepoints) {
+        printf(" %7ld", counts.codepoints);
     }
     if (show_chars) {
-        printf("%8ld", counts.chars);
+        printf(" %7ld", counts.chars);
+    }
+    if (distinct) {
+        printf(" %7.0f +/-%.2f%%", hll_estimate(distinct), 100 * hll_error(distinct));
     }
     if (filename) {
         printf(" %s", filename);
@@ -59,11 +618,782 @@ void print_counts(Counts counts, bool show_lines, bool show_words, bool show_cha
     printf("\n");
 }
 
+// Set from SIGINT/SIGTERM so --follow can print its final counts and exit
+static volatile sig_atomic_t follow_stop = 0;
+
+static void follow_signal(int sig) {
+    (void)sig;
+    follow_stop = 1;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Counts add_counts(Counts a, Counts b) {
+    a.lines += b.lines;
+    a.words += b.words;
+    a.chars += b.chars;
+    a.codepoints += b.codepoints;
+    return a;
+}
+
+// Keep path open and count bytes as they are appended, printing the running
+// counts every interval seconds when they changed. inotify wakes the loop up
+// on appends; without it the loop simply polls once per interval.
+//
+// Rotation is detected by the path resolving to a different inode: the old
+// file is drained, its counts are kept, and counting continues from offset 0
+// of the new file. A file truncated in place is handled the same way.
+static int follow_file(const char *path, double interval,
+                       bool show_lines, bool show_words, bool show_codepoints, bool show_chars) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: cannot open file '%s'\n", path);
+        return 1;
+    }
+
+    unsigned char *buf = new_read_buffer();
+    WordCounter *wc = new_counter();
+    Counts base = {0, 0, 0, 0};    // counts from files that were rotated away
+    struct stat fd_st;
+
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int wd = ifd >= 0 ? inotify_add_watch(ifd, path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) : -1;
+
+    signal(SIGINT, follow_signal);
+    signal(SIGTERM, follow_signal);
+
+    bool ok = feed_until_eof(fd, wc, buf);
+    Counts printed = add_counts(base, wc_counts(wc));
+    print_counts(printed, NULL, show_lines, show_words, show_codepoints, show_chars, path);
+    fflush(stdout);
+
+    double next_print = now_seconds() + interval;
+
+    while (ok && !follow_stop) {
+        int timeout_ms = (int)((next_print - now_seconds()) * 1000);
+        struct pollfd pfd = {ifd, POLLIN, 0};
+
+        if (timeout_ms < 0) {
+            timeout_ms = 0;
+        }
+        if (ifd >= 0) {
+            poll(&pfd, 1, timeout_ms);
+            // Only the wakeup matters; drain the event queue
+            char events[4096];
+            while (read(ifd, events, sizeof(events)) > 0) {
+            }
+        } else {
+            poll(NULL, 0, timeout_ms);
+        }
+
+        ok = fstat(fd, &fd_st) == 0;
+        if (ok && fd_st.st_size < lseek(fd, 0, SEEK_CUR)) {
+            // Truncated in place: start over as if it were a new file
+            base = add_counts(base, wc_finish(wc));
+            wc = new_counter();
+            lseek(fd, 0, SEEK_SET);
+        }
+        ok = ok && feed_until_eof(fd, wc, buf);
+
+        struct stat path_st;
+        if (ok && stat(path, &path_st) == 0 &&
+            (path_st.st_ino != fd_st.st_ino || path_st.st_dev != fd_st.st_dev)) {
+            int new_fd = open(path, O_RDONLY);
+            if (new_fd >= 0) {
+                // Appends may have landed in the old file before the rename
+                ok = feed_until_eof(fd, wc, buf);
+                close(fd);
+                fd = new_fd;
+
+                base = add_counts(base, wc_finish(wc));
+                wc = new_counter();
+                ok = ok && feed_until_eof(fd, wc, buf);
+
+                if (ifd >= 0) {
+                    if (wd >= 0) {
+                        inotify_rm_watch(ifd, wd);
+                    }
+                    wd = inotify_add_watch(ifd, path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+                }
+            }
+        }
+
+        if (now_seconds() >= next_print) {
+            Counts current = add_counts(base, wc_counts(wc));
+            if (memcmp(&current, &printed, sizeof(Counts)) != 0) {
+                print_counts(current, NULL, show_lines, show_words, show_codepoints, show_chars, path);
+                fflush(stdout);
+                printed = current;
+            }
+            next_print += interval;
+            if (next_print < now_seconds()) {
+                next_print = now_seconds() + interval;
+            }
+        }
+    }
+
+    Counts current = add_counts(base, wc_finish(wc));
+    if (ok && memcmp(&current, &printed, sizeof(Counts)) != 0) {
+        print_counts(current, NULL, show_lines, show_words, show_codepoints, show_chars, path);
+    }
+
+    if (ifd >= 0) {
+        close(ifd);
+    }
+    close(fd);
+    free(buf);
+
+    if (!ok) {
+        fprintf(stderr, "Error: cannot read file '%s'\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+// Lists of at least this many files are read through io_uring, which keeps
+// URING_DEPTH opens and reads in flight from a single thread
+#define URING_MIN_FILES 64
+
+typedef struct {
+    char **files;
+    WordCounter **counters;     // per file, from its first bytes until done
+    FileResult *results;        // per file; only counts and status are used
+    int next_print;
+    Counts total;
+    bool show_lines;
+    bool show_words;
+    bool show_codepoints;
+    bool show_chars;
+} UringCount;
+
+static void uring_count_data(void *ctx, size_t idx, const unsigned char *buf, size_t len) {
+    UringCount *uc = ctx;
+
+    if (!uc->counters[idx]) {
+        uc->counters[idx] = new_counter();
+    }
+    wc_feed(uc->counters[idx], buf, len);
+}
+
+// Files complete in any order; print every finished one at the front of the
+// list, and stop at the first failure just like the serial loop does
+static bool uring_count_done(void *ctx, size_t idx, int err, bool open_failed) {
+    UringCount *uc = ctx;
+    FileResult *result = &uc->results[idx];
+
+    result->counts = (Counts){0, 0, 0, 0};
+    if (uc->counters[idx]) {
+        result->counts = wc_finish(uc->counters[idx]);
+        uc->counters[idx] = NULL;
+    }
+    result->status = err == 0 ? COUNT_OK : open_failed ? COUNT_ERR_OPEN : COUNT_ERR_READ;
+    result->done = true;
+
+    while (uc->results[uc->next_print].done) {
+        result = &uc->results[uc->next_print];
+        if (result->status != COUNT_OK) {
+            return false;
+        }
+        print_counts(result->counts, NULL, uc->show_lines, uc->show_words, uc->show_codepoints,
+                     uc->show_chars, uc->files[uc->next_print]);
+        uc->total = add_counts(uc->total, result->counts);
+        uc->next_print++;
+    }
+    return true;
+}
+
+// Count and print files in order through io_uring, adding them to *total.
+// Returns the number of files printed, which is less than nfiles if io_uring
+// is unavailable or failed; the caller counts the rest some other way. If a
+// file could not be counted, *status says why and files[return value] is it.
+static int count_files_uring(char **files, int nfiles, Counts *total, CountStatus *status,
+                             bool show_lines, bool show_words, bool show_codepoints, bool show_chars) {
+    UringReader *reader = uring_open(URING_DEPTH);
+    *status = COUNT_OK;
+    if (!reader) {
+        return 0;
+    }
+
+    UringCount uc = {files, NULL, NULL, 0, *total, show_lines, show_words, show_codepoints, show_chars};
+    uc.counters = calloc(nfiles, sizeof(WordCounter *));
+    // One extra result, never done, ends the printing loop after the last file
+    uc.results = calloc(nfiles + 1, sizeof(FileResult));
+    if (!uc.counters || !uc.results) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+
+    uring_read_files(reader, files, nfiles, uring_count_data, uring_count_done, &uc);
+    uring_close(reader);
+
+    // Counters of files left unfinished by an error
+    for (int i = 0; i < nfiles; i++) {
+        if (uc.counters[i]) {
+            wc_finish(uc.counters[i]);
+        }
+    }
+
+    if (uc.next_print < nfiles && uc.results[uc.next_print].done) {
+        *status = uc.results[uc.next_print].status;
+    }
+    *total = uc.total;
+    free(uc.counters);
+    free(uc.results);
+    return uc.next_print;
+}
+
+// Add the words of a mapped buffer to table. Returns false if the mapping
+// shrank under it; the words read up to then stay in the table.
+static bool freq_add_mapped(FreqTable *table, const unsigned char *buf, size_t len) {
+    sigjmp_buf guard;
+
+    if (sigsetjmp(guard, 1)) {
+        bus_guard = NULL;
+        return false;
+    }
+    bus_guard = &guard;
+    check_alloc(freq_add_words(table, buf, len, unicode_words));
+    bus_guard = NULL;
+    return true;
+}
+
+static bool freq_add_fd(int fd, FreqTable *table) {
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (uintmax_t)st.st_size <= SIZE_MAX) {
+        size_t len = (size_t)st.st_size;
+        unsigned char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED) {
+            madvise(map, len, MADV_SEQUENTIAL);
+            bool ok = freq_add_mapped(table, map, len);
+            munmap(map, len);
+            return ok;
+        }
+    }
+
+    return scan_stream(fd, NULL, freq_words, table);
+}
+
+// --top work item: a whole file, or a whitespace-aligned range of one
+// mapped file (path == NULL)
+typedef struct {
+    const char *path;
+    const unsigned char *buf;
+    size_t len;
+    CountStatus status;
+} TopTask;
+
+typedef struct {
+    TopTask *tasks;
+    size_t ntasks;
+    size_t next_task;
+    pthread_mutex_t lock;
+} TopQueue;
+
+typedef struct {
+    TopQueue *queue;
+    FreqTable table;    // private to this worker until the final merge
+} TopWorker;
+
+static void *top_worker(void *arg) {
+    TopWorker *worker = arg;
+    TopQueue *queue = worker->queue;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t idx = queue->next_task++;
+        pthread_mutex_unlock(&queue->lock);
+        if (idx >= queue->ntasks) {
+            break;
+        }
+
+        TopTask *task = &queue->tasks[idx];
+        if (!task->path) {
+            task->status = freq_add_mapped(&worker->table, task->buf, task->len) ? COUNT_OK : COUNT_ERR_READ;
+            continue;
+        }
+
+        int fd = open(task->path, O_RDONLY);
+        if (fd < 0) {
+            task->status = COUNT_ERR_OPEN;
+            continue;
+        }
+        task->status = freq_add_fd(fd, &worker->table) ? COUNT_OK : COUNT_ERR_READ;
+        close(fd);
+    }
+
+    return NULL;
+}
+
+// Split one mapped file into up to `threads` ranges, moving every nominal
+// boundary forward to the next whitespace byte so no word is cut in two.
+// Returns the number of ranges, or 0 if the mapping shrank under it.
+static size_t split_at_whitespace(const unsigned char *buf, size_t len, long threads, TopTask *tasks) {
+    sigjmp_buf guard;
+
+    if (sigsetjmp(guard, 1)) {
+        bus_guard = NULL;
+        return 0;
+    }
+    size_t nranges = len / MIN_RANGE_SZ;
+    if (nranges > (size_t)threads) {
+        nranges = (size_t)threads;
+    }
+    if (nranges < 1) {
+        nranges = 1;
+    }
+
+    size_t step = len / nranges;
+    size_t start = 0;
+    size_t ntasks = 0;
+
+    bus_guard = &guard;
+    for (size_t r = 1; r <= nranges && start < len; r++) {
+        size_t end = r == nranges ? len : r * step;
+        if (end < start) {
+            end = start;
+        }
+        while (end < len && !wc_is_space(buf[end])) {
+            end++;
+        }
+        tasks[ntasks++] = (TopTask){NULL, buf + start, end - start, COUNT_OK};
+        start = end;
+    }
+    bus_guard = NULL;
+    return ntasks;
+}
+
+// --top K: print the K most frequent words over all inputs. Each worker
+// tokenizes whole files (or, for a single large file, ranges of it) into a
+// private table; the tables are merged once all workers are done. Stdin is
+// read when there are no files, unless they came from a --files0-from list.
+static int run_top(char **files, int nfiles, bool listed, long k, long jobs) {
+    TopQueue queue = {NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+    TopWorker workers[MAX_JOBS];
+    pthread_t tids[MAX_JOBS];
+    unsigned char *map = NULL;
+    size_t map_len = 0;
+    int map_fd = -1;
+    int rc = 0;
+
+    if (nfiles == 0) {
+        // An empty --files0-from list has no words at all
+        check_alloc(freq_init(&workers[0].table));
+        if (!listed && !scan_stream(STDIN_FILENO, NULL, freq_words, &workers[0].table)) {
+            fprintf(stderr, "Error: cannot read stdin\n");
+            return 1;
+        }
+    } else {
+        queue.tasks = calloc(nfiles > jobs ? nfiles : jobs, sizeof(TopTask));
+        check_alloc(queue.tasks ? 0 : -1);
+
+        struct stat st;
+        if (nfiles == 1 && jobs > 1 && (map_fd = open(files[0], O_RDONLY)) >= 0 &&
+            fstat(map_fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            (uintmax_t)st.st_size >= 2 * MIN_RANGE_SZ && (uintmax_t)st.st_size <= SIZE_MAX &&
+            (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, map_fd, 0)) != MAP_FAILED) {
+            map_len = (size_t)st.st_size;
+            madvise(map, map_len, MADV_SEQUENTIAL);
+            queue.ntasks = split_at_whitespace(map, map_len, jobs, queue.tasks);
+            if (queue.ntasks == 0) {
+                queue.tasks[0] = (TopTask){NULL, NULL, 0, COUNT_ERR_READ};
+                queue.ntasks = 1;
+            }
+        } else {
+            map = NULL;
+            for (int i = 0; i < nfiles; i++) {
+                queue.tasks[i] = (TopTask){files[i], NULL, 0, COUNT_OK};
+            }
+            queue.ntasks = (size_t)nfiles;
+        }
+
+        long nworkers = jobs < (long)queue.ntasks ? jobs : (long)queue.ntasks;
+        bool started[MAX_JOBS];
+        for (long t = 0; t < nworkers; t++) {
+            workers[t].queue = &queue;
+            check_alloc(freq_init(&workers[t].table));
+            // The calling thread is worker 0
+            started[t] = t > 0 && pthread_create(&tids[t], NULL, top_worker, &workers[t]) == 0;
+        }
+        top_worker(&workers[0]);
+
+        for (long t = 1; t < nworkers; t++) {
+            if (started[t]) {
+                pthread_join(tids[t], NULL);
+            }
+            check_alloc(freq_merge(&workers[0].table, &workers[t].table));
+            freq_free(&workers[t].table);
+        }
+
+        for (size_t i = 0; i < queue.ntasks; i++) {
+            if (queue.tasks[i].status != COUNT_OK) {
+                fprintf(stderr, "Error: cannot %s file '%s'\n",
+                        queue.tasks[i].status == COUNT_ERR_OPEN ? "open" : "read",
+                        queue.tasks[i].path ? queue.tasks[i].path : files[0]);
+                rc = 1;
+                break;
+            }
+        }
+    }
+
+    if (rc == 0) {
+        // No more entries than distinct words, however large K is
+        size_t want = (uintmax_t)k < workers[0].table.count ? (size_t)k : workers[0].table.count;
+        FreqEntry *top = calloc(want ? want : 1, sizeof(FreqEntry));
+        check_alloc(top ? 0 : -1);
+        size_t n = freq_top(&workers[0].table, want, top);
+
+        for (size_t i = 0; i < n; i++) {
+            printf(" %7ld ", top[i].count);
+            fwrite(top[i].word, 1, top[i].len, stdout);
+            putchar('\n');
+        }
+        free(top);
+    }
+
+    freq_free(&workers[0].table);
+    if (map) {
+        munmap(map, map_len);
+    }
+    if (map_fd >= 0) {
+        close(map_fd);
+    }
+    free(queue.tasks);
+    return rc;
+}
+
+// --estimate samples blocks of this size, at least this many per file
+// unless the file is smaller, and reports 95% confidence intervals
+#define SAMPLE_BLOCK_SZ     (64 * 1024)
+#define MIN_SAMPLE_BLOCKS   64
+#define ESTIMATE_Z          1.96
+#define DEFAULT_SAMPLE_FRACTION 0.01
+
+// Ratio-estimator sums for one count over the sampled blocks, where x is
+// the bytes in a block and y its count
+typedef struct {
+    double y;
+    double yy;
+    double xy;
+} SampleSums;
+
+typedef struct {
+    long nblocks;
+    double x;
+    double xx;
+    SampleSums lines;
+    SampleSums words;
+    SampleSums codepoints;
+} Sample;
+
+// xorshift64*; good enough to place sample blocks
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static void add_sample(SampleSums *sums, double x, double y) {
+    sums->y += y;
+    sums->yy += y * y;
+    sums->xy += x * y;
+}
+
+// Extrapolate sums to a file of `bytes` bytes in `population` blocks:
+// total = bytes * sum(y) / sum(x), with the usual variance of a ratio
+// estimator under sampling without replacement.
+static void extrapolate(const Sample *sample, const SampleSums *sums, double bytes,
+                        long population, long *total, long *margin) {
+    double n = (double)sample->nblocks;
+    double ratio = sums->y / sample->x;
+    *total = (long)(bytes * ratio + 0.5);
+
+    if (sample->nblocks < 2) {
+        *margin = 0;
+        return;
+    }
+    double residual = (sums->yy - 2 * ratio * sums->xy + ratio * ratio * sample->xx) / (n - 1);
+    double scale = bytes / (sample->x / n);
+    double variance = scale * scale * (1 - n / (double)population) * residual / n;
+    *margin = variance > 0 ? (long)(ESTIMATE_Z * sqrt(variance) + 0.5) : 0;
+}
+
+// Read about `fraction` of fd's blocks, picked uniformly at random with
+// selection sampling (so in file order), and extrapolate lines and words.
+// Each block is read with up to three bytes before it (the longest lead-in
+// of a multi-byte space) so a word straddling the block start is credited
+// to the block it started in. Chars are exact.
+static CountStatus estimate_fd(int fd, double fraction, uint64_t *seed,
+                               Counts *counts, Counts *margin) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return COUNT_ERR_NOT_REGULAR;
+    }
+    counts->chars = (long)st.st_size;
+    margin->chars = 0;
+    counts->lines = counts->words = counts->codepoints = 0;
+    margin->lines = margin->words = margin->codepoints = 0;
+    if (st.st_size == 0 || bytes_only) {
+        return COUNT_OK;
+    }
+
+    long population = (long)((st.st_size + SAMPLE_BLOCK_SZ - 1) / SAMPLE_BLOCK_SZ);
+    long wanted = (long)ceil(fraction * (double)population);
+    if (wanted < MIN_SAMPLE_BLOCKS) {
+        wanted = MIN_SAMPLE_BLOCKS;
+    }
+    if (wanted > population) {
+        wanted = population;
+    }
+
+    // Sampled blocks are scattered; readahead would only waste bandwidth
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+    unsigned char *buf = malloc(SAMPLE_BLOCK_SZ + 3);
+    check_alloc(buf ? 0 : -1);
+    Sample sample = {0};
+    CountStatus status = COUNT_OK;
+
+    for (long block = 0; block < population && sample.nblocks < wanted; block++) {
+        // Take this block with probability (still wanted) / (blocks left)
+        double u = (double)(next_random(seed) >> 11) / 9007199254740992.0;
+        if ((double)(population - block) * u >= (double)(wanted - sample.nblocks)) {
+            continue;
+        }
+
+        off_t start = (off_t)block * SAMPLE_BLOCK_SZ;
+        off_t from = block > 0 ? start - 3 : start;
+        size_t want = (size_t)(start - from) + SAMPLE_BLOCK_SZ;
+        size_t got = 0;
+        while (got < want) {
+            ssize_t n = pread(fd, buf + got, want - got, from + (off_t)got);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                status = COUNT_ERR_READ;
+            }
+            if (n <= 0) {
+                break;
+            }
+            got += (size_t)n;
+        }
+        if (status != COUNT_OK) {
+            break;
+        }
+
+        size_t lead = (size_t)(start - from);
+        if (got <= lead) {
+            // The file shrank under us; the block is gone
+            continue;
+        }
+        WordCounter *wc = new_counter();
+        wc_feed(wc, buf, lead);
+        Counts before = wc_counts(wc);
+        wc_feed(wc, buf + lead, got - lead);
+        Counts after = wc_counts(wc);
+        wc_finish(wc);
+
+        double x = (double)(got - lead);
+        sample.nblocks++;
+        sample.x += x;
+        sample.xx += x * x;
+        add_sample(&sample.lines, x, (double)(after.lines - before.lines));
+        add_sample(&sample.words, x, (double)(after.words - before.words));
+        add_sample(&sample.codepoints, x, (double)(after.codepoints - before.codepoints));
+    }
+    free(buf);
+
+    if (status == COUNT_OK && sample.nblocks > 0) {
+        double bytes = (double)st.st_size;
+        extrapolate(&sample, &sample.lines, bytes, population, &counts->lines, &margin->lines);
+        extrapolate(&sample, &sample.words, bytes, population, &counts->words, &margin->words);
+        extrapolate(&sample, &sample.codepoints, bytes, population, &counts->codepoints, &margin->codepoints);
+    }
+    return status;
+}
+
+// Like print_counts(), with each column followed by its 95% margin
+static void print_estimate(Counts counts, Counts margin, bool show_lines, bool show_words,
+                           bool show_codepoints, bool show_chars, const char *filename) {
+    if (show_lines) {
+        printf(" %7ld +/-%ld", counts.lines, margin.lines);
+    }
+    if (show_words) {
+        printf(" %7ld +/-%ld", counts.words, margin.words);
+    }
+    if (show_codepoints) {
+        printf(" %7ld +/-%ld", counts.codepoints, margin.codepoints);
+    }
+    if (show_chars) {
+        printf(" %7ld +/-%ld", counts.chars, margin.chars);
+    }
+    if (filename) {
+        printf(" %s", filename);
+    }
+    printf("\n");
+}
+
+// --estimate: approximate counts of large regular files from a random
+// sample of their blocks. Files are sampled one after another; the work is
+// seek-bound, not CPU-bound. Stdin is sampled when there are no files,
+// unless they came from a --files0-from list.
+static int run_estimate(char **files, int nfiles, bool listed, double fraction,
+                        bool show_lines, bool show_words, bool show_codepoints, bool show_chars) {
+    uint64_t seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32) ^ 0x9E3779B97F4A7C15ULL;
+    Counts total = {0, 0, 0, 0};
+    double lines_var = 0;
+    double words_var = 0;
+    double codepoints_var = 0;
+
+    if (nfiles == 0 && !listed) {
+        Counts counts;
+        Counts margin;
+        if (estimate_fd(STDIN_FILENO, fraction, &seed, &counts, &margin) != COUNT_OK) {
+            fprintf(stderr, "Error: --estimate needs stdin to be a regular file\n");
+            return 1;
+        }
+        print_estimate(counts, margin, show_lines, show_words, show_codepoints, show_chars, NULL);
+        return 0;
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        Counts counts;
+        Counts margin;
+        CountStatus status = COUNT_ERR_OPEN;
+        int fd = open(files[i], O_RDONLY);
+        if (fd >= 0) {
+            status = estimate_fd(fd, fraction, &seed, &counts, &margin);
+            close(fd);
+        }
+
+        if (status != COUNT_OK) {
+            if (status == COUNT_ERR_OPEN) {
+                fprintf(stderr, "Error: cannot open file '%s'\n", files[i]);
+            } else if (status == COUNT_ERR_NOT_REGULAR) {
+                fprintf(stderr, "Error: --estimate needs a regular file: '%s'\n", files[i]);
+            } else {
+                fprintf(stderr, "Error: cannot read file '%s'\n", files[i]);
+            }
+            return 1;
+        }
+        print_estimate(counts, margin, show_lines, show_words, show_codepoints, show_chars, files[i]);
+
+        total = add_counts(total, counts);
+        // Files are sampled independently, so variances add
+        lines_var += (double)margin.lines * (double)margin.lines;
+        words_var += (double)margin.words * (double)margin.words;
+        codepoints_var += (double)margin.codepoints * (double)margin.codepoints;
+    }
+
+    if (nfiles > 1) {
+        Counts margin = {(long)(sqrt(lines_var) + 0.5), (long)(sqrt(words_var) + 0.5), 0,
+                         (long)(sqrt(codepoints_var) + 0.5)};
+        print_estimate(total, margin, show_lines, show_words, show_codepoints, show_chars, "total");
+    }
+    return 0;
+}
+
+// --files0-from: read the NUL-separated file names in path ("-" for stdin),
+// as written by `find -print0`. The names point into *list, which the
+// caller frees along with the returned array. Returns NULL after reporting
+// an error.
+static char **read_files0(const char *path, char **list, int *nfiles) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: cannot open file '%s'\n", path);
+        return NULL;
+    }
+
+    size_t len = 0;
+    size_t cap = READ_BUFFER_SZ;
+    char *buf = malloc(cap + 1);
+    ssize_t n = 1;
+    while (buf && n != 0) {
+        if (len == cap) {
+            char *grown = realloc(buf, 2 * cap + 1);
+            if (!grown) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "Error: cannot read file '%s'\n", path);
+            free(buf);
+            if (fd != STDIN_FILENO) {
+                close(fd);
+            }
+            return NULL;
+        }
+        len += n > 0 ? (size_t)n : 0;
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    if (!buf) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+
+    // The last name need not be terminated
+    if (len > 0 && buf[len - 1] != '\0') {
+        buf[len++] = '\0';
+    }
+    int count = 0;
+    for (size_t i = 0; i < len; i++) {
+        count += buf[i] == '\0';
+    }
+
+    char **files = malloc((count + 1) * sizeof(char *));
+    if (!files) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    char *name = buf;
+    for (int i = 0; i < count; i++) {
+        if (*name == '\0') {
+            fprintf(stderr, "Error: invalid zero-length file name in '%s' (entry %d)\n", path, i + 1);
+            free(files);
+            free(buf);
+            return NULL;
+        }
+        files[i] = name;
+        name += strlen(name) + 1;
+    }
+
+    *list = buf;
+    *nfiles = count;
+    return files;
+}
+
 int main(int argc, char *argv[]) {
     bool show_lines = false;
     bool show_words = false;
+    bool show_codepoints = false;
     bool show_chars = false;
+    bool unicode_spaces = false;
     bool any_option = false;
+    long jobs = 1;
+    bool jobs_set = false;
+    bool follow = false;
+    double interval = 1.0;
+    const char *cache_path = NULL;
+    long top_k = 0;
+    int distinct_precision = 0;
+    double sample_fraction = 0;
+    const char *files0_path = NULL;
     int file_start = 1;
     
     // Parse options
@@ -74,9 +1404,89 @@ int main(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "-w") == 0) {
             show_words = true;
             any_option = true;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            show_codepoints = true;
+            any_option = true;
         } else if (strcmp(argv[i], "-c") == 0) {
             show_chars = true;
             any_option = true;
+        } else if (strcmp(argv[i], "--unicode-spaces") == 0) {
+            unicode_spaces = true;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            // Accept both "-j N" and "-jN"
+            const char *value = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+            char *end;
+            jobs = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || jobs < 1) {
+                fprintf(stderr, "Invalid thread count: %s\n", value);
+                print_usage(argv[0]);
+                return 1;
+            }
+            jobs_set = true;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing cache file for --cache\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            cache_path = argv[++i];
+        } else if (strcmp(argv[i], "--files0-from") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing list file for --files0-from\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            files0_path = argv[++i];
+        } else if (strcmp(argv[i], "--top") == 0) {
+            const char *value = i + 1 < argc ? argv[++i] : "";
+            char *end;
+            top_k = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || top_k < 1) {
+                fprintf(stderr, "Invalid word count for --top: %s\n", value);
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--distinct", 10) == 0 &&
+                   (argv[i][10] == '\0' || argv[i][10] == '=')) {
+            // "--distinct" or "--distinct=P"
+            const char *value = argv[i][10] ? argv[i] + 11 : NULL;
+            distinct_precision = HLL_DEFAULT_PRECISION;
+            if (value) {
+                char *end;
+                long p = strtol(value, &end, 10);
+                if (*value == '\0' || *end != '\0' || p < HLL_MIN_PRECISION || p > HLL_MAX_PRECISION) {
+                    fprintf(stderr, "Invalid precision for --distinct: %s (%d-%d)\n",
+                            value, HLL_MIN_PRECISION, HLL_MAX_PRECISION);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                distinct_precision = (int)p;
+            }
+        } else if (strncmp(argv[i], "--estimate", 10) == 0 &&
+                   (argv[i][10] == '\0' || argv[i][10] == '=')) {
+            // "--estimate" or "--estimate=FRACTION"
+            const char *value = argv[i][10] ? argv[i] + 11 : NULL;
+            sample_fraction = DEFAULT_SAMPLE_FRACTION;
+            if (value) {
+                char *end;
+                sample_fraction = strtod(value, &end);
+                if (*value == '\0' || *end != '\0' || !(sample_fraction > 0 && sample_fraction <= 1)) {
+                    fprintf(stderr, "Invalid sample fraction for --estimate: %s\n", value);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+            }
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            follow = true;
+        } else if (strcmp(argv[i], "--interval") == 0) {
+            const char *value = i + 1 < argc ? argv[++i] : "";
+            char *end;
+            interval = strtod(value, &end);
+            if (*value == '\0' || *end != '\0' || !(interval > 0)) {
+                fprintf(stderr, "Invalid interval: %s\n", value);
+                print_usage(argv[0]);
+                return 1;
+            }
         } else {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
             print_usage(argv[0]);
@@ -85,43 +1495,192 @@ int main(int argc, char *argv[]) {
         file_start = i + 1;
     }
     
+    // WORDCOUNT_KERNEL=scalar|sse2|avx2 forces a kernel; the tests use it
+    // to cross-check them against each other.
+    wc_select_kernel(getenv("WORDCOUNT_KERNEL"));
+    
+    if (!jobs_set) {
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    } else if (jobs > MAX_JOBS) {
+        jobs = MAX_JOBS;
+    }
+    
     // If no options specified, show all
     if (!any_option) {
         show_lines = show_words = show_chars = true;
     }
     
-    // No files specified, read from stdin
-    if (file_start >= argc) {
-        Counts counts = count_stream(stdin);
-        print_counts(counts, show_lines, show_words, show_chars, NULL);
+    // Pick the kernel specialized for exactly the requested counts. The cache
+    // holds lines and words, so it needs both counted, and does not apply to
+    // the UTF-8 modes at all.
+    bool use_cache = cache_path && !show_codepoints && !unicode_spaces;
+    unsigned mode = (show_lines || use_cache ? WC_LINES : 0) |
+                    (show_words || use_cache ? WC_WORDS : 0) |
+                    (show_codepoints ? WC_CODEPOINTS : 0) |
+                    (unicode_spaces ? WC_UNICODE_SPACES : 0);
+    wc_select_mode(mode);
+    unicode_words = unicode_spaces;
+    bytes_only = !(mode & (WC_LINES | WC_WORDS | WC_CODEPOINTS));
+    
+    char **files = argv + file_start;
+    int nfiles = argc - file_start;
+    char *files0_list = NULL;
+    if (files0_path) {
+        if (nfiles > 0) {
+            fprintf(stderr, "Error: file operands cannot be combined with --files0-from\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (!(files = read_files0(files0_path, &files0_list, &nfiles))) {
+            return 1;
+        }
+    }
+    
+    // A file that shrinks while it is mapped is reported as unreadable
+    struct sigaction bus_action;
+    memset(&bus_action, 0, sizeof(bus_action));
+    bus_action.sa_handler = bus_signal;
+    sigemptyset(&bus_action.sa_mask);
+    sigaction(SIGBUS, &bus_action, NULL);
+
+    if (top_k > 0) {
+        return run_top(files, nfiles, files0_path != NULL, top_k, jobs);
+    }
+    
+    if (follow) {
+        if (nfiles != 1) {
+            fprintf(stderr, "Error: --follow needs exactly one file\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return follow_file(files[0], interval, show_lines, show_words, show_codepoints, show_chars);
+    }
+    
+    if (sample_fraction > 0) {
+        if (distinct_precision) {
+            fprintf(stderr, "Error: --estimate cannot be combined with --distinct\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return run_estimate(files, nfiles, files0_path != NULL, sample_fraction,
+                            show_lines, show_words, show_codepoints, show_chars);
+    }
+    
+    HyperLogLog distinct = {0, NULL};
+    HyperLogLog *hll = NULL;
+    if (distinct_precision) {
+        new_sketch(&distinct, distinct_precision);
+        hll = &distinct;
+    }
+    
+    // No files specified, read from stdin; an empty --files0-from list
+    // counts nothing
+    if (!files0_path && nfiles == 0) {
+        Counts counts;
+        if (!count_fd(STDIN_FILENO, jobs, hll, &counts)) {
+            fprintf(stderr, "Error: cannot read stdin\n");
+            return 1;
+        }
+        print_counts(counts, hll, show_lines, show_words, show_codepoints, show_chars, NULL);
+        hll_free(&distinct);
         return 0;
     }
     
     // Process files
-    Counts total = {0, 0, 0};
+    Cache *cache = NULL;
+    if (use_cache && !(cache = cache_open(cache_path))) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    
+    Counts total = {0, 0, 0, 0};
+    HyperLogLog total_distinct = {0, NULL};
+    if (hll) {
+        new_sketch(&total_distinct, distinct_precision);
+    }
     int num_files = 0;
     
-    for (int i = file_start; i < argc; i++) {
-        FILE *fp = fopen(argv[i], "r");
-        if (!fp) {
-            fprintf(stderr, "Error: cannot open file '%s'\n", argv[i]);
+    // On a single thread, long lists of plain counts go through io_uring,
+    // which starts on the next files while earlier ones are still being
+    // read; with more jobs the worker pool below overlaps them instead. The
+    // cache and --distinct need the file-at-a-time path; -c needs no reading
+    // at all. WORDCOUNT_URING=0 turns it off; the tests use it to compare
+    // both paths.
+    const char *uring_env = getenv("WORDCOUNT_URING");
+    if (jobs == 1 && nfiles >= URING_MIN_FILES && !cache && !hll && !bytes_only &&
+        !(uring_env && strcmp(uring_env, "0") == 0)) {
+        CountStatus status;
+        num_files = count_files_uring(files, nfiles, &total, &status,
+                                      show_lines, show_words, show_codepoints, show_chars);
+        if (status != COUNT_OK) {
+            report_error(files[num_files], status);
+            free(files0_list);
             return 1;
         }
+    }
+    
+    // Several files are spread over a worker pool, one file per worker;
+    // a single file gets all the threads to itself instead.
+    FilePool pool;
+    int remaining = nfiles - num_files;
+    long workers = jobs < remaining ? jobs : remaining;
+    bool pooled = workers > 1 && file_pool_start(&pool, files + num_files, remaining, workers,
+                                                      cache, distinct_precision);
+    
+    for (int i = num_files; i < nfiles; i++) {
+        Counts counts;
+        CountStatus status;
+        if (pooled) {
+            hll_free(&distinct);
+            status = file_pool_wait(&pool, i - (nfiles - remaining), &counts, &distinct);
+        } else {
+            hll_clear(&distinct);
+            status = count_path(files[i], jobs, cache, hll, &counts);
+        }
         
-        Counts counts = count_stream(fp);
-        fclose(fp);
+        if (status != COUNT_OK) {
+            if (pooled) {
+                file_pool_stop(&pool);
+            }
+            report_error(files[i], status);
+            hll_free(&distinct);
+            hll_free(&total_distinct);
+            free(files0_list);
+            return 1;
+        }
         
-        print_counts(counts, show_lines, show_words, show_chars, argv[i]);
+        print_counts(counts, hll, show_lines, show_words, show_codepoints, show_chars, files[i]);
+        if (hll) {
+            hll_merge(&total_distinct, &distinct);
+        }
         
-        total.lines += counts.lines;
-        total.words += counts.words;
-        total.chars += counts.chars;
+        total = add_counts(total, counts);
         num_files++;
     }
     
+    if (pooled) {
+        file_pool_stop(&pool);
+    }
+    
+    if (cache) {
+        if (cache_save(cache) != 0) {
+            fprintf(stderr, "Warning: cannot write cache '%s'\n", cache_path);
+        }
+        cache_close(cache);
+    }
+    
     // Print total if multiple files
     if (num_files > 1) {
-        print_counts(total, show_lines, show_words, show_chars, "total");
+        print_counts(total, hll ? &total_distinct : NULL, show_lines, show_words, show_codepoints, show_chars, "total");
+    }
+    hll_free(&distinct);
+    hll_free(&total_distinct);
+    if (files0_list) {
+        free(files0_list);
+        free(files);
     }
     
     return 0;
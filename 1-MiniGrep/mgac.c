@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "mgac.h"
+
+/**
+ * assign_classes - numbers the distinct (folded) pattern bytes
+ * @ac: automaton whose class_of and nclasses are filled in
+ *
+ * Class 0 stands for every byte that occurs in no pattern.
+ */
+static void assign_classes(AhoCorasick *ac, char **patterns, size_t npatterns, int case_insensitive) {
+    uint16_t next = 1;
+
+    for (int c = 0; c < 256; c++) {
+        *(ac->class_of + c) = 0;
+    }
+    for (size_t i = 0; i < npatterns; i++) {
+        for (const unsigned char *p = (const unsigned char *)*(patterns + i); *p != '\0'; p++) {
+            unsigned char c = case_insensitive ? (unsigned char)tolower(*p) : *p;
+            if (*(ac->class_of + c) == 0) {
+                *(ac->class_of + c) = next++;
+            }
+        }
+    }
+    if (case_insensitive) {
+        for (int c = 0; c < 256; c++) {
+            *(ac->class_of + c) = *(ac->class_of + (unsigned char)tolower(c));
+        }
+    }
+    ac->nclasses = next;
+}
+
+int ac_init(AhoCorasick *ac, char **patterns, size_t npatterns, int case_insensitive) {
+    size_t max_states = 1;
+    uint32_t *fail = NULL;
+    uint32_t *queue = NULL;
+    unsigned char *accept = NULL;
+
+    ac->table = NULL;
+    ac->nstates = 1;
+    ac->root_accepts = 0;
+    assign_classes(ac, patterns, npatterns, case_insensitive);
+
+    for (size_t i = 0; i < npatterns; i++) {
+        for (const char *p = *(patterns + i); *p != '\0'; p++) {
+            max_states++;
+        }
+    }
+    // Row offsets must stay clear of AC_ACCEPT
+    if (max_states > AC_ACCEPT / ac->nclasses) {
+        return -1;
+    }
+
+    ac->table = calloc(max_states * ac->nclasses, sizeof(uint32_t));
+    fail = malloc(max_states * sizeof(uint32_t));
+    queue = malloc(max_states * sizeof(uint32_t));
+    accept = calloc(max_states, 1);
+    if (ac->table == NULL || fail == NULL || queue == NULL || accept == NULL) {
+        free(fail);
+        free(queue);
+        free(accept);
+        ac_free(ac);
+        return -1;
+    }
+
+    // Trie of the patterns; 0 marks a missing child, since no edge leads
+    // back to the root
+    for (size_t i = 0; i < npatterns; i++) {
+        uint32_t s = 0;
+        for (const unsigned char *p = (const unsigned char *)*(patterns + i); *p != '\0'; p++) {
+            uint32_t *edge = ac->table + (size_t)s * ac->nclasses + *(ac->class_of + *p);
+            if (*edge == 0) {
+                *edge = ac->nstates++;
+            }
+            s = *edge;
+        }
+        *(accept + s) = 1;
+    }
+    ac->root_accepts = *accept;
+
+    // Breadth-first, each state's failure link points to a shallower state
+    // whose row is already complete, so missing edges can be copied from it
+    size_t head = 0;
+    size_t tail = 0;
+    for (uint32_t c = 0; c < ac->nclasses; c++) {
+        uint32_t t = *(ac->table + c);
+        if (t != 0) {
+            *(fail + t) = 0;
+            *(queue + tail++) = t;
+        }
+    }
+    while (head < tail) {
+        uint32_t s = *(queue + head++);
+        uint32_t *row = ac->table + (size_t)s * ac->nclasses;
+        uint32_t *fail_row = ac->table + (size_t)*(fail + s) * ac->nclasses;
+
+        for (uint32_t c = 0; c < ac->nclasses; c++) {
+            uint32_t t = *(row + c);
+            if (t != 0) {
+                *(fail + t) = *(fail_row + c);
+                *(accept + t) |= *(accept + *(fail + t));
+                *(queue + tail++) = t;
+            } else {
+                *(row + c) = *(fail_row + c);
+            }
+        }
+    }
+
+    // Turn targets into row offsets tagged with acceptance
+    for (size_t i = 0; i < (size_t)ac->nstates * ac->nclasses; i++) {
+        uint32_t t = *(ac->table + i);
+        *(ac->table + i) = t * ac->nclasses | (*(accept + t) ? AC_ACCEPT : 0);
+    }
+
+    uint32_t *shrunk = realloc(ac->table, (size_t)ac->nstates * ac->nclasses * sizeof(uint32_t));
+    if (shrunk != NULL) {
+        ac->table = shrunk;
+    }
+
+    free(fail);
+    free(queue);
+    free(accept);
+    return 0;
+}
+
+const char *ac_find(const AhoCorasick *ac, const char *text, size_t len) {
+    const unsigned char *p = (const unsigned char *)text;
+    const unsigned char *end = p + len;
+    const uint32_t *table = ac->table;
+    const uint16_t *class_of = ac->class_of;
+    uint32_t s = 0;
+
+    if (ac->root_accepts) {
+        return text;
+    }
+
+    while (p < end) {
+        s = *(table + s + *(class_of + *p));
+        if (s & AC_ACCEPT) {
+            return (const char *)p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+void ac_free(AhoCorasick *ac) {
+    free(ac->table);
+    ac->table = NULL;
+}
@@ -0,0 +1,56 @@
+#ifndef __MGAC_H__
+#define __MGAC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Set in a transition whose target state ends at least one pattern
+#define AC_ACCEPT 0x80000000u
+
+/**
+ * AhoCorasick - many literal patterns compiled into one automaton
+ *
+ * The automaton is a complete DFA: failure links are resolved while it is
+ * built, so the search takes exactly one table lookup per text byte. Bytes
+ * are first mapped to classes (one per distinct pattern byte, plus one for
+ * every other byte; -i folds both cases into one class), which keeps rows
+ * as narrow as the pattern alphabet. Each transition holds the target
+ * state's row offset, with AC_ACCEPT set if that state ends a pattern.
+ */
+typedef struct {
+    uint32_t *table;            // nstates rows of nclasses transitions
+    uint32_t nstates;
+    uint32_t nclasses;
+    uint16_t class_of[256];     // byte -> class
+    int root_accepts;           // an empty pattern matches everywhere
+} AhoCorasick;
+
+/**
+ * ac_init - builds the automaton for a set of patterns
+ * @ac: automaton to fill in
+ * @patterns: null-terminated patterns
+ * @npatterns: number of patterns, may be 0 (nothing matches)
+ * @case_insensitive: if 1, match letters regardless of case
+ *
+ * Returns: 0 on success, -1 if memory could not be allocated
+ */
+int ac_init(AhoCorasick *ac, char **patterns, size_t npatterns, int case_insensitive);
+
+/**
+ * ac_find - finds the first place where any pattern ends
+ * @ac: automaton from ac_init()
+ * @text: bytes to search, need not be null-terminated
+ * @len: number of bytes in text
+ *
+ * Returns: pointer to the last byte of the earliest-ending match (the
+ * start of text for an empty pattern), or NULL if nothing matches
+ */
+const char *ac_find(const AhoCorasick *ac, const char *text, size_t len);
+
+/**
+ * ac_free - releases memory held by the automaton
+ * @ac: automaton from ac_init()
+ */
+void ac_free(AhoCorasick *ac);
+
+#endif
@@ -0,0 +1,775 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "mgindex.h"
+#include "mgwalk.h"
+
+#define INDEX_MAGIC "MGINDEX1"
+
+// Files with a NUL byte in this many first bytes get no trigrams
+#define BINARY_CHECK_SZ (256 * 1024)
+
+// Trigrams are 24 bits
+#define TRIGRAM_SPACE (1u << 24)
+
+// Marks a file that was not in the previous index
+#define NO_ID UINT32_MAX
+
+/**
+ * BuildFile - a file found while building, with its id in the previous
+ * index if it has not changed since
+ */
+typedef struct {
+    char *path;                 // relative to the directory
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint32_t old_id;
+} BuildFile;
+
+/**
+ * Posting - a posting list being built: ids are appended in ascending
+ * order, already delta-encoded
+ */
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint32_t last;              // last id appended
+    unsigned char *bytes;
+    size_t len;
+    size_t cap;
+} Posting;
+
+typedef struct {
+    const char *dir;
+    const char *sep;            // "/" unless dir ends with one
+    BuildFile *files;
+    size_t nfiles;
+    size_t file_cap;
+    Posting *postings;
+    size_t npostings;
+    size_t posting_cap;
+    uint32_t *slots;            // hash table of posting index + 1, 0 if free
+    unsigned slot_bits;
+    uint64_t *seen;             // bitmap of the trigrams in the current file
+    uint32_t *found;            // the trigrams set in seen
+    size_t nfound;
+    size_t found_cap;
+    int nomem;
+    int failed;
+} Builder;
+
+static unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c + 'a' - 'A') : c;
+}
+
+// Path of the index file, or of its temporary copy if suffix is given
+static char *index_file_name(const char *dir, const char *suffix) {
+    size_t dir_len = strlen(dir);
+    size_t len = dir_len + sizeof(INDEX_NAME) + strlen(suffix) + 1;
+    char *name = malloc(len);
+
+    if (name != NULL) {
+        snprintf(name, len, "%s%s%s%s", dir, dir_len > 0 && *(dir + dir_len - 1) == '/' ? "" : "/",
+                 INDEX_NAME, suffix);
+    }
+    return name;
+}
+
+// Decodes one varint; returns NULL past end or on a malformed number
+static const unsigned char *read_varint(const unsigned char *p, const unsigned char *end, uint32_t *value) {
+    uint32_t v = 0;
+
+    for (unsigned shift = 0; p < end && shift < 35; shift += 7) {
+        unsigned char byte = *p++;
+        v |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int posting_append(Posting *p, uint32_t id) {
+    uint32_t delta = p->count > 0 ? id - p->last : id;
+
+    if (p->len + 5 > p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 8;
+        unsigned char *grown = realloc(p->bytes, cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        p->bytes = grown;
+        p->cap = cap;
+    }
+    while (delta >= 0x80) {
+        *(p->bytes + p->len++) = (unsigned char)(delta | 0x80);
+        delta >>= 7;
+    }
+    *(p->bytes + p->len++) = (unsigned char)delta;
+    p->last = id;
+    p->count++;
+    return 0;
+}
+
+static size_t slot_of(const Builder *b, uint32_t trigram) {
+    return (uint32_t)(trigram * 0x9E3779B1u) >> (32 - b->slot_bits);
+}
+
+// Doubles the hash table of postings
+static int grow_slots(Builder *b) {
+    unsigned bits = b->slot_bits ? b->slot_bits + 1 : 16;
+    uint32_t *slots = calloc((size_t)1 << bits, sizeof(uint32_t));
+
+    if (slots == NULL) {
+        return -1;
+    }
+    free(b->slots);
+    b->slots = slots;
+    b->slot_bits = bits;
+    for (size_t i = 0; i < b->npostings; i++) {
+        size_t s = slot_of(b, (b->postings + i)->trigram);
+        while (*(slots + s) != 0) {
+            s = (s + 1) & (((size_t)1 << bits) - 1);
+        }
+        *(slots + s) = (uint32_t)i + 1;
+    }
+    return 0;
+}
+
+// Appends id to the posting list of trigram, creating the list
+static int add_posting(Builder *b, uint32_t trigram, uint32_t id) {
+    if ((b->npostings + 1) * 2 > ((size_t)1 << b->slot_bits) && grow_slots(b) != 0) {
+        return -1;
+    }
+
+    size_t mask = ((size_t)1 << b->slot_bits) - 1;
+    size_t s = slot_of(b, trigram);
+    while (*(b->slots + s) != 0) {
+        Posting *p = b->postings + *(b->slots + s) - 1;
+        if (p->trigram == trigram) {
+            return posting_append(p, id);
+        }
+        s = (s + 1) & mask;
+    }
+
+    if (b->npostings == b->posting_cap) {
+        size_t cap = b->posting_cap ? b->posting_cap * 2 : 4096;
+        Posting *grown = realloc(b->postings, cap * sizeof(Posting));
+        if (grown == NULL) {
+            return -1;
+        }
+        b->postings = grown;
+        b->posting_cap = cap;
+    }
+    Posting *p = b->postings + b->npostings++;
+    memset(p, 0, sizeof(Posting));
+    p->trigram = trigram;
+    *(b->slots + s) = (uint32_t)b->npostings;
+    return posting_append(p, id);
+}
+
+// walk_tree() callback: records a file with its modification time
+static void collect_file(void *ctx, unsigned worker, int dirfd, const char *name, const char *path) {
+    Builder *b = ctx;
+    const char *rel = path + strlen(b->dir);
+    struct stat st;
+
+    (void)worker;
+    if (*rel == '/') {
+        rel++;
+    }
+    if (fstatat(dirfd, name, &st, 0) != 0) {
+        printf("Error: Cannot open file %s\n", path);
+        b->failed = 1;
+        return;
+    }
+    if (b->nfiles == b->file_cap) {
+        size_t cap = b->file_cap ? b->file_cap * 2 : 1024;
+        BuildFile *grown = realloc(b->files, cap * sizeof(BuildFile));
+        if (grown == NULL) {
+            b->nomem = 1;
+            return;
+        }
+        b->files = grown;
+        b->file_cap = cap;
+    }
+    BuildFile *f = b->files + b->nfiles;
+    f->path = strdup(rel);
+    if (f->path == NULL) {
+        b->nomem = 1;
+        return;
+    }
+    f->mtime_sec = st.st_mtim.tv_sec;
+    f->mtime_nsec = st.st_mtim.tv_nsec;
+    f->size = st.st_size;
+    f->old_id = NO_ID;
+    b->nfiles++;
+}
+
+static void report_dir(void *ctx, unsigned worker, const char *path) {
+    Builder *b = ctx;
+
+    (void)worker;
+    printf("Error: Cannot read directory %s\n", path);
+    b->failed = 1;
+}
+
+/**
+ * scan_file - adds the trigrams of a new or changed file
+ * @b: builder
+ * @dirfd: the indexed directory
+ * @f: the file
+ * @id: its id in the new index
+ *
+ * Returns: 0, or -1 if memory runs out
+ */
+static int scan_file(Builder *b, int dirfd, BuildFile *f, uint32_t id) {
+    int fd = openat(dirfd, f->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Error: Cannot read file %s%s%s\n", b->dir, b->sep, f->path);
+        f->size = -1;       // read it again next time
+        b->failed = 1;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = (size_t)st.st_size;
+    unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Error: Cannot read file %s%s%s\n", b->dir, b->sep, f->path);
+        f->size = -1;
+        b->failed = 1;
+        return 0;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    if (memchr(map, '\0', size < BINARY_CHECK_SZ ? size : BINARY_CHECK_SZ) == NULL) {
+        uint32_t trigram = 0;
+        size_t run = 0;     // bytes since the last newline
+
+        for (size_t i = 0; i < size; i++) {
+            unsigned char c = *(map + i);
+            if (c == '\n') {
+                run = 0;
+                continue;
+            }
+            trigram = ((trigram << 8) | fold(c)) & (TRIGRAM_SPACE - 1);
+            if (++run < 3 || (*(b->seen + trigram / 64) >> (trigram % 64) & 1)) {
+                continue;
+            }
+            *(b->seen + trigram / 64) |= (uint64_t)1 << (trigram % 64);
+            if (b->nfound == b->found_cap) {
+                size_t cap = b->found_cap ? b->found_cap * 2 : 4096;
+                uint32_t *grown = realloc(b->found, cap * sizeof(uint32_t));
+                if (grown == NULL) {
+                    munmap(map, size);
+                    return -1;
+                }
+                b->found = grown;
+                b->found_cap = cap;
+            }
+            *(b->found + b->nfound++) = trigram;
+        }
+    }
+    munmap(map, size);
+
+    for (size_t i = 0; i < b->nfound; i++) {
+        uint32_t trigram = *(b->found + i);
+        *(b->seen + trigram / 64) &= ~((uint64_t)1 << (trigram % 64));
+        if (add_posting(b, trigram, id) != 0) {
+            return -1;
+        }
+    }
+    b->nfound = 0;
+    return 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(((const BuildFile *)a)->path, ((const BuildFile *)b)->path);
+}
+
+static int compare_index_paths(const void *a, const void *b, void *index) {
+    return strcmp(index_path(index, *(const uint32_t *)a), index_path(index, *(const uint32_t *)b));
+}
+
+static int compare_old_ids(const void *a, const void *b) {
+    uint32_t x = ((const BuildFile *)a)->old_id;
+    uint32_t y = ((const BuildFile *)b)->old_id;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_trigrams(const void *a, const void *b) {
+    uint32_t x = ((const Posting *)a)->trigram;
+    uint32_t y = ((const Posting *)b)->trigram;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * match_old_files - finds the files that have not changed since the
+ * previous index, and orders them first, as they were
+ *
+ * Returns: the number of unchanged files, or -1 if memory runs out
+ */
+static long match_old_files(Builder *b, const TrigramIndex *old) {
+    uint32_t nold = old->header->nfiles;
+    const uint32_t *by_path = old->by_path;
+    size_t kept = 0;
+
+    // Both lists are sorted by path: merge them
+    size_t j = 0;
+    for (size_t i = 0; i < b->nfiles; i++) {
+        BuildFile *f = b->files + i;
+        int cmp = 1;
+        while (j < nold && (cmp = strcmp(index_path(old, *(by_path + j)), f->path)) < 0) {
+            j++;
+        }
+        if (j < nold && cmp == 0) {
+            const IndexFile *o = old->files + *(by_path + j);
+            if (o->mtime_sec == f->mtime_sec && o->mtime_nsec == f->mtime_nsec && o->size == f->size) {
+                f->old_id = *(by_path + j);
+                kept++;
+            }
+        }
+    }
+
+    // Unchanged files first, in their old order; the rest stay sorted by
+    // path
+    BuildFile *ordered = malloc((b->nfiles + 1) * sizeof(BuildFile));
+    if (ordered == NULL) {
+        return -1;
+    }
+    size_t front = 0;
+    size_t back = kept;
+    for (size_t i = 0; i < b->nfiles; i++) {
+        *(ordered + ((b->files + i)->old_id != NO_ID ? front++ : back++)) = *(b->files + i);
+    }
+    free(b->files);
+    b->files = ordered;
+    b->file_cap = b->nfiles + 1;
+    qsort(b->files, kept, sizeof(BuildFile), compare_old_ids);
+    return (long)kept;
+}
+
+/**
+ * carry_postings - copies the posting entries of unchanged files from
+ * the previous index, renumbered
+ *
+ * Returns: 0, or -1 if memory runs out
+ */
+static int carry_postings(Builder *b, const TrigramIndex *old, size_t kept) {
+    uint32_t nold = old->header->nfiles;
+    uint32_t *new_id = malloc((nold + 1) * sizeof(uint32_t));
+    const unsigned char *end = (const unsigned char *)old->map + old->size;
+
+    if (new_id == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < nold; i++) {
+        *(new_id + i) = NO_ID;
+    }
+    for (size_t i = 0; i < kept; i++) {
+        *(new_id + (b->files + i)->old_id) = (uint32_t)i;
+    }
+
+    for (uint32_t t = 0; t < old->header->ntrigrams; t++) {
+        const IndexTrigram *entry = old->trigrams + t;
+        const unsigned char *p = old->postings + entry->off;
+        uint32_t id = 0;
+        for (uint32_t k = 0; k < entry->count && p != NULL; k++) {
+            uint32_t delta;
+            p = read_varint(p, end, &delta);
+            id += delta;
+            if (p != NULL && id < nold && *(new_id + id) != NO_ID &&
+                add_posting(b, entry->trigram, *(new_id + id)) != 0) {
+                free(new_id);
+                return -1;
+            }
+        }
+    }
+    free(new_id);
+    return 0;
+}
+
+static void pad_to_8(FILE *out, uint64_t *off) {
+    static const char zeros[8];
+
+    fwrite(zeros, 1, (8 - *off % 8) % 8, out);
+    *off += (8 - *off % 8) % 8;
+}
+
+/**
+ * write_index - writes the index to a temporary file, then renames it
+ * over the index
+ *
+ * Returns: 0, or -1 if it cannot be written
+ */
+static int write_index(Builder *b) {
+    IndexHeader header;
+    uint64_t off;
+    char *tmp_name = index_file_name(b->dir, ".tmp");
+    char *name = index_file_name(b->dir, "");
+    FILE *out = tmp_name ? fopen(tmp_name, "wb") : NULL;
+    int status = -1;
+
+    if (out == NULL) {
+        goto done;
+    }
+    qsort(b->postings, b->npostings, sizeof(Posting), compare_trigrams);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.nfiles = (uint32_t)b->nfiles;
+    header.ntrigrams = (uint32_t)b->npostings;
+    header.paths_off = sizeof(IndexHeader) + b->nfiles * sizeof(IndexFile);
+    fwrite(&header, sizeof(header), 1, out);
+
+    off = 0;
+    for (size_t i = 0; i < b->nfiles; i++) {
+        const BuildFile *f = b->files + i;
+        IndexFile entry = {off, f->mtime_sec, f->mtime_nsec, f->size};
+        fwrite(&entry, sizeof(entry), 1, out);
+        off += strlen(f->path) + 1;
+    }
+    for (size_t i = 0; i < b->nfiles; i++) {
+        fwrite((b->files + i)->path, 1, strlen((b->files + i)->path) + 1, out);
+    }
+    off += header.paths_off;
+    pad_to_8(out, &off);
+
+    header.trigrams_off = off;
+    header.postings_off = off + b->npostings * sizeof(IndexTrigram);
+    off = 0;
+    for (size_t i = 0; i < b->npostings; i++) {
+        const Posting *p = b->postings + i;
+        IndexTrigram entry = {p->trigram, p->count, off};
+        fwrite(&entry, sizeof(entry), 1, out);
+        off += p->len;
+    }
+    for (size_t i = 0; i < b->npostings; i++) {
+        fwrite((b->postings + i)->bytes, 1, (b->postings + i)->len, out);
+    }
+    header.size = header.postings_off + off;
+
+    // The header goes last, now that the offsets are known
+    if (fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1 &&
+        fflush(out) == 0 && !ferror(out)) {
+        status = 0;
+    }
+    if (fclose(out) != 0) {
+        status = -1;
+    }
+    if (status == 0 && rename(tmp_name, name) != 0) {
+        status = -1;
+    }
+    if (status != 0) {
+        unlink(tmp_name);
+    }
+
+done:
+    free(tmp_name);
+    free(name);
+    return status;
+}
+
+static void free_builder(Builder *b) {
+    for (size_t i = 0; i < b->nfiles; i++) {
+        free((b->files + i)->path);
+    }
+    for (size_t i = 0; i < b->npostings; i++) {
+        free((b->postings + i)->bytes);
+    }
+    free(b->files);
+    free(b->postings);
+    free(b->slots);
+    free(b->seen);
+    free(b->found);
+}
+
+int index_build(const char *dir, IndexStats *stats) {
+    Builder b;
+    Walk walk;
+    TrigramIndex old;
+    int old_status;
+    long kept = 0;
+    int status = 0;
+    struct stat st;
+
+    memset(stats, 0, sizeof(*stats));
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        printf("Error: Cannot read directory %s\n", dir);
+        return 3;
+    }
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) {
+        printf("Error: Cannot read directory %s\n", dir);
+        return 3;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.dir = dir;
+    b.sep = *dir != '\0' && *(dir + strlen(dir) - 1) == '/' ? "" : "/";
+    walk.nthreads = 1;
+    walk.include_hidden = 0;
+    walk.visit_file = collect_file;
+    walk.report_error = report_dir;
+    walk.ctx = &b;
+    walk.stop = NULL;
+    b.seen = calloc(TRIGRAM_SPACE / 64, sizeof(uint64_t));
+    if (b.seen == NULL || grow_slots(&b) != 0 || walk_tree(dir, &walk) != 0 || b.nomem) {
+        status = 4;
+        goto done;
+    }
+    qsort(b.files, b.nfiles, sizeof(BuildFile), compare_paths);
+
+    old_status = index_open(&old, dir);
+    if (old_status == -2) {
+        status = 4;
+        goto done;
+    }
+    if (old_status == 0) {
+        kept = match_old_files(&b, &old);
+        if (kept < 0 || carry_postings(&b, &old, (size_t)kept) != 0) {
+            index_close(&old);
+            status = 4;
+            goto done;
+        }
+        index_close(&old);
+    }
+
+    for (size_t i = (size_t)kept; i < b.nfiles; i++) {
+        if (scan_file(&b, dirfd, b.files + i, (uint32_t)i) != 0) {
+            status = 4;
+            goto done;
+        }
+    }
+
+    if (write_index(&b) != 0) {
+        printf("Error: Cannot write index %s\n", dir);
+        status = 3;
+        goto done;
+    }
+    stats->nfiles = (uint32_t)b.nfiles;
+    stats->nscanned = (uint32_t)(b.nfiles - (size_t)kept);
+    stats->ntrigrams = (uint32_t)b.npostings;
+    stats->failed = b.failed;
+
+done:
+    close(dirfd);
+    free_builder(&b);
+    return status;
+}
+
+int index_open(TrigramIndex *index, const char *dir) {
+    char *name = index_file_name(dir, "");
+    int fd = name ? open(name, O_RDONLY | O_CLOEXEC) : -1;
+    struct stat st;
+
+    free(name);
+    memset(index, 0, sizeof(*index));
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return -1;
+    }
+    index->size = (size_t)st.st_size;
+    index->map = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        return -1;
+    }
+
+    // Check that every table lies inside the file
+    const IndexHeader *h = (const IndexHeader *)index->map;
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0 || h->size != index->size ||
+        h->paths_off != sizeof(IndexHeader) + (uint64_t)h->nfiles * sizeof(IndexFile) ||
+        h->trigrams_off < h->paths_off || h->trigrams_off % 8 != 0 ||
+        h->postings_off != h->trigrams_off + (uint64_t)h->ntrigrams * sizeof(IndexTrigram) ||
+        h->postings_off > h->size ||
+        (h->trigrams_off > h->paths_off ? *(index->map + h->trigrams_off - 1) != '\0' : h->nfiles > 0)) {
+        index_close(index);
+        return -1;
+    }
+    index->header = h;
+    index->files = (const IndexFile *)(index->map + sizeof(IndexHeader));
+    index->paths = index->map + h->paths_off;
+    index->trigrams = (const IndexTrigram *)(index->map + h->trigrams_off);
+    index->postings = (const unsigned char *)index->map + h->postings_off;
+    for (uint32_t i = 0; i < h->nfiles; i++) {
+        if ((index->files + i)->path >= h->trigrams_off - h->paths_off) {
+            index_close(index);
+            return -1;
+        }
+    }
+
+    index->by_path = malloc(((size_t)h->nfiles + 1) * sizeof(uint32_t));
+    if (index->by_path == NULL) {
+        index_close(index);
+        return -2;
+    }
+    for (uint32_t i = 0; i < h->nfiles; i++) {
+        *(index->by_path + i) = i;
+    }
+    qsort_r(index->by_path, h->nfiles, sizeof(uint32_t), compare_index_paths, index);
+    return 0;
+}
+
+const char *index_path(const TrigramIndex *index, uint32_t id) {
+    return index->paths + (index->files + id)->path;
+}
+
+long index_find(const TrigramIndex *index, const char *path) {
+    size_t lo = 0;
+    size_t hi = index->header->nfiles;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t id = *(index->by_path + mid);
+        int cmp = strcmp(index_path(index, id), path);
+        if (cmp == 0) {
+            return id;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+int index_current(const TrigramIndex *index, uint32_t id, const struct stat *st) {
+    const IndexFile *f = index->files + id;
+
+    return f->mtime_sec == st->st_mtim.tv_sec && f->mtime_nsec == st->st_mtim.tv_nsec && f->size == st->st_size;
+}
+
+// The trigram at the start of text
+static uint32_t trigram_at(const char *text) {
+    return (uint32_t)fold((unsigned char)*text) << 16 | (uint32_t)fold((unsigned char)*(text + 1)) << 8 |
+           fold((unsigned char)*(text + 2));
+}
+
+// Binary search for a trigram's entry; NULL if no file has it
+static const IndexTrigram *find_trigram(const TrigramIndex *index, uint32_t trigram) {
+    size_t lo = 0;
+    size_t hi = index->header->ntrigrams;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t t = (index->trigrams + mid)->trigram;
+        if (t == trigram) {
+            return index->trigrams + mid;
+        }
+        if (t < trigram) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Keeps the ids that are also in a posting list; returns how many remain
+static size_t intersect(const TrigramIndex *index, uint32_t *ids, size_t nids, const IndexTrigram *entry) {
+    const unsigned char *p = index->postings + entry->off;
+    const unsigned char *end = (const unsigned char *)index->map + index->size;
+    uint32_t id = 0;
+    uint32_t k = 0;
+    size_t kept = 0;
+    int have = 0;       // id holds an undecoded entry
+
+    for (size_t i = 0; i < nids; i++) {
+        while (!have || id < *(ids + i)) {
+            uint32_t delta;
+            if (k == entry->count || (p = read_varint(p, end, &delta)) == NULL) {
+                return kept;
+            }
+            id = k++ == 0 ? delta : id + delta;
+            have = 1;
+        }
+        if (id == *(ids + i)) {
+            *(ids + kept++) = id;
+        }
+    }
+    return kept;
+}
+
+int index_candidates(const TrigramIndex *index, const char *pattern, size_t len, unsigned char *marks) {
+    uint32_t nfiles = index->header->nfiles;
+    const IndexTrigram *shortest = NULL;
+
+    if (len < 3) {
+        memset(marks, 1, nfiles);
+        return 0;
+    }
+
+    // Every trigram must be present; the rarest one seeds the candidates
+    for (size_t i = 0; i + 3 <= len; i++) {
+        const IndexTrigram *entry = find_trigram(index, trigram_at(pattern + i));
+        if (entry == NULL) {
+            return 0;
+        }
+        if (shortest == NULL || entry->count < shortest->count) {
+            shortest = entry;
+        }
+    }
+
+    uint32_t *ids = malloc(((size_t)shortest->count + 1) * sizeof(uint32_t));
+    if (ids == NULL) {
+        return -1;
+    }
+    const unsigned char *p = index->postings + shortest->off;
+    const unsigned char *end = (const unsigned char *)index->map + index->size;
+    size_t nids = 0;
+    uint32_t id = 0;
+    for (uint32_t k = 0; k < shortest->count; k++) {
+        uint32_t delta;
+        if ((p = read_varint(p, end, &delta)) == NULL) {
+            break;
+        }
+        id = k == 0 ? delta : id + delta;
+        *(ids + nids++) = id;
+    }
+
+    for (size_t i = 0; i + 3 <= len && nids > 0; i++) {
+        const IndexTrigram *entry = find_trigram(index, trigram_at(pattern + i));
+        if (entry != shortest) {
+            nids = intersect(index, ids, nids, entry);
+        }
+    }
+    for (size_t i = 0; i < nids; i++) {
+        if (*(ids + i) < nfiles) {
+            *(marks + *(ids + i)) = 1;
+        }
+    }
+    free(ids);
+    return 0;
+}
+
+void index_close(TrigramIndex *index) {
+    if (index->map != NULL) {
+        munmap(index->map, index->size);
+    }
+    free(index->by_path);
+    memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,143 @@
+#ifndef __MGINDEX_H__
+#define __MGINDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Name of the index file, in the indexed directory
+#define INDEX_NAME ".mgindex"
+
+/**
+ * Index file layout - read through a mapping, in host byte order:
+ *
+ *   IndexHeader
+ *   IndexFile[nfiles]          the indexed files
+ *   paths                      their paths relative to the directory,
+ *                              null-terminated
+ *   IndexTrigram[ntrigrams]    sorted by trigram, at an 8-byte offset
+ *   postings                   one list per trigram
+ *
+ * A trigram is three consecutive bytes of a line, with ASCII letters in
+ * lower case, packed into 24 bits. Its posting list holds the ids (the
+ * positions in the file table) of the files that contain it, ascending,
+ * as the first id followed by the gaps between ids, each as a varint:
+ * seven bits per byte, low bits first, high bit set on all but the last.
+ *
+ * Files with a NUL byte in their first 256 KiB are listed with no
+ * trigrams, as -r skips them.
+ */
+typedef struct {
+    char magic[8];              // "MGINDEX1"
+    uint32_t nfiles;
+    uint32_t ntrigrams;
+    uint64_t paths_off;
+    uint64_t trigrams_off;
+    uint64_t postings_off;
+    uint64_t size;              // size of the index file
+} IndexHeader;
+
+typedef struct {
+    uint64_t path;              // offset of the path in paths
+    int64_t mtime_sec;          // modification time when it was indexed
+    int64_t mtime_nsec;
+    int64_t size;               // size when it was indexed
+} IndexFile;
+
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;             // files in the list
+    uint64_t off;               // offset of the list in postings
+} IndexTrigram;
+
+/**
+ * TrigramIndex - an index file mapped for queries
+ */
+typedef struct {
+    char *map;
+    size_t size;
+    const IndexHeader *header;
+    const IndexFile *files;
+    const char *paths;
+    const IndexTrigram *trigrams;
+    const unsigned char *postings;
+    uint32_t *by_path;          // file ids sorted by path
+} TrigramIndex;
+
+/**
+ * IndexStats - what index_build() did
+ */
+typedef struct {
+    uint32_t nfiles;            // files in the index
+    uint32_t nscanned;          // new or changed files that were read
+    uint32_t ntrigrams;         // distinct trigrams
+    int failed;                 // a file or directory could not be read
+} IndexStats;
+
+/**
+ * index_build - creates or updates the index of a directory tree
+ * @dir: directory to index; the index is written to dir/INDEX_NAME
+ * @stats: receives counts of files and trigrams
+ *
+ * Files are found as by -r (hidden ones are skipped). A file whose
+ * modification time and size match the previous index keeps its posting
+ * entries, which are carried over from that index; only new and changed
+ * files are read. Deleted files are dropped. The new index replaces the
+ * old one atomically.
+ *
+ * Files or directories that cannot be read are reported on stdout; such
+ * files are indexed again by the next build.
+ *
+ * Returns: 0, 3 if dir or the index cannot be read or written, 4 if
+ * memory runs out
+ */
+int index_build(const char *dir, IndexStats *stats);
+
+/**
+ * index_open - maps the index of a directory
+ * @index: receives the mapped index
+ * @dir: indexed directory
+ *
+ * Returns: 0, -1 if there is no valid index, or -2 if memory runs out
+ */
+int index_open(TrigramIndex *index, const char *dir);
+
+/**
+ * index_path - path of an indexed file, relative to the directory
+ */
+const char *index_path(const TrigramIndex *index, uint32_t id);
+
+/**
+ * index_find - looks up a file by its path relative to the directory
+ *
+ * Returns: the file's id, or -1 if it is not in the index
+ */
+long index_find(const TrigramIndex *index, const char *path);
+
+/**
+ * index_current - whether a file still has the modification time and
+ * size it was indexed with
+ * @st: the file's status now
+ */
+int index_current(const TrigramIndex *index, uint32_t id, const struct stat *st);
+
+/**
+ * index_candidates - marks the files that may contain a literal pattern
+ * @index: mapped index
+ * @pattern: the pattern, in any case
+ * @len: its length; a pattern of fewer than 3 bytes marks every file
+ * @marks: one byte per file, set to 1 for each candidate
+ *
+ * The candidates are the files whose posting lists hold every trigram of
+ * the pattern; case is ignored, so they are valid for -i too.
+ *
+ * Returns: 0, or -1 if memory could not be allocated
+ */
+int index_candidates(const TrigramIndex *index, const char *pattern, size_t len, unsigned char *marks);
+
+/**
+ * index_close - unmaps the index
+ */
+void index_close(TrigramIndex *index);
+
+#endif
@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "mgout.h"
+
+// Slices passed to one writev() or vmsplice() call
+#define OUT_IOV_MAX 1024
+
+// Own storage of a buffer that is flushed regularly
+#define OUT_HALF_SZ (OUT_FLUSH_SZ + 4 * OUT_COPY_MAX)
+
+// Pause while waiting for the pipe reader to catch up
+#define DRAIN_WAIT_NS 20000
+
+typedef enum {
+    MODE_UNKNOWN,
+    MODE_WRITE,                 // writev()
+    MODE_SPLICE                 // vmsplice() into a pipe
+} OutputMode;
+
+// Shared by all buffers, under output_lock
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static OutputMode output_mode = MODE_UNKNOWN;
+static uint64_t output_position;   // bytes written by all buffers
+
+// Makes room for len more bytes of own storage
+static void reserve(OutBuf *out, size_t len) {
+    int h = out->cur;
+
+    if (out->len + len <= *(out->half_cap + h)) {
+        return;
+    }
+    size_t cap = *(out->half_cap + h) ? *(out->half_cap + h) * 2 : OUT_HALF_SZ;
+    while (cap < out->len + len) {
+        cap *= 2;
+    }
+    // The current half is never in the pipe, so its memory can move
+    char *grown = realloc(*(out->half + h), cap);
+    if (grown == NULL) {
+        exit(4);
+    }
+    *(out->half + h) = grown;
+    *(out->half_cap + h) = cap;
+}
+
+static OutSlice *new_slice(OutBuf *out) {
+    if (out->nslices == out->slice_cap) {
+        size_t cap = out->slice_cap ? out->slice_cap * 2 : 256;
+        OutSlice *grown = realloc(out->slices, cap * sizeof(OutSlice));
+        if (grown == NULL) {
+            exit(4);
+        }
+        out->slices = grown;
+        out->slice_cap = cap;
+    }
+    return out->slices + out->nslices++;
+}
+
+void out_write(OutBuf *out, const char *data, size_t len) {
+    OutSlice *last = out->nslices > 0 ? out->slices + out->nslices - 1 : NULL;
+
+    reserve(out, len);
+    memcpy(*(out->half + out->cur) + out->len, data, len);
+
+    // Consecutive own bytes form one slice
+    if (last != NULL && last->ext == NULL && last->off + last->len == out->len) {
+        last->len += len;
+    } else {
+        OutSlice *slice = new_slice(out);
+        slice->ext = NULL;
+        slice->off = out->len;
+        slice->len = len;
+        slice->stable = 1;
+    }
+    out->len += len;
+    out->pending += len;
+}
+
+void out_write_ref(OutBuf *out, const char *data, size_t len, int stable) {
+    if (len < OUT_COPY_MAX) {
+        out_write(out, data, len);
+        return;
+    }
+
+    OutSlice *slice = new_slice(out);
+    slice->ext = data;
+    slice->off = 0;
+    slice->len = len;
+    slice->stable = stable;
+    out->transient |= !stable;
+    out->pending += len;
+}
+
+void out_number(OutBuf *out, long n) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long v = (unsigned long)n;
+
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    out_write(out, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+/**
+ * write_all - writes iovecs completely
+ * @splice: if 1, use vmsplice(); falls back to writev() if that fails
+ *
+ * Returns: 0, or -1 on a write error
+ */
+static int write_all(struct iovec *iov, int n, int *splice) {
+    while (n > 0) {
+        ssize_t written = *splice ? vmsplice(STDOUT_FILENO, iov, (unsigned long)n, 0)
+                                  : writev(STDOUT_FILENO, iov, n);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (*splice && errno != EPIPE) {
+                *splice = 0;
+                output_mode = MODE_WRITE;
+                continue;
+            }
+            return -1;
+        }
+        output_position += (uint64_t)written;
+
+        // Skip what was written, which may end inside an iovec
+        while (n > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+    return 0;
+}
+
+// Whether the pipe has been read past position end
+static int drained(uint64_t end) {
+    int unread;
+
+    return ioctl(STDOUT_FILENO, FIONREAD, &unread) != 0 || (uint64_t)unread <= output_position - end;
+}
+
+// Waits until the pipe has been read past position end
+static void wait_drained(uint64_t end) {
+    struct pollfd pfd = {STDOUT_FILENO, POLLOUT, 0};
+
+    while (!drained(end)) {
+        // A closed reader never drains; the next write fails instead
+        if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLERR | POLLHUP))) {
+            return;
+        }
+        struct timespec pause = {0, DRAIN_WAIT_NS};
+        nanosleep(&pause, NULL);
+    }
+}
+
+void out_flush(OutBuf *out) {
+    struct iovec iov[OUT_IOV_MAX];
+    int splice;
+
+    if (out->nslices == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&output_lock);
+    fflush(stdout);     // anything printed with stdio goes first
+    if (output_mode == MODE_UNKNOWN) {
+        struct stat st;
+        output_mode = fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode) ? MODE_SPLICE : MODE_WRITE;
+    }
+    splice = output_mode == MODE_SPLICE && !out->transient;
+
+    for (size_t i = 0; i < out->nslices;) {
+        int n = 0;
+        for (; i < out->nslices && n < OUT_IOV_MAX; i++, n++) {
+            const OutSlice *slice = out->slices + i;
+            iov[n].iov_base = (void *)(slice->ext ? slice->ext : *(out->half + out->cur) + slice->off);
+            iov[n].iov_len = slice->len;
+        }
+        if (write_all(iov, n, &splice) != 0) {
+            break;
+        }
+    }
+
+    // The pipe may still refer to this half: fill the other one, once
+    // the pipe no longer refers to it
+    if (splice) {
+        *(out->half_end + out->cur) = output_position;
+        out->cur ^= 1;
+        if (*(out->half_end + out->cur) != 0) {
+            wait_drained(*(out->half_end + out->cur));
+        }
+    }
+    pthread_mutex_unlock(&output_lock);
+
+    out->nslices = 0;
+    out->len = 0;
+    out->pending = 0;
+    out->transient = 0;
+}
+
+void out_release(OutBuf *out) {
+    if (!out->transient) {
+        return;
+    }
+    if (!out->held) {
+        out_flush(out);
+        return;
+    }
+
+    // Copy the referenced slices into own storage, keeping their order
+    for (size_t i = 0; i < out->nslices; i++) {
+        OutSlice *slice = out->slices + i;
+        if (slice->ext != NULL && !slice->stable) {
+            reserve(out, slice->len);
+            memcpy(*(out->half + out->cur) + out->len, slice->ext, slice->len);
+            slice->ext = NULL;
+            slice->off = out->len;
+            slice->stable = 1;
+            out->len += slice->len;
+        }
+    }
+    out->transient = 0;
+}
+
+void out_end_line(OutBuf *out) {
+    if (!out->held && out->pending >= OUT_FLUSH_SZ) {
+        out_flush(out);
+    }
+}
+
+void out_free(OutBuf *out) {
+    // A half the pipe still refers to is left allocated rather than
+    // waiting for the reader; the process is about to exit
+    pthread_mutex_lock(&output_lock);
+    for (int h = 0; h < 2; h++) {
+        if (*(out->half_end + h) == 0 || drained(*(out->half_end + h))) {
+            free(*(out->half + h));
+        }
+    }
+    pthread_mutex_unlock(&output_lock);
+    free(out->slices);
+    memset(out, 0, sizeof(*out));
+}
@@ -0,0 +1,100 @@
+#ifndef __MGOUT_H__
+#define __MGOUT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * OutSlice - a run of queued output: bytes in the buffer's own storage,
+ * or a slice of the caller's memory that is written without a copy
+ */
+typedef struct {
+    const char *ext;            // caller's memory, or NULL for own bytes
+    size_t off;                 // offset of own bytes in the current half
+    size_t len;
+    int stable;                 // ext stays valid after the flush (mapped file)
+} OutSlice;
+
+/**
+ * OutBuf - output collected by one searching thread
+ *
+ * Line prefixes and short lines are copied into the buffer's own storage;
+ * long lines are queued as references to the searched text. A flush
+ * writes everything with writev() to standard output, under a lock shared
+ * by all buffers, so lines from different threads never interleave.
+ *
+ * When standard output is a pipe and no queued slice refers to memory the
+ * caller will reuse, the flush uses vmsplice() instead, so the pipe refers
+ * to the pages rather than copying them. Own storage then alternates
+ * between two halves: a half is only written again once the pipe has been
+ * read past it.
+ *
+ * A zeroed OutBuf is ready for use.
+ */
+typedef struct {
+    char *half[2];              // own storage
+    size_t half_cap[2];
+    int cur;                    // half being filled
+    size_t len;                 // bytes used in it
+    uint64_t half_end[2];       // output position after each half's last vmsplice()
+    OutSlice *slices;
+    size_t nslices;
+    size_t slice_cap;
+    size_t pending;             // bytes queued
+    int transient;              // a slice refers to memory the caller will reuse
+    int held;                   // only written out by an explicit out_flush()
+} OutBuf;
+
+// A buffer that is not held is flushed once this much is queued
+#define OUT_FLUSH_SZ (64 * 1024)
+
+// Slices shorter than this are copied rather than referenced
+#define OUT_COPY_MAX 256
+
+/**
+ * out_write - appends a copy of bytes
+ *
+ * Exits with code 4 if memory cannot be allocated.
+ */
+void out_write(OutBuf *out, const char *data, size_t len);
+
+/**
+ * out_write_ref - appends bytes by reference
+ * @stable: 1 if data stays valid after the flush (a mapped file), 0 if
+ *          the caller reuses it after out_release()
+ *
+ * data must stay valid until the next flush. Short slices are copied.
+ */
+void out_write_ref(OutBuf *out, const char *data, size_t len, int stable);
+
+/**
+ * out_number - appends a non-negative number in decimal
+ */
+void out_number(OutBuf *out, long n);
+
+/**
+ * out_flush - writes out everything queued
+ */
+void out_flush(OutBuf *out);
+
+/**
+ * out_release - called before memory passed to out_write_ref() with
+ * stable 0 is reused: copies or flushes what refers to it
+ */
+void out_release(OutBuf *out);
+
+/**
+ * out_end_line - called after each complete line; flushes once
+ * OUT_FLUSH_SZ is queued, unless the buffer is held
+ */
+void out_end_line(OutBuf *out);
+
+/**
+ * out_free - releases the buffer's memory; nothing queued is written
+ *
+ * Storage the pipe still refers to is not freed, so it must not be reused:
+ * call it once output is done.
+ */
+void out_free(OutBuf *out);
+
+#endif
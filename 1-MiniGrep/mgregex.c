@@ -0,0 +1,1267 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "mgregex.h"
+
+//===================================================================
+// LIMITS
+//===================================================================
+
+#define RX_MAX_INSTS        100000      // NFA size, after {m,n} expansion
+#define RX_MAX_REPEAT       1000        // largest m or n in {m,n}
+#define RX_MAX_DEPTH        1000        // nesting of parentheses
+#define RX_MAX_LITERAL      64          // longest prefilter literal kept
+#define RX_MIN_LITERAL      2           // shorter literals do not pay off
+
+// Memory for one thread's DFA states and transitions
+#define RX_CACHE_BYTES      (2 * 1024 * 1024)
+
+// A cache flush is wasted if fewer bytes than this per cached state were
+// scanned since the previous one; after RX_MAX_WASTED_FLUSHES of them the
+// search stops building DFA states and simulates the NFA instead
+#define RX_MIN_BYTES_PER_STATE  10
+#define RX_MAX_WASTED_FLUSHES   3
+
+//===================================================================
+// NFA PROGRAM
+//===================================================================
+
+enum {
+    RX_CLASS,       // consume a byte in sets[x], continue at pc + 1
+    RX_SPLIT,       // continue at both x and y
+    RX_JMP,         // continue at x
+    RX_BOL,         // continue at pc + 1 at the start of a line
+    RX_EOL,         // continue at pc + 1 at the end of a line
+    RX_MATCH
+};
+
+struct RxInst {
+    uint8_t op;
+    uint32_t x;
+    uint32_t y;
+};
+
+static int set_has(const uint64_t *set, unsigned b) {
+    return (int)((*(set + (b >> 6)) >> (b & 63)) & 1);
+}
+
+static void set_add(uint64_t *set, unsigned b) {
+    *(set + (b >> 6)) |= (uint64_t)1 << (b & 63);
+}
+
+//===================================================================
+// PARSER
+//===================================================================
+
+enum { N_EMPTY, N_SET, N_CAT, N_ALT, N_REPEAT, N_BOL, N_EOL };
+
+typedef struct {
+    uint8_t type;
+    int a;              // N_CAT, N_ALT: left; N_REPEAT: repeated node
+    int b;              // N_CAT, N_ALT: right
+    int min;            // N_REPEAT bounds, max -1 for no limit
+    int max;
+    uint32_t set;       // N_SET: index into sets
+} Node;
+
+typedef struct {
+    const char *p;
+    int case_insensitive;
+    int depth;
+    const char *error;  // syntax error, if any
+    int nomem;
+    Node *nodes;
+    size_t nnodes;
+    size_t node_cap;
+    Regex *re;          // receives the byte sets
+    uint32_t set_cap;
+} Parser;
+
+static int new_node(Parser *ps, int type) {
+    if (ps->nnodes == ps->node_cap) {
+        size_t cap = ps->node_cap ? ps->node_cap * 2 : 64;
+        Node *grown = realloc(ps->nodes, cap * sizeof(Node));
+        if (grown == NULL) {
+            ps->nomem = 1;
+            return -1;
+        }
+        ps->nodes = grown;
+        ps->node_cap = cap;
+    }
+    Node *n = ps->nodes + ps->nnodes;
+    n->type = (uint8_t)type;
+    n->a = n->b = -1;
+    n->min = n->max = 0;
+    n->set = 0;
+    return (int)ps->nnodes++;
+}
+
+static int new_pair(Parser *ps, int type, int a, int b) {
+    int n = new_node(ps, type);
+    if (n >= 0) {
+        (ps->nodes + n)->a = a;
+        (ps->nodes + n)->b = b;
+    }
+    return n;
+}
+
+// A new, empty byte set node; *set receives the set to fill in
+static int new_set_node(Parser *ps, uint64_t **set) {
+    Regex *re = ps->re;
+
+    if (re->nsets == ps->set_cap) {
+        uint32_t cap = ps->set_cap ? ps->set_cap * 2 : 16;
+        uint64_t (*grown)[4] = realloc(re->sets, cap * sizeof(*grown));
+        if (grown == NULL) {
+            ps->nomem = 1;
+            return -1;
+        }
+        re->sets = grown;
+        ps->set_cap = cap;
+    }
+    int n = new_node(ps, N_SET);
+    if (n < 0) {
+        return -1;
+    }
+    (ps->nodes + n)->set = re->nsets;
+    *set = *(re->sets + re->nsets++);
+    memset(*set, 0, 4 * sizeof(uint64_t));
+    return n;
+}
+
+// Adds b to set, and its other case under -i
+static void add_byte(Parser *ps, uint64_t *set, unsigned char b) {
+    set_add(set, b);
+    if (ps->case_insensitive && isalpha(b)) {
+        set_add(set, (unsigned char)tolower(b));
+        set_add(set, (unsigned char)toupper(b));
+    }
+}
+
+/**
+ * add_named_class - adds the bytes of a class such as "alpha" or 'd'
+ *
+ * Returns: 0, or -1 for an unknown name
+ */
+static int add_named_class(uint64_t *set, const char *name, size_t len) {
+    static const struct {
+        const char *name;
+        int (*test)(int);
+    } classes[] = {
+        {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+        {"lower", islower}, {"space", isspace}, {"blank", isblank}, {"punct", ispunct},
+        {"print", isprint}, {"graph", isgraph}, {"cntrl", iscntrl}, {"xdigit", isxdigit},
+    };
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        const char *cname = classes[i].name;
+        if (strlen(cname) == len && memcmp(cname, name, len) == 0) {
+            for (int b = 0; b < 256; b++) {
+                if (classes[i].test(b)) {
+                    set_add(set, (unsigned)b);
+                }
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// "\d \w \s" and their negations; returns 0 if c is not one of them
+static int add_escape_class(uint64_t *set, char c) {
+    int negate = isupper((unsigned char)c);
+
+    switch (tolower((unsigned char)c)) {
+        case 'd':
+            add_named_class(set, "digit", 5);
+            break;
+        case 's':
+            add_named_class(set, "space", 5);
+            break;
+        case 'w':
+            add_named_class(set, "alnum", 5);
+            set_add(set, '_');
+            break;
+        default:
+            return 0;
+    }
+    if (negate) {
+        for (int i = 0; i < 4; i++) {
+            *(set + i) = ~*(set + i);
+        }
+    }
+    return 1;
+}
+
+static int parse_alt(Parser *ps);
+
+// After "[": a bracket expression up to and including "]"
+static int parse_bracket(Parser *ps) {
+    uint64_t *set;
+    int n = new_set_node(ps, &set);
+    int negate = 0;
+
+    if (n < 0) {
+        return -1;
+    }
+    if (*ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+
+    // A "]" right after "[" or "[^" is a literal
+    int first = 1;
+    while (*ps->p != ']' || first) {
+        unsigned char lo = (unsigned char)*ps->p;
+        first = 0;
+
+        if (lo == '\0') {
+            ps->error = "unmatched [";
+            return -1;
+        }
+        if (lo == '[' && *(ps->p + 1) == ':') {
+            const char *name = ps->p + 2;
+            const char *close = strstr(name, ":]");
+            if (close == NULL || add_named_class(set, name, (size_t)(close - name)) != 0) {
+                ps->error = "invalid character class name";
+                return -1;
+            }
+            ps->p = close + 2;
+            continue;
+        }
+
+        ps->p++;
+        if (*ps->p == '-' && *(ps->p + 1) != ']' && *(ps->p + 1) != '\0') {
+            unsigned char hi = (unsigned char)*(ps->p + 1);
+            if (hi < lo) {
+                ps->error = "invalid range in bracket expression";
+                return -1;
+            }
+            for (unsigned b = lo; b <= hi; b++) {
+                add_byte(ps, set, (unsigned char)b);
+            }
+            ps->p += 2;
+        } else {
+            add_byte(ps, set, lo);
+        }
+    }
+    ps->p++;
+
+    if (negate) {
+        for (int i = 0; i < 4; i++) {
+            *(set + i) = ~*(set + i);
+        }
+    }
+    // Nothing matches a newline
+    *set &= ~((uint64_t)1 << '\n');
+    return n;
+}
+
+static int parse_atom(Parser *ps) {
+    char c = *ps->p;
+    uint64_t *set;
+    int n;
+
+    switch (c) {
+        case '(':
+            if (++ps->depth > RX_MAX_DEPTH) {
+                ps->error = "parentheses nested too deeply";
+                return -1;
+            }
+            ps->p++;
+            n = parse_alt(ps);
+            if (n < 0) {
+                return -1;
+            }
+            if (*ps->p != ')') {
+                ps->error = "unmatched (";
+                return -1;
+            }
+            ps->p++;
+            ps->depth--;
+            return n;
+        case '[':
+            ps->p++;
+            return parse_bracket(ps);
+        case '.':
+            ps->p++;
+            n = new_set_node(ps, &set);
+            if (n >= 0) {
+                memset(set, 0xff, 4 * sizeof(uint64_t));
+                *set &= ~((uint64_t)1 << '\n');
+            }
+            return n;
+        case '^':
+            ps->p++;
+            return new_node(ps, N_BOL);
+        case '$':
+            ps->p++;
+            return new_node(ps, N_EOL);
+        case '\\':
+            ps->p++;
+            c = *ps->p;
+            if (c == '\0') {
+                ps->error = "trailing backslash";
+                return -1;
+            }
+            ps->p++;
+            n = new_set_node(ps, &set);
+            if (n >= 0 && !add_escape_class(set, c)) {
+                add_byte(ps, set, c == 't' ? '\t' : (unsigned char)c);
+            }
+            if (n >= 0) {
+                *set &= ~((uint64_t)1 << '\n');
+            }
+            return n;
+        default:
+            ps->p++;
+            n = new_set_node(ps, &set);
+            if (n >= 0) {
+                add_byte(ps, set, (unsigned char)c);
+            }
+            return n;
+    }
+}
+
+// Reads "{m}", "{m,}" or "{m,n}" at ps->p; returns 0 if it is not one
+static int parse_bounds(Parser *ps, int *min, int *max) {
+    const char *p = ps->p + 1;
+    long lo = 0;
+    long hi;
+
+    if (!isdigit((unsigned char)*p)) {
+        return 0;
+    }
+    while (isdigit((unsigned char)*p) && lo <= RX_MAX_REPEAT) {
+        lo = lo * 10 + (*p++ - '0');
+    }
+    hi = lo;
+    if (*p == ',') {
+        p++;
+        hi = -1;
+        if (isdigit((unsigned char)*p)) {
+            hi = 0;
+            while (isdigit((unsigned char)*p) && hi <= RX_MAX_REPEAT) {
+                hi = hi * 10 + (*p++ - '0');
+            }
+        }
+    }
+    if (*p != '}') {
+        return 0;
+    }
+    if (lo > RX_MAX_REPEAT || hi > RX_MAX_REPEAT || (hi >= 0 && hi < lo)) {
+        ps->error = "invalid repetition count";
+        return -1;
+    }
+    ps->p = p + 1;
+    *min = (int)lo;
+    *max = (int)hi;
+    return 1;
+}
+
+static int parse_repeat(Parser *ps) {
+    int n;
+
+    // As in grep -E, a repetition with nothing to repeat is a literal
+    if (*ps->p == '*' || *ps->p == '+' || *ps->p == '?') {
+        uint64_t *set;
+        n = new_set_node(ps, &set);
+        if (n >= 0) {
+            set_add(set, (unsigned char)*ps->p++);
+        }
+    } else {
+        n = parse_atom(ps);
+    }
+
+    while (n >= 0) {
+        int min;
+        int max;
+        int bounds;
+
+        if (*ps->p == '*') {
+            min = 0;
+            max = -1;
+        } else if (*ps->p == '+') {
+            min = 1;
+            max = -1;
+        } else if (*ps->p == '?') {
+            min = 0;
+            max = 1;
+        } else if (*ps->p == '{' && (bounds = parse_bounds(ps, &min, &max)) != 0) {
+            if (bounds < 0) {
+                return -1;
+            }
+            ps->p--;    // parse_bounds() already consumed the "}"
+        } else {
+            break;
+        }
+        ps->p++;
+
+        int r = new_node(ps, N_REPEAT);
+        if (r < 0) {
+            return -1;
+        }
+        (ps->nodes + r)->a = n;
+        (ps->nodes + r)->min = min;
+        (ps->nodes + r)->max = max;
+        n = r;
+    }
+    return n;
+}
+
+/**
+ * append_chain - appends item to a chain of N_CAT or N_ALT nodes
+ * @root: first node of the chain, -1 while it is empty
+ * @tail: last link of the chain, -1 while there is none
+ *
+ * Chains nest to the right, so that walking them is a loop over the
+ * right-hand side rather than recursion as deep as the pattern is long.
+ *
+ * Returns: 0, or -1 if memory could not be allocated
+ */
+static int append_chain(Parser *ps, int type, int *root, int *tail, int item) {
+    int link;
+
+    if (*root < 0) {
+        *root = item;
+        return 0;
+    }
+    if (*tail < 0) {
+        link = new_pair(ps, type, *root, item);
+        *root = link;
+    } else {
+        link = new_pair(ps, type, (ps->nodes + *tail)->b, item);
+        if (link >= 0) {
+            (ps->nodes + *tail)->b = link;
+        }
+    }
+    *tail = link;
+    return link < 0 ? -1 : 0;
+}
+
+static int parse_concat(Parser *ps) {
+    int root = -1;
+    int tail = -1;
+
+    while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+        int next = parse_repeat(ps);
+        if (next < 0 || append_chain(ps, N_CAT, &root, &tail, next) < 0) {
+            return -1;
+        }
+    }
+    return root < 0 ? new_node(ps, N_EMPTY) : root;
+}
+
+static int parse_alt(Parser *ps) {
+    int root = parse_concat(ps);
+    int tail = -1;
+
+    while (root >= 0 && *ps->p == '|') {
+        ps->p++;
+        int next = parse_concat(ps);
+        if (next < 0 || append_chain(ps, N_ALT, &root, &tail, next) < 0) {
+            return -1;
+        }
+    }
+    return root;
+}
+
+//===================================================================
+// REQUIRED LITERAL
+//===================================================================
+
+/**
+ * literal_byte - the byte a set node stands for, if it is a single one
+ *
+ * Under -i, the two cases of one letter count as that (lowercase) letter.
+ *
+ * Returns: the byte, or -1
+ */
+static int literal_byte(const Parser *ps, const Node *n) {
+    const uint64_t *set = *(ps->re->sets + n->set);
+    int count = 0;
+    int first = -1;
+
+    for (int b = 0; b < 256 && count <= 2; b++) {
+        if (set_has(set, (unsigned)b)) {
+            first = count == 0 ? b : first;
+            count++;
+        }
+    }
+    if (count == 1) {
+        return first;
+    }
+    if (count == 2 && ps->case_insensitive && isupper(first) &&
+        set_has(set, (unsigned)tolower(first))) {
+        return tolower(first);
+    }
+    return -1;
+}
+
+typedef struct {
+    char run[RX_MAX_LITERAL + 1];
+    size_t run_len;
+    char best[RX_MAX_LITERAL + 1];
+    size_t best_len;
+} LiteralScan;
+
+static void end_run(LiteralScan *ls) {
+    if (ls->run_len > ls->best_len) {
+        memcpy(ls->best, ls->run, ls->run_len);
+        ls->best_len = ls->run_len;
+    }
+    ls->run_len = 0;
+}
+
+// Walks a concatenation in order, collecting runs of literal bytes; any
+// other node ends a run, but may contain a required literal of its own
+static void scan_literals(const Parser *ps, int node, LiteralScan *ls) {
+    const Node *n = ps->nodes + node;
+    int b;
+
+    switch (n->type) {
+        case N_CAT:
+            while (n->type == N_CAT) {
+                scan_literals(ps, n->a, ls);
+                n = ps->nodes + n->b;
+            }
+            scan_literals(ps, (int)(n - ps->nodes), ls);
+            return;
+        case N_EMPTY:
+        case N_BOL:
+        case N_EOL:
+            return;
+        case N_SET:
+            b = literal_byte(ps, n);
+            if (b >= 0) {
+                if (ls->run_len < RX_MAX_LITERAL) {
+                    *(ls->run + ls->run_len++) = (char)b;
+                }
+                return;
+            }
+            break;
+        case N_REPEAT:
+            if (n->min >= 1) {
+                LiteralScan inner;
+                inner.run_len = inner.best_len = 0;
+                scan_literals(ps, n->a, &inner);
+                end_run(&inner);
+                end_run(ls);
+                if (inner.best_len > ls->best_len) {
+                    memcpy(ls->best, inner.best, inner.best_len);
+                    ls->best_len = inner.best_len;
+                }
+                return;
+            }
+            break;
+    }
+    end_run(ls);
+}
+
+//===================================================================
+// COMPILER
+//===================================================================
+
+static int emit_inst(Regex *re, uint32_t *cap, int op, uint32_t x, uint32_t y) {
+    if (re->ninst >= RX_MAX_INSTS) {
+        return -1;
+    }
+    if (re->ninst == *cap) {
+        uint32_t grown_cap = *cap ? *cap * 2 : 64;
+        struct RxInst *grown = realloc(re->prog, grown_cap * sizeof(struct RxInst));
+        if (grown == NULL) {
+            return -2;
+        }
+        re->prog = grown;
+        *cap = grown_cap;
+    }
+    struct RxInst *inst = re->prog + re->ninst;
+    inst->op = (uint8_t)op;
+    inst->x = x;
+    inst->y = y;
+    return (int)re->ninst++;
+}
+
+/**
+ * emit - appends the instructions for a node
+ *
+ * Returns: 0, -1 if the program is too large, -2 if out of memory
+ */
+static int emit(const Parser *ps, Regex *re, uint32_t *cap, int node) {
+    const Node *n = ps->nodes + node;
+    int rc = 0;
+    int at;
+
+    switch (n->type) {
+        case N_EMPTY:
+            return 0;
+        case N_SET:
+            at = emit_inst(re, cap, RX_CLASS, n->set, 0);
+            return at < 0 ? at : 0;
+        case N_BOL:
+        case N_EOL:
+            at = emit_inst(re, cap, n->type == N_BOL ? RX_BOL : RX_EOL, 0, 0);
+            return at < 0 ? at : 0;
+        case N_CAT:
+            while (n->type == N_CAT) {
+                if ((rc = emit(ps, re, cap, n->a)) < 0) {
+                    return rc;
+                }
+                n = ps->nodes + n->b;
+            }
+            return emit(ps, re, cap, (int)(n - ps->nodes));
+        case N_ALT: {
+            // split L+1, next; <a>; jmp out; next: ... <last>
+            // The jmps are chained through x until out is known
+            uint32_t jmps = UINT32_MAX;
+            while (n->type == N_ALT) {
+                int split = emit_inst(re, cap, RX_SPLIT, 0, 0);
+                if (split < 0 || (rc = emit(ps, re, cap, n->a)) < 0) {
+                    return split < 0 ? split : rc;
+                }
+                int jmp = emit_inst(re, cap, RX_JMP, jmps, 0);
+                if (jmp < 0) {
+                    return jmp;
+                }
+                jmps = (uint32_t)jmp;
+                (re->prog + split)->x = (uint32_t)split + 1;
+                (re->prog + split)->y = re->ninst;
+                n = ps->nodes + n->b;
+            }
+            if ((rc = emit(ps, re, cap, (int)(n - ps->nodes))) < 0) {
+                return rc;
+            }
+            while (jmps != UINT32_MAX) {
+                uint32_t prev = (re->prog + jmps)->x;
+                (re->prog + jmps)->x = re->ninst;
+                jmps = prev;
+            }
+            return 0;
+        }
+        case N_REPEAT:
+            for (int i = 0; i < n->min; i++) {
+                if ((rc = emit(ps, re, cap, n->a)) < 0) {
+                    return rc;
+                }
+            }
+            if (n->max < 0) {
+                // L: split L+1, out; <a>; jmp L
+                int split = emit_inst(re, cap, RX_SPLIT, 0, 0);
+                if (split < 0 || (rc = emit(ps, re, cap, n->a)) < 0) {
+                    return split < 0 ? split : rc;
+                }
+                if ((at = emit_inst(re, cap, RX_JMP, (uint32_t)split, 0)) < 0) {
+                    return at;
+                }
+                (re->prog + split)->x = (uint32_t)split + 1;
+                (re->prog + split)->y = re->ninst;
+                return 0;
+            }
+            for (int i = n->min; i < n->max; i++) {
+                // split L+1, out; <a>
+                int split = emit_inst(re, cap, RX_SPLIT, 0, 0);
+                if (split < 0 || (rc = emit(ps, re, cap, n->a)) < 0) {
+                    return split < 0 ? split : rc;
+                }
+                (re->prog + split)->x = (uint32_t)split + 1;
+                (re->prog + split)->y = re->ninst;
+            }
+            return 0;
+    }
+    return 0;
+}
+
+// Splits bytes into classes that no byte set tells apart; the newline,
+// which ends lines, is always a class of its own
+static void assign_classes(Regex *re) {
+    unsigned char boundary[256];
+    uint32_t cls = 0;
+
+    memset(boundary, 0, sizeof(boundary));
+    *(boundary + '\n') = *(boundary + '\n' + 1) = 1;
+    for (uint32_t s = 0; s < re->nsets; s++) {
+        const uint64_t *set = *(re->sets + s);
+        for (unsigned b = 1; b < 256; b++) {
+            if (set_has(set, b) != set_has(set, b - 1)) {
+                *(boundary + b) = 1;
+            }
+        }
+    }
+
+    for (unsigned b = 0; b < 256; b++) {
+        if (b > 0 && *(boundary + b)) {
+            cls++;
+            *(re->class_byte + cls) = (uint8_t)b;
+        }
+        *(re->class_of + b) = (uint16_t)cls;
+    }
+    *re->class_byte = 0;
+    re->nclasses = cls + 1;
+}
+
+int regex_compile(Regex *re, char **patterns, size_t npatterns, int case_insensitive,
+                  const char **error) {
+    Parser ps;
+    uint32_t cap = 0;
+    int root = -1;
+    int tail = -1;
+    int rc;
+
+    memset(re, 0, sizeof(*re));
+    memset(&ps, 0, sizeof(ps));
+    ps.case_insensitive = case_insensitive;
+    ps.re = re;
+    *error = NULL;
+
+    // Patterns are alternatives of one expression
+    for (size_t i = 0; i < npatterns; i++) {
+        ps.p = *(patterns + i);
+        ps.depth = 0;
+        int n = parse_alt(&ps);
+        if (n >= 0 && *ps.p == ')') {
+            ps.error = "unmatched )";
+        }
+        if (n < 0 || ps.error != NULL || append_chain(&ps, N_ALT, &root, &tail, n) < 0) {
+            break;
+        }
+    }
+    if (npatterns == 0 && !ps.nomem) {
+        uint64_t *set;
+        root = new_set_node(&ps, &set);     // matches nothing
+    }
+    if (ps.nomem || ps.error != NULL) {
+        *error = ps.error;
+        free(ps.nodes);
+        regex_free(re);
+        return ps.nomem ? -1 : 1;
+    }
+
+    rc = emit(&ps, re, &cap, root);
+    if (rc == 0) {
+        rc = emit_inst(re, &cap, RX_MATCH, 0, 0) < 0 ? -1 : 0;
+    }
+    if (rc == 0 && npatterns == 1) {
+        LiteralScan ls;
+        ls.run_len = ls.best_len = 0;
+        scan_literals(&ps, root, &ls);
+        end_run(&ls);
+        *(ls.best + ls.best_len) = '\0';
+        if (ls.best_len >= RX_MIN_LITERAL) {
+            if (matcher_init(&re->literal, ls.best, case_insensitive) != 0) {
+                rc = -2;
+            } else {
+                re->has_literal = 1;
+            }
+        }
+    }
+    free(ps.nodes);
+
+    if (rc != 0) {
+        regex_free(re);
+        if (rc == -1) {
+            *error = "regular expression too large";
+            return 1;
+        }
+        return -1;
+    }
+
+    re->start = 0;
+    assign_classes(re);
+    return 0;
+}
+
+void regex_free(Regex *re) {
+    free(re->prog);
+    free(re->sets);
+    if (re->has_literal) {
+        matcher_free(&re->literal);
+    }
+    re->prog = NULL;
+    re->sets = NULL;
+    re->has_literal = 0;
+}
+
+//===================================================================
+// NFA STATE SETS
+//===================================================================
+
+#define STATE_ACCEPT        0x1     // a pattern has matched
+#define STATE_ACCEPT_EOL    0x2     // a pattern matches if the line ends here
+#define STATE_BOL           0x4     // nothing of the line consumed yet
+
+// A transition holds the row offset of its target in RegexCache.trans;
+// the scan loop only leaves its fast path for tagged ones
+#define DFA_ACCEPT          0x80000000u     // the target has matched
+#define DFA_NEWLINE         0xfffffffeu     // a newline: the line ends
+#define DFA_UNKNOWN         0xffffffffu     // not computed yet
+
+typedef struct {
+    uint32_t off;       // pcs of the state in RegexCache.pcs
+    uint32_t n;
+    uint32_t hash;
+    uint8_t flags;
+} DfaState;
+
+struct RegexCache {
+    const Regex *re;
+
+    // Lazily built DFA: states, their NFA pc sets, a hash index over
+    // them, and a row of transitions per state
+    DfaState *states;
+    uint32_t nstates;
+    uint32_t max_states;
+    uint32_t *pcs;
+    size_t npcs;
+    size_t pcs_cap;
+    uint32_t *index;
+    uint32_t index_mask;
+    uint32_t *trans;
+    int32_t start_state;        // -1 until built
+
+    // Scratch space for computing pc sets
+    uint32_t *stack;
+    uint32_t *mark;
+    uint32_t gen;
+    uint32_t *set;
+    uint32_t *next_set;
+    uint32_t *eol_set;
+
+    // Cache effectiveness
+    size_t scanned;             // bytes scanned by DFA searches so far
+    size_t scanned_at_flush;
+    int wasted_flushes;
+    int use_nfa;
+};
+
+static void new_generation(RegexCache *c) {
+    if (++c->gen == 0) {
+        memset(c->mark, 0, c->re->ninst * sizeof(uint32_t));
+        c->gen = 1;
+    }
+}
+
+/**
+ * add_closure - adds pc and what it reaches without consuming a byte
+ * @c: cache with the scratch stack and marks
+ * @set: set to add to; byte-consuming, match and pending end-of-line
+ *       instructions are recorded
+ * @n: size of set, updated
+ * @bol: 1 at the start of a line
+ * @eol: 1 at the end of a line
+ *
+ * Instructions already marked in the current generation are skipped.
+ */
+static void add_closure(RegexCache *c, uint32_t *set, uint32_t *n, uint32_t pc, int bol, int eol) {
+    const struct RxInst *prog = c->re->prog;
+    uint32_t top = 0;
+
+    *(c->stack + top++) = pc;
+    while (top > 0) {
+        pc = *(c->stack + --top);
+        if (*(c->mark + pc) == c->gen) {
+            continue;
+        }
+        *(c->mark + pc) = c->gen;
+
+        const struct RxInst *inst = prog + pc;
+        switch (inst->op) {
+            case RX_CLASS:
+            case RX_MATCH:
+                *(set + (*n)++) = pc;
+                break;
+            case RX_SPLIT:
+                *(c->stack + top++) = inst->y;
+                *(c->stack + top++) = inst->x;
+                break;
+            case RX_JMP:
+                *(c->stack + top++) = inst->x;
+                break;
+            case RX_BOL:
+                if (bol) {
+                    *(c->stack + top++) = pc + 1;
+                }
+                break;
+            case RX_EOL:
+                if (eol) {
+                    *(c->stack + top++) = pc + 1;
+                } else {
+                    *(set + (*n)++) = pc;
+                }
+                break;
+        }
+    }
+}
+
+// The set at the start of a line
+static uint32_t start_set(RegexCache *c, uint32_t *set) {
+    uint32_t n = 0;
+
+    new_generation(c);
+    add_closure(c, set, &n, c->re->start, 1, 0);
+    return n;
+}
+
+// The set after consuming byte b (not a newline) from set; a match may
+// also begin at the next position
+static uint32_t step_set(RegexCache *c, const uint32_t *set, uint32_t n, unsigned char b, uint32_t *out) {
+    const Regex *re = c->re;
+    uint32_t nout = 0;
+
+    new_generation(c);
+    for (uint32_t i = 0; i < n; i++) {
+        const struct RxInst *inst = re->prog + *(set + i);
+        if (inst->op == RX_CLASS && set_has(*(re->sets + inst->x), b)) {
+            add_closure(c, out, &nout, *(set + i) + 1, 0, 0);
+        }
+    }
+    add_closure(c, out, &nout, re->start, 0, 0);
+    return nout;
+}
+
+static uint8_t set_flags(RegexCache *c, const uint32_t *set, uint32_t n, int bol) {
+    const struct RxInst *prog = c->re->prog;
+    uint8_t flags = bol ? STATE_BOL : 0;
+    uint32_t neol = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        if ((prog + *(set + i))->op == RX_MATCH) {
+            return flags | STATE_ACCEPT | STATE_ACCEPT_EOL;
+        }
+    }
+
+    // Follow the pending end-of-line assertions as if the line ended here
+    new_generation(c);
+    for (uint32_t i = 0; i < n; i++) {
+        if ((prog + *(set + i))->op == RX_EOL) {
+            add_closure(c, c->eol_set, &neol, *(set + i) + 1, bol, 1);
+        }
+    }
+    for (uint32_t i = 0; i < neol; i++) {
+        if ((prog + *(c->eol_set + i))->op == RX_MATCH) {
+            return flags | STATE_ACCEPT_EOL;
+        }
+    }
+    return flags;
+}
+
+static int compare_pcs(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+//===================================================================
+// LAZY DFA
+//===================================================================
+
+RegexCache *regex_cache_new(const Regex *re) {
+    RegexCache *c = calloc(1, sizeof(RegexCache));
+    size_t row_bytes = re->nclasses * sizeof(uint32_t) + sizeof(DfaState) + 2 * sizeof(uint32_t);
+    uint32_t index_size = 1;
+
+    if (c == NULL) {
+        return NULL;
+    }
+    c->re = re;
+    c->max_states = (uint32_t)(RX_CACHE_BYTES / 2 / row_bytes);
+    if (c->max_states < 16) {
+        c->max_states = 16;
+    }
+    while (index_size < 2 * c->max_states) {
+        index_size *= 2;
+    }
+    c->index_mask = index_size - 1;
+    c->pcs_cap = RX_CACHE_BYTES / 2 / sizeof(uint32_t);
+    if (c->pcs_cap < re->ninst) {
+        c->pcs_cap = re->ninst;
+    }
+
+    c->states = malloc(c->max_states * sizeof(DfaState));
+    c->trans = malloc((size_t)c->max_states * re->nclasses * sizeof(uint32_t));
+    c->index = calloc(index_size, sizeof(uint32_t));
+    c->pcs = malloc(c->pcs_cap * sizeof(uint32_t));
+    c->stack = malloc((2 * (size_t)re->ninst + 2) * sizeof(uint32_t));
+    c->mark = calloc(re->ninst, sizeof(uint32_t));
+    c->set = malloc(re->ninst * sizeof(uint32_t));
+    c->next_set = malloc(re->ninst * sizeof(uint32_t));
+    c->eol_set = malloc(re->ninst * sizeof(uint32_t));
+    if (!c->states || !c->trans || !c->index || !c->pcs || !c->stack || !c->mark ||
+        !c->set || !c->next_set || !c->eol_set) {
+        regex_cache_free(c);
+        return NULL;
+    }
+    c->start_state = -1;
+    return c;
+}
+
+void regex_cache_free(RegexCache *c) {
+    if (c == NULL) {
+        return;
+    }
+    free(c->states);
+    free(c->trans);
+    free(c->index);
+    free(c->pcs);
+    free(c->stack);
+    free(c->mark);
+    free(c->set);
+    free(c->next_set);
+    free(c->eol_set);
+    free(c);
+}
+
+// Drops every state; the search goes on from a freshly built one
+static void flush_cache(RegexCache *c) {
+    c->nstates = 0;
+    c->npcs = 0;
+    c->start_state = -1;
+    memset(c->index, 0, ((size_t)c->index_mask + 1) * sizeof(uint32_t));
+}
+
+/**
+ * find_state - looks up or adds the DFA state for a pc set
+ * @c: cache
+ * @set: pc set, sorted in place
+ * @n: size of set
+ * @bol: 1 for the state at the start of a line
+ *
+ * Returns: state index, or -1 if the cache is full
+ */
+static int32_t find_state(RegexCache *c, uint32_t *set, uint32_t n, int bol) {
+    uint32_t hash = 2166136261u ^ (uint32_t)bol;
+    uint32_t slot;
+
+    qsort(set, n, sizeof(uint32_t), compare_pcs);
+    for (uint32_t i = 0; i < n; i++) {
+        hash = (hash ^ *(set + i)) * 16777619u;
+    }
+
+    for (slot = hash & c->index_mask; *(c->index + slot) != 0; slot = (slot + 1) & c->index_mask) {
+        const DfaState *s = c->states + *(c->index + slot) - 1;
+        if (s->hash == hash && s->n == n && ((s->flags & STATE_BOL) != 0) == bol &&
+            memcmp(c->pcs + s->off, set, n * sizeof(uint32_t)) == 0) {
+            return (int32_t)(*(c->index + slot) - 1);
+        }
+    }
+
+    if (c->nstates == c->max_states || c->npcs + n > c->pcs_cap) {
+        return -1;
+    }
+
+    DfaState *s = c->states + c->nstates;
+    s->off = (uint32_t)c->npcs;
+    s->n = n;
+    s->hash = hash;
+    s->flags = set_flags(c, set, n, bol);
+    memcpy(c->pcs + c->npcs, set, n * sizeof(uint32_t));
+    c->npcs += n;
+    uint32_t *row = c->trans + (size_t)c->nstates * c->re->nclasses;
+    memset(row, 0xff, c->re->nclasses * sizeof(uint32_t));
+    *(row + *(c->re->class_of + '\n')) = DFA_NEWLINE;
+    *(c->index + slot) = c->nstates + 1;
+    return (int32_t)c->nstates++;
+}
+
+static int32_t get_start_state(RegexCache *c) {
+    if (c->start_state < 0) {
+        uint32_t n = start_set(c, c->set);
+        c->start_state = find_state(c, c->set, n, 1);
+        if (c->start_state < 0) {
+            flush_cache(c);
+            c->start_state = find_state(c, c->set, n, 1);
+        }
+    }
+    return c->start_state;
+}
+
+// The transition to state t
+static uint32_t encode_state(const RegexCache *c, int32_t t) {
+    uint32_t offset = (uint32_t)t * c->re->nclasses;
+    return (c->states + t)->flags & STATE_ACCEPT ? offset | DFA_ACCEPT : offset;
+}
+
+/**
+ * next_state - computes the transition from a state on byte b
+ * @s: row offset of the state
+ * @flushed: set to 1 if the cache had to be flushed
+ *
+ * Returns: the transition, as stored in trans
+ */
+static uint32_t next_state(RegexCache *c, uint32_t s, unsigned char b, int *flushed) {
+    const DfaState *state = c->states + s / c->re->nclasses;
+    uint32_t n = step_set(c, c->pcs + state->off, state->n, b, c->next_set);
+    int32_t t = find_state(c, c->next_set, n, 0);
+
+    if (t >= 0) {
+        uint32_t next = encode_state(c, t);
+        *(c->trans + s + *(c->re->class_of + b)) = next;
+        return next;
+    }
+
+    // Full: start over with just the target (and the start state)
+    flush_cache(c);
+    *flushed = 1;
+    memcpy(c->set, c->next_set, n * sizeof(uint32_t));
+    t = find_state(c, c->set, n, 0);
+    get_start_state(c);
+    return encode_state(c, t);
+}
+
+//===================================================================
+// SEARCH
+//===================================================================
+
+/**
+ * nfa_scan - scans [p, end) by simulating the NFA one byte at a time
+ *
+ * Used once the DFA cache has proven ineffective. p is a line start.
+ */
+static const char *nfa_scan(RegexCache *c, const char *p, const char *end) {
+    uint32_t *set = c->set;
+    uint32_t *next = c->next_set;
+    uint32_t n = start_set(c, set);
+    int bol = 1;
+    const char *begin = p;
+
+    if (set_flags(c, set, n, 1) & STATE_ACCEPT) {
+        return p < end ? p : NULL;
+    }
+    while (p < end) {
+        unsigned char b = (unsigned char)*p;
+
+        if (b == '\n') {
+            if (set_flags(c, set, n, bol) & STATE_ACCEPT_EOL) {
+                return p;
+            }
+            p++;
+            n = start_set(c, set);
+            bol = 1;
+            if (p < end && (set_flags(c, set, n, 1) & STATE_ACCEPT)) {
+                return p;
+            }
+            continue;
+        }
+
+        n = step_set(c, set, n, b, next);
+        uint32_t *tmp = set;
+        set = next;
+        next = tmp;
+        bol = 0;
+        if (set_flags(c, set, n, 0) & STATE_ACCEPT) {
+            return p;
+        }
+        p++;
+    }
+
+    if (end > begin && *(end - 1) != '\n' && (set_flags(c, set, n, bol) & STATE_ACCEPT_EOL)) {
+        return end;
+    }
+    return NULL;
+}
+
+/**
+ * dfa_scan - scans [p, end) with the lazily built DFA
+ *
+ * p is a line start. Each newline checks for a match at the end of the
+ * line and restarts from the start state.
+ */
+static const char *dfa_scan(RegexCache *c, const char *p, const char *end) {
+    const uint32_t *trans = c->trans;
+    const uint16_t *class_of = c->re->class_of;
+    uint32_t nclasses = c->re->nclasses;
+    const char *begin = p;
+    const char *line = p;
+    uint32_t start;
+    uint32_t s;
+
+    if (c->use_nfa) {
+        return nfa_scan(c, p, end);
+    }
+    start = (uint32_t)get_start_state(c) * nclasses;
+    if ((c->states + start / nclasses)->flags & STATE_ACCEPT) {
+        return p < end ? p : NULL;      // an empty match on every line
+    }
+
+    s = start;
+    while (p < end) {
+        uint32_t t = *(trans + s + *(class_of + (unsigned char)*p));
+
+        if (t & DFA_ACCEPT) {
+            if (t == DFA_NEWLINE) {
+                if ((c->states + s / nclasses)->flags & STATE_ACCEPT_EOL) {
+                    break;
+                }
+                s = start;
+                line = ++p;
+                continue;
+            }
+            if (t == DFA_UNKNOWN) {
+                int flushed = 0;
+                t = next_state(c, s, (unsigned char)*p, &flushed);
+                if (flushed) {
+                    size_t scanned = c->scanned + (size_t)(p - begin);
+                    if (scanned - c->scanned_at_flush < (size_t)RX_MIN_BYTES_PER_STATE * c->max_states &&
+                        ++c->wasted_flushes >= RX_MAX_WASTED_FLUSHES) {
+                        c->use_nfa = 1;
+                        c->scanned = scanned;
+                        return nfa_scan(c, line, end);
+                    }
+                    c->scanned_at_flush = scanned;
+                    start = (uint32_t)c->start_state * nclasses;
+                }
+                if (!(t & DFA_ACCEPT)) {
+                    s = t;
+                    p++;
+                    continue;
+                }
+            }
+            break;      // matched
+        }
+        s = t;
+        p++;
+    }
+
+    c->scanned += (size_t)(p - begin);
+    if (p < end) {
+        return p;
+    }
+    if (end > begin && *(end - 1) != '\n' && ((c->states + s / nclasses)->flags & STATE_ACCEPT_EOL)) {
+        return end;
+    }
+    return NULL;
+}
+
+const char *regex_find(const Regex *re, RegexCache *cache, const char *text, size_t len) {
+    const char *p = text;
+    const char *end = text + len;
+
+    if (!re->has_literal) {
+        return dfa_scan(cache, p, end);
+    }
+
+    // Only lines holding the required literal can match
+    while (p < end) {
+        const char *hit = matcher_find(&re->literal, p, (size_t)(end - p));
+        const char *line_start;
+        const char *line_end;
+        const char *match;
+
+        if (hit == NULL) {
+            return NULL;
+        }
+        line_start = hit;
+        while (line_start > p && *(line_start - 1) != '\n') {
+            line_start--;
+        }
+        line_end = memchr(hit, '\n', (size_t)(end - hit));
+        line_end = line_end ? line_end : end;
+
+        match = dfa_scan(cache, line_start, line_end);
+        if (match != NULL) {
+            return match;
+        }
+        p = line_end + 1;
+    }
+    return NULL;
+}
@@ -0,0 +1,85 @@
+#ifndef __MGREGEX_H__
+#define __MGREGEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mgsearch.h"
+
+/**
+ * Regex - extended regular expressions, compiled for line-by-line matching
+ *
+ * Supported syntax: literals, ".", bracket expressions (ranges, negation,
+ * [:alpha:] style classes), "\d \w \s \D \W \S", grouping, "|", the
+ * repetitions "* + ? {m} {m,} {m,n}", and the anchors "^" and "$", which
+ * match at line boundaries. Nothing matches a newline.
+ *
+ * Patterns compile to a Thompson NFA. Searches run it as a DFA whose states
+ * are built lazily and kept in a size-bounded cache (RegexCache); if the
+ * cache keeps filling up faster than it pays off, the search falls back to
+ * simulating the NFA directly (a Pike VM without captures). Either way the
+ * time is linear in the text. If every match must contain some literal
+ * string, that literal is located first with the literal engine, and only
+ * the lines holding it are run through the automaton.
+ */
+typedef struct {
+    struct RxInst *prog;        // NFA program
+    uint32_t ninst;
+    uint32_t start;
+    uint64_t (*sets)[4];        // byte sets of the RX_CLASS instructions
+    uint32_t nsets;
+    uint16_t class_of[256];     // byte -> equivalence class for DFA rows
+    uint8_t class_byte[256];    // a byte of each class
+    uint32_t nclasses;
+    int has_literal;            // literal prefilter available
+    Matcher literal;
+} Regex;
+
+typedef struct RegexCache RegexCache;
+
+/**
+ * regex_compile - compiles patterns; a line matches if any of them does
+ * @re: regex to fill in
+ * @patterns: null-terminated patterns
+ * @npatterns: number of patterns, may be 0 (nothing matches)
+ * @case_insensitive: if 1, match letters regardless of case
+ * @error: receives a description of the first invalid pattern
+ *
+ * Returns: 0 on success, 1 if a pattern is invalid, -1 if memory could
+ * not be allocated
+ */
+int regex_compile(Regex *re, char **patterns, size_t npatterns, int case_insensitive,
+                  const char **error);
+
+/**
+ * regex_cache_new - creates the lazily built DFA for one searching thread
+ * @re: compiled regex, which must outlive the cache
+ *
+ * Returns: cache, or NULL if memory could not be allocated
+ */
+RegexCache *regex_cache_new(const Regex *re);
+
+/**
+ * regex_find - finds the first line of text that matches
+ * @re: compiled regex
+ * @cache: DFA cache from regex_cache_new()
+ * @text: bytes to search, starting at the beginning of a line
+ * @len: number of bytes in text
+ *
+ * Returns: pointer into the first matching line (possibly to its
+ * terminating newline, or to text + len for an unterminated last line),
+ * or NULL if no line matches
+ */
+const char *regex_find(const Regex *re, RegexCache *cache, const char *text, size_t len);
+
+/**
+ * regex_cache_free - releases a DFA cache
+ */
+void regex_cache_free(RegexCache *cache);
+
+/**
+ * regex_free - releases memory held by a compiled regex
+ */
+void regex_free(Regex *re);
+
+#endif
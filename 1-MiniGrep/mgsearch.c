@@ -0,0 +1,394 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "mgsearch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Byte maps applied to the text before comparing: identity, and tolower()
+static unsigned char fold_none[256];
+static unsigned char fold_lower[256];
+static int fold_ready = 0;
+
+// Bytes in rough order of decreasing frequency in prose, source code and
+// logs. Bytes not listed (control characters, bytes >= 0x80) rank rarest.
+static const char common_bytes[] =
+    " etaoinsrlhdcumpfgybw.,_/-=()\"'0123456789:;\tTSEAIRNOCLDMPxvkjqz"
+    "{}[]<>*#!?&|+%$@\\^~`HUBFGWYVKXJQZ";
+
+// Higher is more common; see common_bytes
+static unsigned char byte_rank[256];
+
+static void init_fold_tables(void) {
+    size_t ncommon = sizeof(common_bytes) - 1;
+
+    fold_ready = 1;
+    for (int c = 0; c < 256; c++) {
+        *(fold_none + c) = (unsigned char)c;
+        *(fold_lower + c) = (unsigned char)tolower(c);
+    }
+    for (size_t i = 0; i < ncommon; i++) {
+        *(byte_rank + (unsigned char)*(common_bytes + i)) = (unsigned char)(ncommon - i);
+    }
+}
+
+/**
+ * rarity - how common a pattern byte is in text, lower is rarer
+ * @c: folded pattern byte
+ * @case_insensitive: if 1, a letter also stands for its uppercase form
+ */
+static int rarity(unsigned char c, int case_insensitive) {
+    int rank = *(byte_rank + c);
+
+    if (case_insensitive && islower(c)) {
+        rank += *(byte_rank + (unsigned char)toupper(c));
+    }
+    return rank;
+}
+
+/**
+ * pick_rare_bytes - chooses the two positions the prefilter compares
+ * @m: matcher with its folded needle filled in
+ * @case_insensitive: if 1, letters match either case
+ */
+static void pick_rare_bytes(Matcher *m, int case_insensitive) {
+    size_t first = 0;
+    size_t second = 0;
+
+    for (size_t i = 1; i < m->len; i++) {
+        if (rarity(*(m->needle + i), case_insensitive) < rarity(*(m->needle + first), case_insensitive)) {
+            first = i;
+        }
+    }
+    second = first == 0 ? 1 : 0;
+    for (size_t i = 0; i < m->len; i++) {
+        if (i != first &&
+            rarity(*(m->needle + i), case_insensitive) < rarity(*(m->needle + second), case_insensitive)) {
+            second = i;
+        }
+    }
+    if (m->len < 2) {
+        second = first;
+    }
+
+    m->rare1 = first < second ? first : second;
+    m->rare2 = first < second ? second : first;
+    m->rare1_byte = *(m->needle + m->rare1);
+    m->rare2_byte = *(m->needle + m->rare2);
+    // A lowercase letter has bit 0x20 set, and clearing it gives the
+    // uppercase letter, so OR-ing 0x20 into the text folds exactly its case
+    m->rare1_or = case_insensitive && islower(m->rare1_byte) ? 0x20 : 0;
+    m->rare2_or = case_insensitive && islower(m->rare2_byte) ? 0x20 : 0;
+}
+
+/**
+ * maximal_suffix - computes the maximal suffix of the needle
+ * @n: needle
+ * @len: needle length, at least 1
+ * @reverse: if 1, use the reversed byte order
+ * @period: receives the period of the suffix
+ *
+ * Returns: position just before the maximal suffix (may be (size_t)-1)
+ */
+static size_t maximal_suffix(const unsigned char *n, size_t len, int reverse, size_t *period) {
+    size_t ip = (size_t)-1;     // candidate suffix start - 1
+    size_t jp = 0;              // position being compared against it
+    size_t k = 1;
+    size_t p = 1;
+
+    while (jp + k < len) {
+        unsigned char a = *(n + ip + k);
+        unsigned char b = *(n + jp + k);
+
+        if (a == b) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (reverse ? a < b : a > b) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+
+    *period = p;
+    return ip;
+}
+
+/**
+ * twoway_find - Two-Way search of [h, z)
+ *
+ * Returns: pointer to the first match, or NULL
+ */
+static const char *twoway_find(const Matcher *m, const unsigned char *h, const unsigned char *z) {
+    const unsigned char *n = m->needle;
+    const unsigned char *fold = m->fold;
+    size_t l = m->len;
+    size_t mem = 0;
+    size_t k;
+
+    while ((size_t)(z - h) >= l) {
+        // Last byte of the window first: skip to align its last occurrence
+        // in the needle, or past the window if it does not occur at all
+        size_t shift = *(m->shift + *(fold + *(h + l - 1)));
+        if (shift != l) {
+            k = l - shift;
+            if (k < mem) {
+                k = mem;
+            }
+            h += k;
+            mem = 0;
+            continue;
+        }
+
+        // Right half, left to right
+        k = m->split > mem ? m->split : mem;
+        while (k < l && *(n + k) == *(fold + *(h + k))) {
+            k++;
+        }
+        if (k < l) {
+            h += k - m->split + 1;
+            mem = 0;
+            continue;
+        }
+
+        // Left half, right to left, down to what is already known to match
+        k = m->split;
+        while (k > mem && *(n + k - 1) == *(fold + *(h + k - 1))) {
+            k--;
+        }
+        if (k <= mem) {
+            return (const char *)h;
+        }
+        h += m->period;
+        mem = m->memory;
+    }
+
+    return NULL;
+}
+
+/**
+ * verify - checks the whole pattern at one candidate window
+ */
+static inline int verify(const Matcher *m, const unsigned char *h) {
+    const unsigned char *n = m->needle;
+    const unsigned char *fold = m->fold;
+
+    for (size_t k = 0; k < m->len; k++) {
+        if (*(n + k) != *(fold + *(h + k))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static const char *find_scalar(const Matcher *m, const char *text, size_t len) {
+    const unsigned char *h = (const unsigned char *)text;
+
+    return twoway_find(m, h, h + len);
+}
+
+// Verifying a candidate may cost up to a pattern length. Once the bytes
+// verified exceed this multiple of the bytes scanned (as with "aaaa" in a
+// run of a's), the rest of the text goes to Two-Way, so the search stays
+// linear whatever the input.
+#define VERIFY_BUDGET_FACTOR 4
+#define VERIFY_BUDGET_SLACK 4096
+
+// Windows [h, h + W) are tested at once: the text bytes at offsets rare1
+// and rare2 of each window are compared with the pattern's, and each bit
+// set in both comparison masks is a candidate to verify.
+#define PREFILTER_BODY(W, vec, loadu, set1, or_, cmpeq, and_, movemask) \
+    const unsigned char *start = (const unsigned char *)text; \
+    const unsigned char *h = start; \
+    const unsigned char *z = start + len; \
+    const unsigned char *last; \
+    size_t verified = 0; \
+    vec want1 = set1((char)m->rare1_byte); \
+    vec want2 = set1((char)m->rare2_byte); \
+    vec or1 = set1((char)m->rare1_or); \
+    vec or2 = set1((char)m->rare2_or); \
+    \
+    if (len < m->len) { \
+        return NULL; \
+    } \
+    last = z - m->len;      /* start of the last window */ \
+    while ((size_t)(last - h) >= (W)) { \
+        vec b1 = or_(loadu((const vec *)(h + m->rare1)), or1); \
+        vec b2 = or_(loadu((const vec *)(h + m->rare2)), or2); \
+        unsigned mask = (unsigned)movemask(and_(cmpeq(b1, want1), cmpeq(b2, want2))); \
+        while (mask != 0) { \
+            const unsigned char *cand = h + __builtin_ctz(mask); \
+            if (verify(m, cand)) { \
+                return (const char *)cand; \
+            } \
+            verified += m->len; \
+            mask &= mask - 1; \
+        } \
+        h += (W); \
+        if (verified > (size_t)(h - start) * VERIFY_BUDGET_FACTOR + VERIFY_BUDGET_SLACK) { \
+            break; \
+        } \
+    } \
+    return twoway_find(m, h, z);
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static const char *find_sse2(const Matcher *m, const char *text, size_t len) {
+    PREFILTER_BODY(16, __m128i, _mm_loadu_si128, _mm_set1_epi8, _mm_or_si128,
+                   _mm_cmpeq_epi8, _mm_and_si128, _mm_movemask_epi8)
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const Matcher *m, const char *text, size_t len) {
+    PREFILTER_BODY(32, __m256i, _mm256_loadu_si256, _mm256_set1_epi8, _mm256_or_si256,
+                   _mm256_cmpeq_epi8, _mm256_and_si256, _mm256_movemask_epi8)
+}
+#endif
+
+typedef const char *(*find_fn)(const Matcher *m, const char *text, size_t len);
+
+typedef struct {
+    const char *name;
+    find_fn find;
+} Kernel;
+
+// Ordered from narrowest to widest
+static const Kernel kernels[] = {
+    {"scalar", find_scalar},
+#if defined(__x86_64__) || defined(__i386__)
+    {"sse2", find_sse2},
+    {"avx2", find_avx2},
+#endif
+};
+
+// Kernel used by every matcher, set once by mg_select_kernel()
+static const Kernel *active_kernel = NULL;
+
+static int kernel_supported(const Kernel *kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (strcmp(kernel->name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(kernel->name, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return strcmp(kernel->name, "scalar") == 0;
+}
+
+const char *mg_select_kernel(const char *name) {
+    size_t nkernels = sizeof(kernels) / sizeof(kernels[0]);
+    const Kernel *best = &kernels[0];
+
+    for (size_t i = 0; i < nkernels; i++) {
+        if (!kernel_supported(&kernels[i])) {
+            continue;
+        }
+        if (name && strcmp(name, kernels[i].name) == 0) {
+            best = &kernels[i];
+            break;
+        }
+        best = &kernels[i];
+    }
+
+    active_kernel = best;
+    return active_kernel->name;
+}
+
+int matcher_init(Matcher *m, const char *pattern, int case_insensitive) {
+    const char *end = pattern;
+    size_t ms, period, rev_period, rev_ms;
+
+    if (!fold_ready) {
+        init_fold_tables();
+    }
+    if (!active_kernel) {
+        mg_select_kernel(NULL);
+    }
+
+    while (*end != '\0') {
+        end++;
+    }
+    m->len = (size_t)(end - pattern);
+    m->fold = case_insensitive ? fold_lower : fold_none;
+    m->needle = malloc(m->len + 1);
+    if (m->needle == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < 256; i++) {
+        *(m->shift + i) = 0;
+    }
+    for (size_t i = 0; i < m->len; i++) {
+        unsigned char c = *(m->fold + (unsigned char)*(pattern + i));
+        *(m->needle + i) = c;
+        *(m->shift + c) = i + 1;
+    }
+    *(m->needle + m->len) = '\0';
+
+    m->split = 0;
+    m->period = 1;
+    m->memory = 0;
+    if (m->len == 0) {
+        return 0;
+    }
+    pick_rare_bytes(m, case_insensitive);
+
+    // Critical factorization: the later of the two maximal suffixes
+    ms = maximal_suffix(m->needle, m->len, 0, &period);
+    rev_ms = maximal_suffix(m->needle, m->len, 1, &rev_period);
+    if (rev_ms + 1 > ms + 1) {
+        ms = rev_ms;
+        period = rev_period;
+    }
+    m->split = ms + 1;
+
+    // A periodic needle lets a match of the right half keep what is known
+    // of the left half; otherwise shift past the larger half
+    int periodic = 1;
+    for (size_t i = 0; i < m->split; i++) {
+        if (*(m->needle + i) != *(m->needle + i + period)) {
+            periodic = 0;
+            break;
+        }
+    }
+    if (periodic) {
+        m->period = period;
+        m->memory = m->len - period;
+    } else {
+        size_t left = m->split - 1;
+        size_t right = m->len - m->split;
+        m->period = (left > right ? left : right) + 1;
+        m->memory = 0;
+    }
+
+    return 0;
+}
+
+const char *matcher_find(const Matcher *m, const char *text, size_t len) {
+    const unsigned char *h = (const unsigned char *)text;
+
+    if (m->len == 0) {
+        return text;
+    }
+    if (m->len > PREFILTER_MAX_LEN) {
+        return twoway_find(m, h, h + len);
+    }
+    return active_kernel->find(m, text, len);
+}
+
+void matcher_free(Matcher *m) {
+    free(m->needle);
+    m->needle = NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef __MGSEARCH_H__
+#define __MGSEARCH_H__
+
+#include <stddef.h>
+
+/**
+ * Matcher - a literal pattern prepared once for repeated searches
+ *
+ * Searching uses the Two-Way algorithm (Crochemore-Perrin): the pattern is
+ * split at its critical factorization, which bounds the work to O(n + m)
+ * for any text, with a Horspool-style shift on the last window byte so that
+ * typical text is skipped in steps of up to the pattern length.
+ *
+ * Patterns of up to PREFILTER_MAX_LEN bytes are first located by a SIMD
+ * prefilter: the two rarest pattern bytes (by a byte-frequency table) are
+ * compared against 16 or 32 window positions at once, and only windows
+ * where both agree are verified.
+ */
+typedef struct {
+    unsigned char *needle;          // pattern, lowercased for -i
+    size_t len;
+    const unsigned char *fold;      // maps a text byte to its compared form
+    size_t split;                   // start of the right half of the factorization
+    size_t period;                  // shift after a full right-half match
+    size_t memory;                  // prefix known to match after that shift
+    size_t shift[256];              // 1 + last position of each byte, 0 if absent
+    size_t rare1;                   // positions of the two rarest bytes, rare1 < rare2
+    size_t rare2;                   // (equal for one-byte patterns)
+    unsigned char rare1_byte;       // (text | rare1_or) == rare1_byte at rare1
+    unsigned char rare1_or;         // 0x20 for letters under -i, otherwise 0
+    unsigned char rare2_byte;
+    unsigned char rare2_or;
+} Matcher;
+
+// Longest pattern searched through the SIMD prefilter; the skip loop of
+// Two-Way already moves about a pattern length per step for longer ones
+#define PREFILTER_MAX_LEN 64
+
+/**
+ * mg_select_kernel - chooses the search kernel used by all matchers
+ * @name: "scalar", "sse2" or "avx2", or NULL for the widest one the CPU
+ *        supports; a kernel the CPU lacks falls back to the best available
+ *
+ * "scalar" is plain Two-Way. If this is never called, the first
+ * matcher_init() selects automatically.
+ *
+ * Returns: name of the kernel in use
+ */
+const char *mg_select_kernel(const char *name);
+
+/**
+ * matcher_init - prepares pattern for searching
+ * @m: matcher to fill in
+ * @pattern: null-terminated pattern
+ * @case_insensitive: if 1, match letters regardless of case
+ *
+ * Returns: 0 on success, -1 if memory could not be allocated
+ */
+int matcher_init(Matcher *m, const char *pattern, int case_insensitive);
+
+/**
+ * matcher_find - finds the first occurrence of the pattern
+ * @m: prepared matcher
+ * @text: bytes to search, need not be null-terminated
+ * @len: number of bytes in text
+ *
+ * Returns: pointer to the first match in text, or NULL if there is none
+ */
+const char *matcher_find(const Matcher *m, const char *text, size_t len);
+
+/**
+ * matcher_free - releases memory held by the matcher
+ * @m: matcher from matcher_init()
+ */
+void matcher_free(Matcher *m);
+
+#endif
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "mgwalk.h"
+
+// Files of one directory handed out as a unit of work
+#define WALK_BATCH          64
+
+// Buffer for one getdents64() call
+#define DENTS_BUF_SZ        (32 * 1024)
+
+// Idle workers sleep this long between attempts to steal
+#define IDLE_SLEEP_NS       50000
+
+// Layout of the records returned by getdents64()
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/**
+ * WalkItem - a directory to list, or a batch of files in a directory
+ */
+typedef struct {
+    char *dir;                  // path of the directory
+    char *names;                // null-separated file names, NULL to list dir
+    size_t nnames;
+} WalkItem;
+
+// Items of one worker: the owner pushes and pops at tail, thieves take
+// from head
+typedef struct {
+    pthread_mutex_t lock;
+    WalkItem **items;
+    size_t head;
+    size_t tail;
+    size_t cap;
+} Deque;
+
+typedef struct {
+    const Walk *walk;
+    Deque *deques;
+    unsigned nworkers;
+    atomic_size_t pending;      // items pushed but not yet finished
+    atomic_int nomem;
+} Walker;
+
+typedef struct {
+    Walker *walker;
+    unsigned id;
+} Worker;
+
+static int deque_push(Deque *d, WalkItem *item) {
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->cap) {
+        if (d->head > 0) {
+            memmove(d->items, d->items + d->head, (d->tail - d->head) * sizeof(WalkItem *));
+            d->tail -= d->head;
+            d->head = 0;
+        } else {
+            size_t cap = d->cap ? d->cap * 2 : 64;
+            WalkItem **grown = realloc(d->items, cap * sizeof(WalkItem *));
+            if (grown == NULL) {
+                pthread_mutex_unlock(&d->lock);
+                return -1;
+            }
+            d->items = grown;
+            d->cap = cap;
+        }
+    }
+    *(d->items + d->tail++) = item;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+// Takes the newest item (owner) or the oldest one (thief)
+static WalkItem *deque_take(Deque *d, int steal) {
+    WalkItem *item = NULL;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail) {
+        item = steal ? *(d->items + d->head++) : *(d->items + --d->tail);
+        if (d->head == d->tail) {
+            d->head = d->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+    return item;
+}
+
+static void free_item(WalkItem *item) {
+    free(item->dir);
+    free(item->names);
+    free(item);
+}
+
+// Whether the caller asked for the walk to end early
+static int stopped(const Walker *walker) {
+    return walker->walk->stop != NULL && atomic_load(walker->walk->stop);
+}
+
+// Queues item on worker's deque; on failure it is dropped
+static void push_item(Worker *w, WalkItem *item) {
+    Walker *walker = w->walker;
+
+    atomic_fetch_add(&walker->pending, 1);
+    if (deque_push(walker->deques + w->id, item) != 0) {
+        atomic_store(&walker->nomem, 1);
+        atomic_fetch_sub(&walker->pending, 1);
+        free_item(item);
+    }
+}
+
+static WalkItem *new_item(const char *dir, char *names, size_t nnames) {
+    WalkItem *item = malloc(sizeof(WalkItem));
+    char *copy = strdup(dir);
+
+    if (item == NULL || copy == NULL) {
+        free(item);
+        free(copy);
+        return NULL;
+    }
+    item->dir = copy;
+    item->names = names;
+    item->nnames = nnames;
+    return item;
+}
+
+// dir + "/" + name, in a buffer that grows as needed
+static const char *join_path(char **buf, size_t *size, const char *dir, const char *name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    size_t need = dir_len + name_len + 2;
+
+    if (need > *size) {
+        char *grown = realloc(*buf, need * 2);
+        if (grown == NULL) {
+            return NULL;
+        }
+        *buf = grown;
+        *size = need * 2;
+    }
+    memcpy(*buf, dir, dir_len);
+    if (dir_len > 0 && *(dir + dir_len - 1) != '/') {
+        *(*buf + dir_len++) = '/';
+    }
+    memcpy(*buf + dir_len, name, name_len + 1);
+    return *buf;
+}
+
+// Visits each file of a batch; dirfd is the directory, or -1 to open it
+static void visit_batch(Worker *w, int dirfd, const char *dir, const char *names, size_t nnames,
+                        char **path, size_t *path_size) {
+    const Walk *walk = w->walker->walk;
+    int own_fd = dirfd < 0;
+
+    if (own_fd) {
+        dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd < 0) {
+            walk->report_error(walk->ctx, w->id, dir);
+            return;
+        }
+    }
+    for (size_t i = 0; i < nnames && !stopped(w->walker); i++) {
+        const char *full = join_path(path, path_size, dir, names);
+        if (full == NULL) {
+            atomic_store(&w->walker->nomem, 1);
+            break;
+        }
+        walk->visit_file(walk->ctx, w->id, dirfd, names, full);
+        names += strlen(names) + 1;
+    }
+    if (own_fd) {
+        close(dirfd);
+    }
+}
+
+/**
+ * list_dir - reads a directory, queueing its subdirectories and files
+ *
+ * Full batches of files are queued where other workers can steal them;
+ * the last, partial batch is visited right away.
+ */
+static void list_dir(Worker *w, const char *dir, char **path, size_t *path_size) {
+    const Walk *walk = w->walker->walk;
+    char dents[DENTS_BUF_SZ];
+    char *batch = NULL;
+    size_t batch_len = 0;
+    size_t batch_cap = 0;
+    size_t nbatch = 0;
+    long nread = 0;
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0) {
+        walk->report_error(walk->ctx, w->id, dir);
+        return;
+    }
+
+    while (!stopped(w->walker) && (nread = syscall(SYS_getdents64, fd, dents, sizeof(dents))) > 0) {
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(dents + off);
+            const char *name = d->d_name;
+            unsigned char type = d->d_type;
+            off += d->d_reclen;
+
+            if (*name == '.' && (*(name + 1) == '\0' || (*(name + 1) == '.' && *(name + 2) == '\0'))) {
+                continue;
+            }
+            if (*name == '.' && !walk->include_hidden) {
+                continue;
+            }
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+            }
+
+            if (type == DT_DIR) {
+                const char *sub = join_path(path, path_size, dir, name);
+                WalkItem *item = sub ? new_item(sub, NULL, 0) : NULL;
+                if (item == NULL) {
+                    atomic_store(&w->walker->nomem, 1);
+                    continue;
+                }
+                push_item(w, item);
+            } else if (type == DT_REG) {
+                size_t len = strlen(name) + 1;
+                if (batch_len + len > batch_cap) {
+                    size_t cap = batch_cap ? batch_cap * 2 : 4096;
+                    if (cap < batch_len + len) {
+                        cap = batch_len + len;
+                    }
+                    char *grown = realloc(batch, cap);
+                    if (grown == NULL) {
+                        atomic_store(&w->walker->nomem, 1);
+                        continue;
+                    }
+                    batch = grown;
+                    batch_cap = cap;
+                }
+                memcpy(batch + batch_len, name, len);
+                batch_len += len;
+
+                if (++nbatch == WALK_BATCH) {
+                    WalkItem *item = new_item(dir, batch, nbatch);
+                    if (item == NULL) {
+                        atomic_store(&w->walker->nomem, 1);
+                        free(batch);
+                    } else {
+                        push_item(w, item);
+                    }
+                    batch = NULL;
+                    batch_len = batch_cap = nbatch = 0;
+                }
+            }
+        }
+    }
+    if (nread < 0) {
+        walk->report_error(walk->ctx, w->id, dir);
+    }
+
+    visit_batch(w, fd, dir, batch, nbatch, path, path_size);
+    free(batch);
+    close(fd);
+}
+
+static void *run_worker(void *arg) {
+    Worker *w = arg;
+    Walker *walker = w->walker;
+    char *path = NULL;
+    size_t path_size = 0;
+
+    while (!stopped(walker)) {
+        WalkItem *item = deque_take(walker->deques + w->id, 0);
+
+        // Out of work: steal, starting with the next worker
+        for (unsigned i = 1; item == NULL && i < walker->nworkers; i++) {
+            item = deque_take(walker->deques + (w->id + i) % walker->nworkers, 1);
+        }
+        if (item == NULL) {
+            if (atomic_load(&walker->pending) == 0) {
+                break;
+            }
+            struct timespec idle = {0, IDLE_SLEEP_NS};
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        if (item->names == NULL) {
+            list_dir(w, item->dir, &path, &path_size);
+        } else {
+            visit_batch(w, -1, item->dir, item->names, item->nnames, &path, &path_size);
+        }
+        free_item(item);
+        atomic_fetch_sub(&walker->pending, 1);
+    }
+
+    free(path);
+    return NULL;
+}
+
+int walk_tree(const char *root, const Walk *walk) {
+    Walker walker;
+    unsigned nworkers = walk->nthreads > 0 ? walk->nthreads : 1;
+    struct stat st;
+
+    if (stat(root, &st) == 0 && !S_ISDIR(st.st_mode)) {
+        walk->visit_file(walk->ctx, 0, AT_FDCWD, root, root);
+        return 0;
+    }
+
+    walker.walk = walk;
+    walker.nworkers = nworkers;
+    atomic_init(&walker.pending, 0);
+    atomic_init(&walker.nomem, 0);
+    walker.deques = calloc(nworkers, sizeof(Deque));
+    Worker *workers = malloc(nworkers * sizeof(Worker));
+    pthread_t *threads = malloc(nworkers * sizeof(pthread_t));
+    int *started = calloc(nworkers, sizeof(int));
+    WalkItem *first = new_item(root, NULL, 0);
+    if (walker.deques == NULL || workers == NULL || threads == NULL || started == NULL || first == NULL) {
+        free(walker.deques);
+        free(workers);
+        free(threads);
+        free(started);
+        if (first != NULL) {
+            free_item(first);
+        }
+        return -1;
+    }
+
+    for (unsigned i = 0; i < nworkers; i++) {
+        pthread_mutex_init(&(walker.deques + i)->lock, NULL);
+        (workers + i)->walker = &walker;
+        (workers + i)->id = i;
+    }
+    push_item(workers, first);
+
+    // The calling thread is worker 0
+    for (unsigned i = 1; i < nworkers; i++) {
+        *(started + i) = pthread_create(threads + i, NULL, run_worker, workers + i) == 0;
+    }
+    run_worker(workers);
+    for (unsigned i = 1; i < nworkers; i++) {
+        if (*(started + i)) {
+            pthread_join(*(threads + i), NULL);
+        }
+    }
+
+    // A stopped walk leaves work behind
+    for (unsigned i = 0; i < nworkers; i++) {
+        Deque *d = walker.deques + i;
+        for (size_t j = d->head; j < d->tail; j++) {
+            free_item(*(d->items + j));
+        }
+        pthread_mutex_destroy(&d->lock);
+        free(d->items);
+    }
+    free(walker.deques);
+    free(workers);
+    free(threads);
+    free(started);
+    return atomic_load(&walker.nomem) ? -1 : 0;
+}
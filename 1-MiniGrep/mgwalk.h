@@ -0,0 +1,48 @@
+#ifndef __MGWALK_H__
+#define __MGWALK_H__
+
+#include <stdatomic.h>
+
+/**
+ * Walk - a parallel traversal of a directory tree
+ *
+ * Each worker thread keeps a deque of pending work: directories still to
+ * be listed, and batches of files found in a listed directory. A worker
+ * takes its own newest work first and, when it runs out, steals the oldest
+ * work of another worker, which tends to be a whole subtree. Directories
+ * are read with getdents64() and files are opened relative to their
+ * directory, so that no path is resolved more than once.
+ *
+ * Symbolic links are not followed, and only regular files are visited.
+ */
+typedef struct {
+    unsigned nthreads;          // worker threads, including the caller
+    int include_hidden;         // if 0, skip names starting with "."
+
+    // Called on a worker thread for each regular file; name is relative
+    // to dirfd, path is the path shown to the user
+    void (*visit_file)(void *ctx, unsigned worker, int dirfd, const char *name,
+                       const char *path);
+
+    // Called for a directory that cannot be opened or read
+    void (*report_error)(void *ctx, unsigned worker, const char *path);
+
+    void *ctx;
+
+    // If not NULL, the walk ends early once this is set
+    const atomic_int *stop;
+} Walk;
+
+/**
+ * walk_tree - visits every regular file below root
+ * @root: directory to walk; a file is visited on its own
+ * @walk: workers and callbacks
+ *
+ * Returns when every file has been visited, or soon after walk->stop is
+ * set.
+ *
+ * Returns: 0, or -1 if memory could not be allocated
+ */
+int walk_tree(const char *root, const Walk *walk);
+
+#endif
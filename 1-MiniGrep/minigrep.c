@@ -1,25 +1,189 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
-#define LINE_BUFFER_SZ 256
+#include "mgsearch.h"
+#include "mgac.h"
+#include "mgregex.h"
+#include "mgwalk.h"
+#include "mgout.h"
+#include "mgindex.h"
+
+// Initial size of the block buffer; it doubles for lines that do not fit
+#define READ_BLOCK_SZ (256 * 1024)
+
+// Mapped files are searched in windows of this size; the kernel is asked
+// to read the next window ahead while one is searched
+#define MAP_WINDOW_SZ (8 * 1024 * 1024)
+
+// Most threads used by -r and -j
+#define MAX_THREADS 256
+
+// Range of file bytes each thread searches per round with -j
+#define CHUNK_MIN_SZ (64 * 1024)
+#define CHUNK_MAX_SZ (8 * 1024 * 1024)
+
+/**
+ * PatternList - patterns from the command line (-e, or the positional
+ * pattern) and pattern files (-f), each an owned copy
+ */
+typedef struct {
+    char **items;
+    size_t count;
+    size_t capacity;
+} PatternList;
+
+/**
+ * Patterns - the compiled form of a PatternList
+ *
+ * A single pattern is searched with the literal engine (Two-Way with the
+ * SIMD prefilter); several are matched in one pass by Aho-Corasick. With
+ * -E, all of them are compiled into one regular expression.
+ */
+typedef struct {
+    Matcher literal;
+    AhoCorasick multi;
+    Regex regex;
+    int use_multi;
+    int use_regex;
+} Patterns;
+
+/**
+ * Block - buffer for reading a file in blocks; it holds whole lines,
+ * growing for long ones, and is reused from file to file. It is
+ * allocated on first use.
+ */
+typedef struct {
+    char *data;
+    size_t size;
+} Block;
+
+/**
+ * Search - state of a search across consecutive blocks of one file
+ *
+ * Line numbers are only computed for -n, and only when a line is printed,
+ * by counting the newlines since the last line that was numbered.
+ */
+typedef struct {
+    const Patterns *patterns;
+    RegexCache *regex_cache;    // DFA states built by this search, for -E
+    OutBuf *out;
+    const char *label;      // file name printed before each line (-r), or NULL
+    int lines_stable;       // the searched text is mapped, not a reused block
+    int show_line_nums;
+    int count_only;
+    int invert_match;
+    int skip_binary;        // skip files with a NUL byte in their first block
+    int list_files;         // print the label once instead of the lines (-l)
+    int quiet;              // exit with 0 at the first selected line (-q)
+    long max_count;         // selected lines after which a file is left (-m, -l), or -1
+    long file_count;        // lines selected in the current file
+    long line_number;       // number of the line starting at counted
+    const char *counted;    // newlines before this have been counted
+    long match_count;
+} Search;
+
+/**
+ * Chunk - one thread's share of a round of a chunked search (-j)
+ *
+ * The chunk holds the lines that start in [begin, end) of the file: the
+ * line running into begin is left to the previous chunk, and the last
+ * line is read to its end past the range.
+ */
+typedef struct {
+    Search search;
+    OutBuf out;
+    Block block;
+    int fd;
+    const char *map;        // the mapped file, or NULL to read into block
+    off_t size;             // file size
+    off_t begin;
+    off_t end;
+    const char *lines;      // the lines, in map or block
+    size_t len;
+    long newlines;          // newlines in the lines, for -n
+    int status;             // 0, or 3 / 4 if the chunk could not be read
+} Chunk;
+
+/**
+ * TreeWorker - state of one thread of a search of many files (-r, --index)
+ */
+typedef struct {
+    Search search;
+    OutBuf out;
+    Block block;
+    int failed;             // a file or directory could not be read
+} TreeWorker;
+
+/**
+ * IndexScan - an indexed search: the directory is walked as by -r, and
+ * the index tells which unchanged files cannot match
+ */
+typedef struct {
+    TreeWorker *workers;
+    const TrigramIndex *index;
+    const unsigned char *marks; // 1 for each indexed file that may match
+    size_t dir_len;             // length of the directory's path
+} IndexScan;
 
 // Function prototypes
 void usage(char *exename);
 int str_len(char *str);
-int str_match(char *line, char *pattern, int case_insensitive);
+int str_match(char *line, Matcher *matcher);
+void add_pattern(PatternList *list, const char *pattern, size_t len);
+void read_pattern_file(PatternList *list, const char *path);
+int compile_patterns(Patterns *compiled, PatternList *list, int case_insensitive, int extended);
+void free_patterns(Patterns *compiled, PatternList *list);
+void search_lines(Search *search, const char *start, const char *end);
+int search_fd(Search *search, int fd, Block *block);
+int search_file(Search *search, int fd, Block *block);
+int search_chunked(int fd, off_t size, const Search *proto, unsigned nthreads, long *match_count);
+int search_tree(const char *root, const Search *proto, int include_hidden, unsigned nthreads,
+                long *match_count);
+int search_indexed(const char *dir, const PatternList *list, const Search *proto, unsigned nthreads,
+                   long *match_count);
 
 /**
  * usage - prints usage information
  * @exename: the name of the executable
  */
 void usage(char *exename) {
-    printf("usage: %s [-h|n|i|c|v] \"pattern\" filename\n", exename);
+    printf("usage: %s [-h|n|i|c|v|E|r|q|l] [-m NUM] \"pattern\" filename\n", exename);
+    printf("       %s [-n|i|c|v|E|r|q|l] -e \"pattern\" [-e \"pattern\"]... [-f patternfile] filename\n", exename);
+    printf("       %s --index build directory\n", exename);
+    printf("       %s [-n|i|c|v|E|q|l] [-m NUM] --index directory \"pattern\"\n", exename);
     printf("  -h    prints this help message\n");
     printf("  -n    prints matching lines with line numbers\n");
     printf("  -i    case-insensitive search\n");
     printf("  -c    counts matching lines\n");
     printf("  -v    inverts match (prints non-matching lines) [EXTRA CREDIT]\n");
+    printf("  -e    adds a pattern; lines matching any pattern are selected\n");
+    printf("  -f    adds the patterns in a file, one per line\n");
+    printf("  -E    patterns are extended regular expressions\n");
+    printf("  -r    searches every file below the directory filename, in parallel\n");
+    printf("  -q    prints nothing; exits with 0 at the first selected line\n");
+    printf("  -l    prints the name of each file with a selected line\n");
+    printf("  -m N  stops reading a file after N selected lines\n");
+    printf("  -j N  searches with N threads: one file in parallel ranges, or with -r,\n");
+    printf("        N files at a time (default: one per CPU)\n");
+    printf("  --hidden  with -r, also searches hidden files and directories\n");
+    printf("  --binary  with -r, also searches files containing NUL bytes\n");
+    printf("  --index build DIR  indexes the files below DIR; a later build only\n");
+    printf("            reads the files that changed\n");
+    printf("  --index DIR  searches only the indexed files that may match\n");
+    printf("            (--hidden and --binary do not apply)\n");
+    printf("A filename of - reads standard input.\n");
 }
 
 /**
@@ -49,83 +213,1019 @@ int str_len(char *str) {
 /**
  * str_match - searches for pattern in line
  * @line: the line to search in
- * @pattern: the pattern to search for
- * @case_insensitive: if 1, ignore case; if 0, case-sensitive
+ * @matcher: the pattern, prepared once by matcher_init()
  * 
  * Returns: 1 if pattern found, 0 if not found
  * 
- * TODO: IMPLEMENT THIS FUNCTION
- * You must use pointer arithmetic, no array notation
- * Hint: For case-insensitive, use tolower() or toupper() on both characters
- * Hint: You need to check if pattern matches starting at ANY position in line
+ * The search runs in time linear in the line length for any pattern;
+ * the case-insensitive path compares lowercased bytes (see mgsearch.c).
  */
-int str_match(char *line, char *pattern, int case_insensitive) {
-    // TODO: Implement pattern matching
-    // Remember: pattern can appear anywhere in the line
-    // For case-insensitive, compare characters after converting to same case
-
-	char *start;
-	char *lp;
-	char *pp;
-	
-	// empty pattern 
-	if (line == NULL || pattern == NULL) {
+int str_match(char *line, Matcher *matcher) {
+	if (line == NULL) {
 		return 0;
-    	}
+	}
 
-    	if (*pattern == '\0') {
-        	return 1;
-    	}
-	
-	// match pattern start at position in line 
-    	start = line;
-
-   	while (*start != '\0') {
-		// set pointer to current pos and start of pattern
-        	lp = start;
-        	pp = pattern;
-		
-		// compar echaracters while match
-        	while (*pp != '\0' && *lp != '\0') {
-            		char a = *lp;
-            		char b = *pp;
-
-            		if (case_insensitive) {
-				a = (char)tolower((unsigned char)a);
-                		b = (char)tolower((unsigned char)b);
-            		}
-
-            		if (a != b) {
-                		break;
-            		}
-			//move to next chars
-            		lp++;
-            		pp++;
-        	}
-
-        	if (*pp == '\0') { // full match found
-            		return 1;
-        	}
-
-        	start++;
-    	}
+	return matcher_find(matcher, line, str_len(line)) != NULL;
+}
+
+/**
+ * add_pattern - appends a copy of a pattern to the list
+ * @list: pattern list
+ * @pattern: pattern bytes, need not be null-terminated
+ * @len: pattern length
+ *
+ * Exits with code 4 if memory cannot be allocated.
+ */
+void add_pattern(PatternList *list, const char *pattern, size_t len) {
+    char *copy;
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 8;
+        char **grown = realloc(list->items, capacity * sizeof(char *));
+        if (grown == NULL) {
+            exit(4);
+        }
+        list->items = grown;
+        list->capacity = capacity;
+    }
+
+    copy = malloc(len + 1);
+    if (copy == NULL) {
+        exit(4);
+    }
+    memcpy(copy, pattern, len);
+    *(copy + len) = '\0';
+    *(list->items + list->count++) = copy;
+}
+
+/**
+ * read_pattern_file - adds every line of a file as a pattern
+ * @list: pattern list
+ * @path: file with one pattern per line; an empty line matches everything
+ *
+ * Exits with code 3 if the file cannot be read, 4 if memory runs out.
+ */
+void read_pattern_file(PatternList *list, const char *path) {
+    FILE *fp = fopen(path, "r");
+    char *buf = NULL;
+    size_t size = 0;
+    size_t len = 0;
+    size_t nread;
+
+    if (fp == NULL) {
+        printf("Error: Cannot open file %s\n", path);
+        exit(3);
+    }
+
+    do {
+        if (len == size) {
+            size = size ? size * 2 : READ_BLOCK_SZ;
+            char *grown = realloc(buf, size);
+            if (grown == NULL) {
+                exit(4);
+            }
+            buf = grown;
+        }
+        nread = fread(buf + len, 1, size - len, fp);
+        len += nread;
+    } while (nread > 0);
+
+    if (ferror(fp)) {
+        printf("Error: Cannot read file %s\n", path);
+        exit(3);
+    }
+    fclose(fp);
+
+    // A final newline ends the last pattern rather than adding an empty one
+    const char *p = buf;
+    const char *end = buf + len;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        eol = eol ? eol : end;
+        add_pattern(list, p, (size_t)(eol - p));
+        p = eol + 1;
+    }
+    free(buf);
+}
+
+/**
+ * compile_patterns - prepares the patterns for searching
+ * @extended: if 1, the patterns are regular expressions
+ *
+ * Returns: 0 on success, 1 if a regular expression is invalid (after
+ * printing why), -1 if memory could not be allocated
+ */
+int compile_patterns(Patterns *compiled, PatternList *list, int case_insensitive, int extended) {
+    compiled->use_regex = extended;
+    compiled->use_multi = !extended && list->count != 1;
+    if (compiled->use_regex) {
+        const char *error;
+        int rc = regex_compile(&compiled->regex, list->items, list->count, case_insensitive, &error);
+        if (rc > 0) {
+            printf("Error: Invalid regular expression: %s\n", error);
+        }
+        return rc;
+    }
+    if (compiled->use_multi) {
+        return ac_init(&compiled->multi, list->items, list->count, case_insensitive);
+    }
+    return matcher_init(&compiled->literal, *list->items, case_insensitive);
+}
+
+void free_patterns(Patterns *compiled, PatternList *list) {
+    if (compiled->use_regex) {
+        regex_free(&compiled->regex);
+    } else if (compiled->use_multi) {
+        ac_free(&compiled->multi);
+    } else {
+        matcher_free(&compiled->literal);
+    }
+    for (size_t i = 0; i < list->count; i++) {
+        free(*(list->items + i));
+    }
+    free(list->items);
+}
+
+/**
+ * find_pattern - finds the first match of any pattern
+ *
+ * Returns: pointer to a byte of the match (the line it is on is the
+ * matching line), or NULL if nothing matches
+ */
+static const char *find_pattern(Search *search, const char *text, size_t len) {
+    const Patterns *compiled = search->patterns;
+
+    if (compiled->use_regex) {
+        return regex_find(&compiled->regex, search->regex_cache, text, len);
+    }
+    if (compiled->use_multi) {
+        return ac_find(&compiled->multi, text, len);
+    }
+    return matcher_find(&compiled->literal, text, len);
+}
+
+/**
+ * count_newlines - counts newline characters in [start, end)
+ */
+static long count_newlines(const char *start, const char *end) {
+    long n = 0;
+
+    while (start < end) {
+        n += *start == '\n';
+        start++;
+    }
+    return n;
+}
+
+// "Error: <message> <path>" in line with the search output
+static void out_error(OutBuf *out, const char *message, const char *path) {
+    out_write(out, "Error: ", 7);
+    out_write(out, message, strlen(message));
+    out_write(out, " ", 1);
+    out_write(out, path, strlen(path));
+    out_write(out, "\n", 1);
+}
+
+// Set at the first line selected with -q: every search stops there, and
+// main() exits with 0
+static atomic_int quiet_found;
+
+/**
+ * search_done - whether the current file has its -m (or -l) lines, or
+ * any search has found the line -q waits for
+ */
+static int search_done(const Search *search) {
+    return (search->quiet && atomic_load(&quiet_found)) ||
+           (search->max_count >= 0 && search->file_count >= search->max_count);
+}
+
+/**
+ * emit_line - counts a selected line, and prints it unless -c is given
+ * @search: search state
+ * @start: first byte of the line
+ * @end: end of the line, excluding its newline
+ *
+ * With -q, prints nothing and stops all searches instead.
+ *
+ * Returns: 1 if the rest of the file is to be skipped, else 0
+ */
+static int emit_line(Search *search, const char *start, const char *end) {
+    OutBuf *out = search->out;
+
+    if (search->quiet) {
+        atomic_store(&quiet_found, 1);
+        search->match_count++;
+        return 1;
+    }
+    search->match_count++;
+    search->file_count++;
+    if (search->list_files) {
+        out_write(out, search->label, strlen(search->label));
+        out_write(out, "\n", 1);
+        out_end_line(out);
+        return 1;
+    }
+    if (search->count_only) {
+        return search_done(search);
+    }
+
+    if (search->label != NULL) {
+        out_write(out, search->label, strlen(search->label));
+        out_write(out, ":", 1);
+    }
+    if (search->show_line_nums) {
+        search->line_number += count_newlines(search->counted, start);
+        search->counted = start;
+        out_number(out, search->line_number);
+        out_write(out, ": ", 2);
+    }
+    // Long lines are written straight from the searched text
+    out_write_ref(out, start, (size_t)(end - start), search->lines_stable);
+    out_write(out, "\n", 1);
+    out_end_line(out);
+    return search_done(search);
+}
+
+/**
+ * search_lines - searches a run of whole lines at once
+ * @search: search state
+ * @start: first byte of the first line
+ * @end: end of the last line: just past its newline, or the end of the
+ *       file for a last line without one
+ *
+ * The whole run is searched in one call per match; lines are only
+ * delimited around the matches, and for -v, between them. The search
+ * stops at the line that completes the file's -m count.
+ */
+void search_lines(Search *search, const char *start, const char *end) {
+    const char *p = start;
+
+    search->counted = start;
+    while (p < end) {
+        const char *hit = find_pattern(search, p, (size_t)(end - p));
+        const char *line_start;
+        const char *line_end;
+
+        if (hit == NULL) {
+            if (search->invert_match) {
+                // Every remaining line is selected
+                while (p < end) {
+                    line_end = memchr(p, '\n', (size_t)(end - p));
+                    line_end = line_end ? line_end : end;
+                    if (emit_line(search, p, line_end)) {
+                        return;
+                    }
+                    p = line_end + 1;
+                }
+            }
+            break;
+        }
+
+        // The line holding the match
+        line_start = hit;
+        while (line_start > p && *(line_start - 1) != '\n') {
+            line_start--;
+        }
+        line_end = memchr(hit, '\n', (size_t)(end - hit));
+        line_end = line_end ? line_end : end;
+
+        if (search->invert_match) {
+            // Lines before it are selected
+            while (p < line_start) {
+                const char *eol = memchr(p, '\n', (size_t)(line_start - p));
+                if (emit_line(search, p, eol)) {
+                    return;
+                }
+                p = eol + 1;
+            }
+        } else if (emit_line(search, line_start, line_end)) {
+            return;
+        }
+        p = line_end + 1;
+    }
+
+    // Carry the line count to the next run
+    if (search->show_line_nums) {
+        search->line_number += count_newlines(search->counted, end);
+    }
+}
+
+/**
+ * search_fd - searches everything that can be read from a file
+ * @search: search state; line numbers restart at 1
+ * @fd: file to read
+ * @block: block buffer, grown as needed
+ *
+ * Large blocks are read and the whole lines in each are searched at once.
+ * The partial line at the end of a block is moved to the front and
+ * completed by the next read; the buffer grows if a line fills it.
+ * Output that refers to the block is released before it is reused.
+ * Reading stops once the file has its -m lines.
+ *
+ * Returns: 0, 3 if the file cannot be read, 4 if memory runs out
+ */
+int search_fd(Search *search, int fd, Block *block) {
+    size_t filled = 0;      // bytes in block
+    ssize_t nread;          // bytes returned by the last read()
+    int first = 1;
+
+    if (block->data == NULL) {
+        block->data = malloc(READ_BLOCK_SZ);
+        if (block->data == NULL) {
+            return 4;
+        }
+        block->size = READ_BLOCK_SZ;
+    }
+
+    search->line_number = 1;
+    search->file_count = 0;
+    search->lines_stable = 0;
+    for (;;) {
+        if (search_done(search)) {
+            return 0;
+        }
+        if (filled == block->size) {
+            char *grown = realloc(block->data, block->size * 2);
+            if (grown == NULL) {
+                return 4;
+            }
+            block->data = grown;
+            block->size *= 2;
+        }
+
+        nread = read(fd, block->data + filled, block->size - filled);
+        if (nread < 0) {
+            return 3;
+        }
+        if (nread == 0) {
+            // A last line without a newline
+            if (filled > 0) {
+                search_lines(search, block->data, block->data + filled);
+                out_release(search->out);
+            }
+            return 0;
+        }
+        if (first && search->skip_binary && memchr(block->data, '\0', (size_t)nread) != NULL) {
+            return 0;
+        }
+        first = 0;
+
+        // Search up to the last newline of what was just read
+        char *data_end = block->data + filled + nread;
+        char *lines_end = data_end;
+        while (lines_end > block->data + filled && *(lines_end - 1) != '\n') {
+            lines_end--;
+        }
+        if (lines_end == block->data + filled) {
+            filled += (size_t)nread;    // no newline yet
+            continue;
+        }
+
+        search_lines(search, block->data, lines_end);
+        out_release(search->out);
+        filled = (size_t)(data_end - lines_end);
+        memmove(block->data, lines_end, filled);
+    }
+}
+
+// Pages of a mapped file that was truncated while it is searched raise
+// SIGBUS. A thread reading a mapping points bus_guard at a jump buffer, and
+// the handler jumps back to it so the file is reported as unreadable; any
+// other SIGBUS is fatal as usual.
+static _Thread_local sigjmp_buf *bus_guard;
+
+static void bus_signal(int sig) {
+    if (bus_guard != NULL) {
+        siglongjmp(*bus_guard, 1);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
 
-    	return 0;
- 
+// Asks the kernel to start reading [start, start + len) of a mapping
+static void read_ahead(const char *map, const char *start, size_t len) {
+    static size_t page_size;
+    uintptr_t offset = (uintptr_t)(start - map);
+
+    if (page_size == 0) {
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    offset &= ~(uintptr_t)(page_size - 1);
+    madvise((char *)map + offset, len + ((uintptr_t)(start - map) - offset), MADV_WILLNEED);
+}
+
+// Searches the lines of a mapped file in windows, reading the next one ahead
+static void search_windows(Search *search, const char *map, size_t size) {
+    const char *p = map;
+    const char *end = map + size;
+
+    if (search->skip_binary && memchr(map, '\0', size < READ_BLOCK_SZ ? size : READ_BLOCK_SZ) != NULL) {
+        return;
+    }
+
+    search->line_number = 1;
+    search->file_count = 0;
+    search->lines_stable = 1;
+    while (p < end && !search_done(search)) {
+        const char *window_end = (size_t)(end - p) > MAP_WINDOW_SZ ? p + MAP_WINDOW_SZ : end;
+        if (window_end < end) {
+            const char *eol = memchr(window_end - 1, '\n', (size_t)(end - window_end) + 1);
+            window_end = eol ? eol + 1 : end;
+        }
+        if (window_end < end) {
+            size_t ahead = (size_t)(end - window_end);
+            read_ahead(map, window_end, ahead < MAP_WINDOW_SZ ? ahead : MAP_WINDOW_SZ);
+        }
+        search_lines(search, p, window_end);
+        p = window_end;
+    }
+}
+
+/**
+ * search_mapped - searches a regular file through a read-only mapping
+ * @search: search state; line numbers restart at 1
+ * @fd: file to search
+ * @size: its size, more than 0
+ *
+ * Lines are searched and printed straight from the mapped pages, in
+ * windows of whole lines; the next window is read ahead. Output is
+ * flushed before the file is unmapped.
+ *
+ * Returns: 0, 3 if the file shrank while it was searched, or -1 if it
+ * cannot be mapped
+ */
+static int search_mapped(Search *search, int fd, size_t size) {
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    sigjmp_buf guard;
+
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    if (sigsetjmp(guard, 1) != 0) {
+        // Lines found before the missing pages are still printed
+        bus_guard = NULL;
+        out_flush(search->out);
+        munmap(map, size);
+        return 3;
+    }
+    bus_guard = &guard;
+    search_windows(search, map, size);
+    bus_guard = NULL;
+
+    out_flush(search->out);
+    munmap(map, size);
+    return 0;
+}
+
+/**
+ * search_file - searches a file, mapping it if it is a large regular file
+ * @search: search state; line numbers restart at 1
+ * @fd: file to search
+ * @block: block buffer for files that are read, grown as needed
+ *
+ * Files of up to one block, and pipes, terminals and other files that
+ * cannot be mapped, are read with search_fd().
+ *
+ * Returns: 0, 3 if the file cannot be read, 4 if memory runs out
+ */
+int search_file(Search *search, int fd, Block *block) {
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > READ_BLOCK_SZ) {
+        int status = search_mapped(search, fd, (size_t)st.st_size);
+        if (status >= 0) {
+            return status;
+        }
+    }
+    return search_fd(search, fd, block);
+}
+
+// Makes room for size bytes in a block buffer; returns 0, or -1
+static int reserve_block(Block *block, size_t size) {
+    if (size > block->size) {
+        char *grown = realloc(block->data, size);
+        if (grown == NULL) {
+            return -1;
+        }
+        block->data = grown;
+        block->size = size;
+    }
+    return 0;
+}
+
+// Reads the lines of a chunk into its block buffer: [from, to) holds the
+// range with the byte before it
+static void read_chunk_lines(Chunk *c, off_t from, off_t to) {
+    size_t start = 0;
+    size_t filled = 0;
+    ssize_t nread;
+
+    if (reserve_block(&c->block, (size_t)(to - from)) != 0) {
+        c->status = 4;
+        return;
+    }
+    while (filled < (size_t)(to - from)) {
+        nread = pread(c->fd, c->block.data + filled, (size_t)(to - from) - filled, from + (off_t)filled);
+        if (nread < 0) {
+            c->status = 3;
+            return;
+        }
+        if (nread == 0) {
+            break;      // the file shrank
+        }
+        filled += (size_t)nread;
+    }
+
+    // Skip the line that started before begin
+    if (c->begin > 0) {
+        const char *eol = memchr(c->block.data, '\n', filled);
+        if (eol == NULL) {
+            return;     // no line starts in the range
+        }
+        start = (size_t)(eol + 1 - c->block.data);
+    }
+
+    // Read the last line to its end
+    while (filled > start && *(c->block.data + filled - 1) != '\n' &&
+           from + (off_t)filled < c->size) {
+        if (filled == c->block.size && reserve_block(&c->block, c->block.size * 2) != 0) {
+            c->status = 4;
+            return;
+        }
+        nread = pread(c->fd, c->block.data + filled, c->block.size - filled, from + (off_t)filled);
+        if (nread < 0) {
+            c->status = 3;
+            return;
+        }
+        if (nread == 0) {
+            break;
+        }
+        const char *eol = memchr(c->block.data + filled, '\n', (size_t)nread);
+        filled = eol ? (size_t)(eol + 1 - c->block.data) : filled + (size_t)nread;
+    }
+
+    c->lines = c->block.data + start;
+    c->len = filled - start;
+}
+
+// Thread function: finds (or reads) the lines of a chunk, counting them
+// for -n
+static void *read_chunk(void *arg) {
+    Chunk *c = arg;
+    off_t from = c->begin > 0 ? c->begin - 1 : 0;   // with the byte before begin
+    off_t to = c->end < c->size ? c->end : c->size;
+    sigjmp_buf guard;
+
+    c->lines = NULL;
+    c->len = 0;
+    c->newlines = 0;
+    c->status = 0;
+    if (c->begin >= to) {
+        return NULL;
+    }
+    if (sigsetjmp(guard, 1) != 0) {
+        bus_guard = NULL;
+        c->len = 0;
+        c->status = 3;      // the mapped file shrank
+        return NULL;
+    }
+    bus_guard = &guard;
+
+    if (c->map != NULL) {
+        const char *lines = c->map + c->begin;
+        const char *lines_end = c->map + to;
+        const char *eol;
+        if (c->begin > 0) {
+            eol = memchr(lines - 1, '\n', (size_t)(lines_end - lines) + 1);
+            lines = eol ? eol + 1 : lines_end;
+        }
+        if (lines < lines_end && to < c->size && *(lines_end - 1) != '\n') {
+            eol = memchr(lines_end, '\n', (size_t)(c->size - to));
+            lines_end = eol ? eol + 1 : c->map + c->size;
+        }
+        if (lines < lines_end) {
+            c->lines = lines;
+            c->len = (size_t)(lines_end - lines);
+        }
+    } else {
+        read_chunk_lines(c, from, to);
+    }
+    if (c->len > 0 && c->search.show_line_nums) {
+        c->newlines = count_newlines(c->lines, c->lines + c->len);
+    }
+    bus_guard = NULL;
+    return NULL;
+}
+
+// Thread function: searches the lines of a chunk
+static void *search_chunk(void *arg) {
+    Chunk *c = arg;
+    sigjmp_buf guard;
+
+    if (sigsetjmp(guard, 1) != 0) {
+        bus_guard = NULL;
+        c->status = 3;      // the mapped file shrank
+        return NULL;
+    }
+    bus_guard = &guard;
+    if (c->len > 0) {
+        search_lines(&c->search, c->lines, c->lines + c->len);
+    }
+    bus_guard = NULL;
+    return NULL;
+}
+
+// Runs fn on every chunk, the first on the calling thread; a chunk whose
+// thread could not be started runs on the calling thread afterwards
+static void run_chunks(void *(*fn)(void *), Chunk *chunks, unsigned nchunks) {
+    pthread_t tids[MAX_THREADS];
+    int started[MAX_THREADS];
+
+    for (unsigned i = 1; i < nchunks; i++) {
+        started[i] = pthread_create(&tids[i], NULL, fn, chunks + i) == 0;
+    }
+    fn(chunks);
+    for (unsigned i = 1; i < nchunks; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        } else {
+            fn(chunks + i);
+        }
+    }
+}
+
+/**
+ * search_chunked - searches one regular file with several threads (-j)
+ * @fd: file to search
+ * @size: its size
+ * @proto: search settings shared by all threads
+ * @nthreads: number of threads, at most MAX_THREADS
+ * @match_count: receives the total number of selected lines
+ *
+ * The file is searched in rounds of nthreads consecutive ranges. Each
+ * round, the threads find their ranges' lines (counting newlines for -n),
+ * a prefix sum of the counts gives each range its first line number, the
+ * threads search, and their output is written in file order. The file is
+ * mapped, and the next round read ahead, if possible; otherwise each
+ * thread reads its range with pread().
+ *
+ * Returns: 0, 3 if the file cannot be read, 4 if memory runs out
+ */
+int search_chunked(int fd, off_t size, const Search *proto, unsigned nthreads, long *match_count) {
+    size_t chunk_size = (size_t)(size / nthreads) + 1;
+    Chunk *chunks = calloc(nthreads, sizeof(Chunk));
+    char *map = size > 0 ? mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    long lines_before = 0;
+    int status = 0;
+
+    if (chunks == NULL) {
+        return 4;
+    }
+    if (map == MAP_FAILED) {
+        map = NULL;
+    }
+    chunk_size = chunk_size < CHUNK_MIN_SZ ? CHUNK_MIN_SZ : chunk_size > CHUNK_MAX_SZ ? CHUNK_MAX_SZ : chunk_size;
+    for (unsigned i = 0; i < nthreads; i++) {
+        Chunk *c = chunks + i;
+        c->search = *proto;
+        c->search.out = &c->out;
+        c->out.held = 1;
+        c->fd = fd;
+        c->map = map;
+        c->size = size;
+        c->search.lines_stable = map != NULL;
+        if (proto->patterns->use_regex &&
+            (c->search.regex_cache = regex_cache_new(&proto->patterns->regex)) == NULL) {
+            return 4;
+        }
+    }
+
+    off_t round_size = (off_t)(chunk_size * nthreads);
+    for (off_t round = 0; round < size && status == 0 && !search_done(proto); round += round_size) {
+        for (unsigned i = 0; i < nthreads; i++) {
+            (chunks + i)->begin = round + (off_t)(i * chunk_size);
+            (chunks + i)->end = (chunks + i)->begin + (off_t)chunk_size;
+        }
+        if (map != NULL && round + round_size < size) {
+            off_t ahead = size - (round + round_size);
+            read_ahead(map, map + round + round_size, (size_t)(ahead < round_size ? ahead : round_size));
+        }
+        run_chunks(read_chunk, chunks, nthreads);
+
+        for (unsigned i = 0; i < nthreads; i++) {
+            Chunk *c = chunks + i;
+            status = status == 0 ? c->status : status;
+            c->search.line_number = lines_before + 1;
+            lines_before += c->newlines;
+        }
+        if (status != 0) {
+            break;
+        }
+
+        run_chunks(search_chunk, chunks, nthreads);
+        // Output stops at a range that could not be read
+        for (unsigned i = 0; i < nthreads && status == 0; i++) {
+            out_flush(&(chunks + i)->out);
+            status = (chunks + i)->status;
+        }
+    }
+
+    *match_count = 0;
+    for (unsigned i = 0; i < nthreads; i++) {
+        Chunk *c = chunks + i;
+        *match_count += c->search.match_count;
+        out_free(&c->out);
+        free(c->block.data);
+        regex_cache_free(c->search.regex_cache);
+    }
+    free(chunks);
+    if (map != NULL) {
+        munmap(map, (size_t)size);
+    }
+    return status;
+}
+
+// walk_tree() callback: searches one file on a worker thread
+static void search_tree_file(void *ctx, unsigned worker, int dirfd, const char *name, const char *path) {
+    TreeWorker *w = (TreeWorker *)ctx + worker;
+
+    if (w->search.quiet && atomic_load(&quiet_found)) {
+        return;
+    }
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        out_error(&w->out, "Cannot open file", path);
+        w->failed = 1;
+        return;
+    }
+    w->search.label = path;
+    int status = search_file(&w->search, fd, &w->block);
+    close(fd);
+
+    if (status == 4) {
+        exit(4);
+    }
+    if (status == 3) {
+        out_error(&w->out, "Cannot read file", path);
+        w->failed = 1;
+    }
+}
+
+static void search_tree_error(void *ctx, unsigned worker, const char *path) {
+    TreeWorker *w = (TreeWorker *)ctx + worker;
+
+    out_error(&w->out, "Cannot read directory", path);
+    w->failed = 1;
+}
+
+// Thread count for -r and --index: nthreads, or 0 for one per CPU
+static unsigned thread_count(unsigned nthreads) {
+    if (nthreads == 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus < 1 ? 1 : ncpus > MAX_THREADS ? MAX_THREADS : (unsigned)ncpus;
+    }
+    return nthreads;
+}
+
+// Per-thread state for a search of many files; NULL if memory runs out
+static TreeWorker *new_workers(const Search *proto, unsigned nthreads) {
+    TreeWorker *workers = calloc(nthreads, sizeof(TreeWorker));
+
+    if (workers == NULL) {
+        return NULL;
+    }
+    for (unsigned i = 0; i < nthreads; i++) {
+        TreeWorker *w = workers + i;
+        w->search = *proto;
+        w->search.out = &w->out;
+        if (proto->patterns->use_regex &&
+            (w->search.regex_cache = regex_cache_new(&proto->patterns->regex)) == NULL) {
+            return NULL;
+        }
+    }
+    return workers;
+}
+
+// Writes out what the threads still hold, adds up their counts and
+// frees them; returns 0, or 3 if a file or directory could not be read
+static int finish_workers(TreeWorker *workers, unsigned nthreads, long *match_count) {
+    int status = 0;
+
+    *match_count = 0;
+    for (unsigned i = 0; i < nthreads; i++) {
+        TreeWorker *w = workers + i;
+        out_flush(&w->out);
+        *match_count += w->search.match_count;
+        if (w->failed) {
+            status = 3;
+        }
+        out_free(&w->out);
+        free(w->block.data);
+        regex_cache_free(w->search.regex_cache);
+    }
+    free(workers);
+    return status;
+}
+
+/**
+ * search_tree - searches every regular file below a directory (-r)
+ * @root: directory to search
+ * @proto: search settings shared by all threads
+ * @include_hidden: if 1, also search hidden files and directories
+ * @nthreads: number of threads, at most MAX_THREADS; 0 for one per CPU
+ * @match_count: receives the total number of selected lines
+ *
+ * The threads walk the tree and search the files they find, each into
+ * its own output buffer, so lines of one file stay together unless a
+ * file produces more than a buffer's worth.
+ *
+ * Returns: 0, 3 if a file or directory could not be read, 4 if memory
+ * runs out
+ */
+int search_tree(const char *root, const Search *proto, int include_hidden, unsigned nthreads,
+                long *match_count) {
+    nthreads = thread_count(nthreads);
+    TreeWorker *workers = new_workers(proto, nthreads);
+    int status;
+    Walk walk;
+
+    if (workers == NULL) {
+        return 4;
+    }
+
+    walk.nthreads = nthreads;
+    walk.include_hidden = include_hidden;
+    walk.visit_file = search_tree_file;
+    walk.report_error = search_tree_error;
+    walk.ctx = workers;
+    walk.stop = proto->quiet ? &quiet_found : NULL;
+    status = walk_tree(root, &walk) != 0 ? 4 : 0;
+
+    int failed = finish_workers(workers, nthreads, match_count);
+    return status != 0 ? status : failed;
+}
+
+// walk_tree() callback for --index: searches a file unless the index shows
+// it cannot match. Files that are new or changed since the index was built
+// are searched as by -r.
+static void search_index_file(void *ctx, unsigned worker, int dirfd, const char *name, const char *path) {
+    IndexScan *scan = ctx;
+    const char *rel = path + scan->dir_len;
+    struct stat st;
+
+    if (*rel == '/') {
+        rel++;
+    }
+    long id = index_find(scan->index, rel);
+    if (id >= 0 && !*(scan->marks + id) && fstatat(dirfd, name, &st, 0) == 0 &&
+        index_current(scan->index, (uint32_t)id, &st)) {
+        return;
+    }
+    search_tree_file(scan->workers, worker, dirfd, name, path);
+}
+
+static void search_index_error(void *ctx, unsigned worker, const char *path) {
+    search_tree_error(((IndexScan *)ctx)->workers, worker, path);
+}
+
+/**
+ * search_indexed - searches the files of an index that may match (--index)
+ * @dir: indexed directory
+ * @list: the patterns
+ * @proto: search settings shared by all threads
+ * @nthreads: number of threads, at most MAX_THREADS; 0 for one per CPU
+ * @match_count: receives the total number of selected lines
+ *
+ * The directory is walked as by -r. Each literal pattern's trigrams are
+ * looked up in the index, and an indexed file that lacks a trigram of
+ * every pattern is skipped while its modification time and size are
+ * those it was indexed with. Files added or changed since the index was
+ * built are searched, and deleted ones are not. With -v or -E every file
+ * is searched.
+ *
+ * Returns: 0, 3 if the index or a file could not be read, 4 if memory
+ * runs out
+ */
+int search_indexed(const char *dir, const PatternList *list, const Search *proto, unsigned nthreads,
+                   long *match_count) {
+    TrigramIndex index;
+    IndexScan scan;
+    Walk walk;
+    int status;
+
+    *match_count = 0;
+    status = index_open(&index, dir);
+    if (status != 0) {
+        if (status == -2) {
+            return 4;
+        }
+        printf("Error: Cannot read index %s\n", dir);
+        return 3;
+    }
+    unsigned char *marks = calloc((size_t)index.header->nfiles + 1, 1);
+    if (marks == NULL) {
+        index_close(&index);
+        return 4;
+    }
+    if (proto->invert_match || proto->patterns->use_regex) {
+        memset(marks, 1, index.header->nfiles);
+    } else {
+        for (size_t i = 0; i < list->count; i++) {
+            const char *pattern = *(list->items + i);
+            if (index_candidates(&index, pattern, strlen(pattern), marks) != 0) {
+                free(marks);
+                index_close(&index);
+                return 4;
+            }
+        }
+    }
+
+    nthreads = thread_count(nthreads);
+    scan.workers = new_workers(proto, nthreads);
+    scan.index = &index;
+    scan.marks = marks;
+    scan.dir_len = strlen(dir);
+    if (scan.workers == NULL) {
+        free(marks);
+        index_close(&index);
+        return 4;
+    }
+
+    // The walk skips hidden files, as the index build does
+    walk.nthreads = nthreads;
+    walk.include_hidden = 0;
+    walk.visit_file = search_index_file;
+    walk.report_error = search_index_error;
+    walk.ctx = &scan;
+    walk.stop = proto->quiet ? &quiet_found : NULL;
+    status = walk_tree(dir, &walk) != 0 ? 4 : 0;
+
+    int failed = finish_workers(scan.workers, nthreads, match_count);
+    free(marks);
+    index_close(&index);
+    return status != 0 ? status : failed;
+}
+
+/**
+ * is_option - whether an argument is made only of known options
+ * @arg: the argument, starting with '-'
+ *
+ * -e and -f end a group and take the next argument as their value; -j and
+ * -m may have their number attached instead. A value attached to -e or -f
+ * would make "-foo" ambiguous, so it is not accepted. Anything else, such as a
+ * pattern starting with '-', is not an option.
+ *
+ * Returns: 1 if arg is options, else 0
+ */
+static int is_option(const char *arg) {
+    const char *p = arg + 1;
+
+    if (*p == '-') {
+        return strcmp(p, "-") == 0 || strcmp(p, "-hidden") == 0 || strcmp(p, "-binary") == 0 ||
+               strcmp(p, "-index") == 0;
+    }
+    for (; *p != '\0'; p++) {
+        if (*p == 'e' || *p == 'f') {
+            return *(p + 1) == '\0';
+        }
+        if (*p == 'j' || *p == 'm') {
+            for (p++; *p >= '0' && *p <= '9'; p++) {
+            }
+            return *p == '\0';
+        }
+        if (strchr("nicvErlq", *p) == NULL) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
 int main(int argc, char *argv[]) {
-    char *line_buffer;      // buffer for reading lines from file
-    char *pattern;          // the search pattern
-    char *filename;         // the file to search
-    FILE *fp;               // file pointer
+    Block block = {NULL, 0};    // block buffer for reading the file
+    OutBuf out = {0};       // output of the search
+    PatternList pattern_list = {NULL, 0, 0};   // patterns from -e, -f or the command line
+    char *filename;         // the file (or with -r, directory) to search
+    int fd;                 // file descriptor
+    struct stat st;         // file type and size, for -j
+    int status;             // 0, or the exit code of a failed search
     int show_line_nums = 0; // flag for -n option
     int case_insensitive = 0; // flag for -i option
     int count_only = 0;     // flag for -c option
     int invert_match = 0;   // flag for -v option (extra credit)
-    int line_number = 0;    // current line number in file
-    int match_count = 0;    // count of matching lines
-    int found_match;        // result from str_match()
+    int extended = 0;       // flag for -E option
+    int recursive = 0;      // flag for -r option
+    int include_hidden = 0; // flag for --hidden option
+    int search_binary = 0;  // flag for --binary option
+    int list_files = 0;     // flag for -l option
+    int quiet = 0;          // flag for -q option
+    long max_count = -1;    // value of -m option, -1 if not given
+    char *index_dir = NULL; // value of --index option: a directory, or "build"
+    unsigned nthreads = 0;  // value of -j option, 0 if not given
+    Patterns patterns;      // patterns prepared for searching
+    Search search;          // state of the search across blocks
     
     // Check minimum arguments
     if (argc < 2) {
@@ -142,10 +1242,48 @@ int main(int argc, char *argv[]) {
     // Parse command line arguments
     int arg_idx = 1;  // current argument index
     
-    // Check for option flags (they start with -)
-    if (*argv[arg_idx] == '-') {
+    int have_patterns = 0;   // -e or -f was given
+    
+    // Check for option flags (they start with -); "--" ends them. The
+    // first argument is always options, as it always was; after it, the
+    // first argument that is not (e.g. "-foo") is the pattern.
+    while (arg_idx < argc && *argv[arg_idx] == '-' && *(argv[arg_idx] + 1) != '\0') {
         char *flag_ptr = argv[arg_idx] + 1;  // skip the '-'
         
+        if (!is_option(argv[arg_idx])) {
+            if (arg_idx > 1) {
+                break;
+            }
+            printf("Error: Unknown option %s\n", argv[arg_idx]);
+            usage(argv[0]);
+            exit(2);
+        }
+        
+        if (*flag_ptr == '-') {
+            if (*(flag_ptr + 1) == '\0') {
+                arg_idx++;
+                break;
+            }
+            if (strcmp(flag_ptr, "-hidden") == 0) {
+                include_hidden = 1;
+            } else if (strcmp(flag_ptr, "-binary") == 0) {
+                search_binary = 1;
+            } else if (strcmp(flag_ptr, "-index") == 0) {
+                if (arg_idx + 1 >= argc) {
+                    printf("Error: Option --index requires an argument\n");
+                    usage(argv[0]);
+                    exit(2);
+                }
+                index_dir = argv[++arg_idx];
+            } else {
+                printf("Error: Unknown option -%s\n", flag_ptr);
+                usage(argv[0]);
+                exit(2);
+            }
+            arg_idx++;
+            continue;
+        }
+        
         // Process each character in the flag
         while (*flag_ptr != '\0') {
             switch (*flag_ptr) {
@@ -161,6 +1299,59 @@ int main(int argc, char *argv[]) {
                 case 'v':
                     invert_match = 1;  // extra credit
                     break;
+                case 'E':
+                    extended = 1;
+                    break;
+                case 'r':
+                    recursive = 1;
+                    break;
+                case 'l':
+                    list_files = 1;
+                    break;
+                case 'q':
+                    quiet = 1;
+                    break;
+                case 'e':
+                case 'f':
+                case 'j':
+                case 'm': {
+                    // The value is the rest of this argument or the next one
+                    char *value = *(flag_ptr + 1) != '\0' ? flag_ptr + 1 : NULL;
+                    if (value == NULL) {
+                        if (arg_idx + 1 >= argc) {
+                            printf("Error: Option -%c requires an argument\n", *flag_ptr);
+                            usage(argv[0]);
+                            exit(2);
+                        }
+                        value = argv[++arg_idx];
+                    }
+                    if (*flag_ptr == 'j') {
+                        char *end;
+                        long n = strtol(value, &end, 10);
+                        if (end == value || *end != '\0' || n < 1 || n > MAX_THREADS) {
+                            printf("Error: Invalid thread count %s\n", value);
+                            usage(argv[0]);
+                            exit(2);
+                        }
+                        nthreads = (unsigned)n;
+                    } else if (*flag_ptr == 'm') {
+                        char *end;
+                        max_count = strtol(value, &end, 10);
+                        if (end == value || *end != '\0' || max_count < 0) {
+                            printf("Error: Invalid match count %s\n", value);
+                            usage(argv[0]);
+                            exit(2);
+                        }
+                    } else if (*flag_ptr == 'e') {
+                        add_pattern(&pattern_list, value, (size_t)str_len(value));
+                        have_patterns = 1;
+                    } else {
+                        read_pattern_file(&pattern_list, value);
+                        have_patterns = 1;
+                    }
+                    flag_ptr = value + str_len(value);  // value ends the argument
+                    continue;
+                }
                 default:
                     printf("Error: Unknown option -%c\n", *flag_ptr);
                     usage(argv[0]);
@@ -171,106 +1362,136 @@ int main(int argc, char *argv[]) {
         arg_idx++;  // move to next argument
     }
     
-    // Check we have pattern and filename
-    if (argc < arg_idx + 2) {
+    // The index holds neither hidden nor binary files
+    if (index_dir != NULL && (include_hidden || search_binary)) {
+        printf("Error: Option --%s cannot be used with --index\n", include_hidden ? "hidden" : "binary");
+        usage(argv[0]);
+        exit(2);
+    }
+
+    // --index build takes only the directory
+    if (index_dir != NULL && strcmp(index_dir, "build") == 0) {
+        IndexStats stats;
+        if (arg_idx + 1 != argc) {
+            printf("Error: Missing directory\n");
+            usage(argv[0]);
+            exit(2);
+        }
+        status = index_build(argv[arg_idx], &stats);
+        if (status == 0) {
+            printf("Indexed %u files (%u read, %u trigrams)\n", stats.nfiles, stats.nscanned, stats.ntrigrams);
+        }
+        exit(status != 0 ? status : stats.failed ? 3 : 0);
+    }
+
+    // Check we have pattern and filename (with --index, only the pattern)
+    if (argc < arg_idx + (have_patterns ? 0 : 1) + (index_dir != NULL ? 0 : 1)) {
         printf("Error: Missing pattern or filename\n");
         usage(argv[0]);
         exit(2);
     }
     
-    pattern = argv[arg_idx];
-    filename = argv[arg_idx + 1];
+    if (!have_patterns) {
+        add_pattern(&pattern_list, argv[arg_idx], (size_t)str_len(argv[arg_idx]));
+        arg_idx++;
+    }
+    filename = index_dir != NULL ? index_dir : argv[arg_idx];
     
-    // TODO: Allocate memory for line buffer using malloc 
-    // Use LINE_BUFFER_SZ for the size
-    // Check if malloc succeeds, if not exit with code 4
+    // MINIGREP_KERNEL=scalar|sse2|avx2 forces a search kernel; the tests
+    // use it to cross-check them against each other
+    mg_select_kernel(getenv("MINIGREP_KERNEL"));
 
-    	line_buffer = (char *)malloc(LINE_BUFFER_SZ);
-	if (line_buffer == NULL) {
-    		exit(4);
-}
+    // Preprocess the patterns once; every block reuses them
+    int compiled = compile_patterns(&patterns, &pattern_list, case_insensitive, extended);
+    if (compiled != 0) {
+        exit(compiled > 0 ? 2 : 4);
+    }
 
-    // TODO: Open the file
-    // Use fopen() with "r" mode
-    // Check if fopen succeeds, if not print error and exit with code 3
+    // -q and -l print instead of the count; -l needs one line per file
+    if (quiet || list_files) {
+        count_only = 0;
+    }
+    if (list_files && max_count != 0) {
+        max_count = 1;
+    }
 
-	fp = fopen(filename, "r"); // open file
-	if (fp == NULL) {
-    		printf("Error: Cannot open file %s\n", filename);
-    		free(line_buffer);
-    		exit(3);
-}
+    search.patterns = &patterns;
+    search.regex_cache = NULL;
+    search.out = &out;
+    search.label = NULL;
+    search.lines_stable = 0;
+    search.show_line_nums = show_line_nums;
+    search.count_only = count_only;
+    search.invert_match = invert_match;
+    search.skip_binary = !search_binary;
+    search.list_files = list_files;
+    search.quiet = quiet;
+    search.max_count = max_count;
+    search.file_count = 0;
+    search.line_number = 1;
+    search.match_count = 0;
 
-    
-    // TODO: Read file line by line
-    // Use fgets() to read into line_buffer
-    // Keep track of line_number (starts at 1)
-    // For each line:
-    //   - Call str_match() to check if pattern exists
-    //   - Based on the flags (show_line_nums, case_insensitive, count_only, invert_match)
-    //     print the appropriate output
-    //   - Update match_count if needed
-    //
-    // Hint: fgets() returns NULL when end of file is reached
-    // Hint: fgets() includes the newline character, you may want to handle that
-    
-	line_number = 1;
-
-	while (fgets(line_buffer, LINE_BUFFER_SZ, fp) != NULL) {
-		
-		found_match = str_match(line_buffer, pattern, case_insensitive);
-
-    	// invert if -v flag is set 
-    	if (invert_match) {
-        	if (found_match == 1) {
-            		found_match = 0;
-        	} else {
-            		found_match = 1;
-        	}
-	}
+    // A mapped file that shrinks during the search cannot be read
+    struct sigaction bus_action;
+    memset(&bus_action, 0, sizeof(bus_action));
+    bus_action.sa_handler = bus_signal;
+    sigemptyset(&bus_action.sa_mask);
+    sigaction(SIGBUS, &bus_action, NULL);
 
-    	if (found_match) {
-        	match_count++;
-
-        	if (!count_only) {
-
-            		// remove trailing newline from fgets (if it exists)
-            		{
-
-                		char *p = line_buffer;
-                		while (*p != '\0') {
-                    			if (*p == '\n') {
-                        			*p = '\0';
-                        			break;
-                    			}
-                    			p++;
-                		}
-            		}
-
-            		if (show_line_nums) {
-                		printf("%d: %s\n", line_number, line_buffer);
-            		} else {
-                		printf("%s\n", line_buffer);
-            		}
-        	}
-    	}
+    if (index_dir != NULL) {
+        status = search_indexed(index_dir, &pattern_list, &search, nthreads, &search.match_count);
+    } else if (recursive) {
+        status = search_tree(filename, &search, include_hidden, nthreads, &search.match_count);
+    } else {
+        // "-" is standard input
+        fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            printf("Error: Cannot open file %s\n", filename);
+            free_patterns(&patterns, &pattern_list);
+            exit(3);
+        }
 
-    	line_number++;
-}
+        search.skip_binary = 0;
+        search.label = list_files ? (fd == STDIN_FILENO ? "(standard input)" : filename) : NULL;
+        // Ranges are searched at the same time, so a count limit needs one
+        // thread to know which lines come first. Standard input is read
+        // from where it stands, which mappings and ranges would ignore.
+        if (nthreads > 1 && max_count < 0 && fd != STDIN_FILENO && fstat(fd, &st) == 0 &&
+            S_ISREG(st.st_mode)) {
+            status = search_chunked(fd, st.st_size, &search, nthreads, &search.match_count);
+        } else {
+            if (patterns.use_regex && (search.regex_cache = regex_cache_new(&patterns.regex)) == NULL) {
+                exit(4);
+            }
 
-    
-    // TODO: Close the file using fclose()
+            status = fd == STDIN_FILENO ? search_fd(&search, fd, &block) : search_file(&search, fd, &block);
+            out_flush(&out);
+            free(block.data);
+            regex_cache_free(search.regex_cache);
+        }
+        if (status == 3) {
+            printf("Error: Cannot read file %s\n", filename);
+        }
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+    if (status == 4) {
+        exit(4);
+    }
+    // -q succeeds once a line is selected, whatever happened to other files
+    if (quiet && atomic_load(&quiet_found)) {
+        exit(0);
+    }
 
-	fclose(fp);
-    
     // TODO: If count_only flag is set, print the match count
     // Format: "Matches found: X" or "No matches found" if count is 0
 
 	
-	if (count_only) {
-		if (match_count > 0) {
+	if (count_only && (status == 0 || recursive || index_dir != NULL)) {
+		if (search.match_count > 0) {
 
-        		printf("Matches found: %d\n", match_count);
+        		printf("Matches found: %ld\n", search.match_count);
 		} else {
         		printf("No matches found\n");
     		}
@@ -280,12 +1501,16 @@ int main(int argc, char *argv[]) {
     
     // TODO: Free the line buffer
 
-	free(line_buffer);
+	out_free(&out);
+	free_patterns(&patterns, &pattern_list);
     
     // Exit with appropriate code
     // 0 = success (found matches)
     // 1 = pattern not found
-    if (match_count > 0) {
+    // 3 = a file could not be read
+    if (status != 0) {
+        exit(status);
+    } else if (search.match_count > 0) {
         exit(0);
     } else {
         exit(1);
@@ -320,6 +320,370 @@ def test_wrong_option_flag(executable):
     result = run_minigrep(executable, ["-z", "pattern", "file.txt"])
     assert result.returncode == 2, "Invalid flag should return error code 2"
 
+# ============================================================================
+# SEARCH ENGINE TESTS (not graded)
+# ============================================================================
+
+def test_periodic_patterns_match_python(executable, tmp_path):
+    """Test Two-Way search on repetitive text and patterns, with and without -i"""
+    lines = ["ab" * 60, "aab" * 40 + "aaab", "abaabaab" * 10 + "abaaba", "x" * 100 + "xy", "AbAbAb" * 10]
+    patterns = ["abab", "aaab", "abaaba", "xxxxxxxxy", "ABABABAB", "baab" * 6]
+    data = tmp_path / "periodic.txt"
+    data.write_text("\n".join(lines) + "\n")
+
+    for pattern in patterns:
+        for flags, fold in (([], str), (["-i"], str.lower)):
+            result = run_minigrep(executable, flags + [pattern, str(data)])
+            expected = [line for line in lines if fold(pattern) in fold(line)]
+            assert result.stdout.splitlines() == expected, (pattern, flags)
+            assert result.returncode == (0 if expected else 1)
+
+@pytest.mark.parametrize("kernel", ["scalar", "sse2", "avx2"])
+def test_prefilter_kernels_match_python(executable, tmp_path, kernel):
+    """Test each search kernel on short and long patterns, including -i on letters and symbols"""
+    import random
+    rng = random.Random(5)
+    alphabet = "abcAB@`[{ xyz"
+    lines = ["".join(rng.choice(alphabet) for _ in range(rng.randrange(200))) for _ in range(300)]
+    data = tmp_path / "random.txt"
+    data.write_text("\n".join(lines) + "\n")
+    patterns = ["x", "@", "`z", "a{B", "ab ab", "zyx" * 3, "a" * 70, lines[7][10:90]]
+    env = {**os.environ, "MINIGREP_KERNEL": kernel}
+
+    for pattern in patterns:
+        for flags, fold in (([], str), (["-i"], str.lower)):
+            result = subprocess.run([executable] + flags + [pattern, str(data)],
+                                    capture_output=True, text=True, env=env)
+            expected = [line for line in lines if fold(pattern) in fold(line)]
+            assert result.stdout.splitlines() == expected, (pattern, flags)
+
+def test_lines_longer_than_a_block(executable, tmp_path):
+    """Test that a match at the end of a multi-megabyte line is found and printed whole"""
+    long_line = "x" * (3 << 20) + "NEEDLE"
+    data = tmp_path / "long.txt"
+    data.write_text("first\n" + long_line + "\nlast NEEDLE")
+
+    result = run_minigrep(executable, ["-n", "NEEDLE", str(data)])
+    assert result.returncode == 0
+    assert result.stdout == f"2: {long_line}\n3: last NEEDLE\n"
+
+@pytest.mark.parametrize("flags", [["-n"], ["-vn"], ["-c"], ["-vc"], ["-in"]])
+def test_line_numbers_across_blocks(executable, tmp_path, flags):
+    """Test output and lazy line numbers over many blocks against Python"""
+    import random
+    rng = random.Random(9)
+    words = ["alpha", "beta", "Gamma", "gamma", "delta", ""]
+    lines = [" ".join(rng.choice(words) for _ in range(rng.randrange(30))) for _ in range(60000)]
+    data = tmp_path / "many.txt"
+    data.write_text("\n".join(lines) + "\n")
+
+    result = run_minigrep(executable, flags + ["gamma", str(data)])
+    fold = str.lower if "i" in flags[0] else str
+    invert = "v" in flags[0]
+    selected = [(i + 1, line) for i, line in enumerate(lines) if ("gamma" in fold(line)) != invert]
+    if "c" in flags[0]:
+        assert result.stdout == f"Matches found: {len(selected)}\n"
+    else:
+        assert result.stdout.splitlines() == [f"{n}: {line}" for n, line in selected]
+
+@pytest.mark.parametrize("flags", [[], ["-i"], ["-vn"], ["-ic"]])
+def test_many_patterns_match_python(executable, tmp_path, flags):
+    """Test thousands of -f patterns plus -e patterns in one Aho-Corasick pass"""
+    import random
+    rng = random.Random(3)
+    def word(n):
+        return "".join(rng.choice("abcdeABCDE-") for _ in range(n))
+    lines = [" ".join(word(rng.randrange(1, 12)) for _ in range(rng.randrange(8))) for _ in range(3000)]
+    patterns = [word(rng.randrange(4, 9)) for _ in range(5000)] + ["Ab", "dEAD"]
+    data = tmp_path / "lines.txt"
+    data.write_text("\n".join(lines) + "\n")
+    pattern_file = tmp_path / "patterns.txt"
+    pattern_file.write_text("\n".join(patterns[:-2]) + "\n")
+
+    result = run_minigrep(executable, flags + ["-f", str(pattern_file), "-e", "Ab", "-e", "dEAD", str(data)])
+    opts = "".join(flags)
+    fold = str.lower if "i" in opts else str
+    folded = [fold(p) for p in patterns]
+    selected = [(i + 1, line) for i, line in enumerate(lines)
+                if any(p in fold(line) for p in folded) != ("v" in opts)]
+    if "c" in opts:
+        assert result.stdout == f"Matches found: {len(selected)}\n"
+    elif "n" in opts:
+        assert result.stdout.splitlines() == [f"{n}: {line}" for n, line in selected]
+    else:
+        assert result.stdout.splitlines() == [line for _, line in selected]
+
+def test_pattern_options(executable, tmp_path, test_files):
+    """Test empty and missing pattern files, empty patterns, and a missing -e argument"""
+    empty = tmp_path / "empty_patterns.txt"
+    empty.write_text("")
+    blank_line = tmp_path / "blank_line.txt"
+    blank_line.write_text("ERROR\n\n")
+
+    assert run_minigrep(executable, ["-f", str(empty), test_files["test1"]]).returncode == 1
+    assert run_minigrep(executable, ["-cf", str(blank_line), test_files["test1"]]).stdout == "Matches found: 5\n"
+    assert run_minigrep(executable, ["-f", "missing_patterns.txt", test_files["test1"]]).returncode == 3
+    assert run_minigrep(executable, ["-n", "-e"]).returncode == 2
+
+def test_dash_patterns(executable, tmp_path):
+    """Test that after the first option argument, one that is not an option is the pattern"""
+    data = tmp_path / "dashes.txt"
+    data.write_text("a -foo b\nfoo\n-x\n--hidden\n")
+
+    assert run_minigrep(executable, ["-n", "-foo", str(data)]).stdout == "1: a -foo b\n"
+    assert run_minigrep(executable, ["-c", "-x", str(data)]).stdout == "Matches found: 1\n"
+    assert run_minigrep(executable, ["-n", "--hid", str(data)]).stdout == "4: --hidden\n"
+    assert run_minigrep(executable, ["-n", "--", "--hidden", str(data)]).stdout == "4: --hidden\n"
+    assert run_minigrep(executable, ["-n", "-m1", "-e", "-x", str(data)]).stdout == "3: -x\n"
+    # The first argument is always options, as it always was
+    assert run_minigrep(executable, ["-foo", str(data)]).returncode == 2
+
+REGEX_PATTERNS = [r"ab+c", r"^a.b", r"[0-9]{2,3}$", r"(ab|ba)*x", r"^$", r"\d\d-\w+",
+                  r"[^a-c ]{3}", r"(a|b)(c|d)?e", r"^(ab){2}", r"x[[:digit:]]", r"c\.", r"a*"]
+
+@pytest.mark.parametrize("flags", [["-E"], ["-Ei"], ["-Evn"], ["-Ec"]])
+def test_regex_matches_python(executable, tmp_path, flags):
+    """Test -E against Python's re on classes, alternation, anchors and repetition"""
+    import random, re
+    rng = random.Random(11)
+    lines = ["".join(rng.choice("abcdeABx0123-. ") for _ in range(rng.randrange(25))) for _ in range(2000)]
+    data = tmp_path / "regex.txt"
+    data.write_text("\n".join(lines) + "\n")
+    opts = flags[0]
+
+    for pattern in REGEX_PATTERNS:
+        python_pattern = pattern.replace(r"\d", "[0-9]").replace("[:digit:]", "0-9")
+        compiled = re.compile(python_pattern, re.I if "i" in opts else 0)
+        selected = [(i + 1, line) for i, line in enumerate(lines)
+                    if (compiled.search(line) is not None) != ("v" in opts)]
+        result = run_minigrep(executable, flags + [pattern, str(data)])
+        if "c" in opts:
+            expected = f"Matches found: {len(selected)}\n" if selected else "No matches found\n"
+            assert result.stdout == expected, pattern
+        elif "n" in opts:
+            assert result.stdout.splitlines() == [f"{n}: {line}" for n, line in selected], pattern
+        else:
+            assert result.stdout.splitlines() == [line for _, line in selected], pattern
+
+def test_regex_state_explosion(executable, tmp_path):
+    """Test patterns whose DFA outgrows the state cache, and several -e expressions"""
+    import random, re
+    rng = random.Random(4)
+    lines = ["".join(rng.choice("ab") for _ in range(rng.randrange(60))) for _ in range(20000)]
+    data = tmp_path / "ab.txt"
+    data.write_text("\n".join(lines) + "\n")
+
+    for args, regex in ((["a[ab]{17}b$"], r"a[ab]{17}b$"),
+                        (["-e", "^b{9}", "-e", "a[ab]{15}c"], r"^b{9}|a[ab]{15}c")):
+        result = run_minigrep(executable, ["-cE"] + args + [str(data)])
+        count = sum(1 for line in lines if re.search(regex, line))
+        assert result.stdout == f"Matches found: {count}\n", args
+
+def test_regex_errors(executable, test_files):
+    """Test that invalid regular expressions are usage errors"""
+    for pattern in ["a(", "a)", "[ab", "[z-a]", "x\\", "a{5,2}", "[[:nope:]]"]:
+        result = run_minigrep(executable, ["-E", pattern, test_files["test1"]])
+        assert result.returncode == 2, pattern
+        assert "Invalid regular expression" in result.stdout
+    # Without -E the same text is a literal
+    assert run_minigrep(executable, ["a(", test_files["test1"]]).returncode == 1
+
+@pytest.fixture
+def source_tree(tmp_path):
+    """Directory tree with nested, hidden and binary files; returns (root, {path: lines})"""
+    import random
+    rng = random.Random(8)
+    root = tmp_path / "tree"
+    files = {}
+    for d in range(30):
+        directory = root / f"d{d % 5}" / f"sub{d}"
+        directory.mkdir(parents=True, exist_ok=True)
+        for n in range(rng.randrange(1, 90)):
+            lines = [" ".join(rng.choice(["foo", "bar", "baz", "Foo"]) for _ in range(rng.randrange(6)))
+                     for _ in range(rng.randrange(20))]
+            path = directory / f"f{n}.txt"
+            path.write_text("\n".join(lines) + "\n")
+            files[str(path)] = lines
+    (root / ".hidden").mkdir()
+    (root / ".hidden" / "h.txt").write_text("foo hidden\n")
+    (root / ".dotfile").write_text("foo dot\n")
+    (root / "image.bin").write_bytes(b"foo\x00\x01\x02\n")
+    return root, files
+
+def test_recursive_search(executable, source_tree):
+    """Test -r output, line numbers and totals against Python, skipping hidden and binary files"""
+    root, files = source_tree
+    expected = sorted(f"{path}:{n}: {line}" for path, lines in files.items()
+                      for n, line in enumerate(lines, 1) if "foo" in line)
+
+    for threads in ["1", "8"]:
+        result = run_minigrep(executable, ["-rn", "-j", threads, "foo", str(root)])
+        assert result.returncode == 0
+        assert sorted(result.stdout.splitlines()) == expected
+
+    result = run_minigrep(executable, ["-rc", "foo", str(root)])
+    assert result.stdout == f"Matches found: {len(expected)}\n"
+
+    result = run_minigrep(executable, ["-rc", "--hidden", "--binary", "foo", str(root)])
+    assert result.stdout == f"Matches found: {len(expected) + 3}\n"
+
+def test_recursive_errors(executable, tmp_path):
+    """Test -r on a missing directory and on a single file"""
+    result = run_minigrep(executable, ["-r", "foo", str(tmp_path / "missing")])
+    assert result.returncode == 3
+    assert "Error:" in result.stdout
+
+    single = tmp_path / "one.txt"
+    single.write_text("a foo\nb\n")
+    result = run_minigrep(executable, ["-r", "foo", str(single)])
+    assert result.stdout == f"{single}:a foo\n"
+    assert run_minigrep(executable, ["--bogus", "foo", str(single)]).returncode == 2
+
+@pytest.mark.parametrize("flags", [["-n"], ["-vn"], ["-c"], ["-vc"], ["-nE"]])
+def test_parallel_chunks_match_python(executable, tmp_path, flags):
+    """Test -j on one file against Python, with lines longer than a chunk and no final newline"""
+    import random
+    rng = random.Random(6)
+    words = ["alpha", "beta", "gamma", "delta", ""]
+    lines = []
+    for i in range(30000):
+        if i % 5000 == 17:
+            lines.append("x" * rng.randrange(100000, 300000) + (" gamma" if i % 2 else ""))
+        else:
+            lines.append(" ".join(rng.choice(words) for _ in range(rng.randrange(12))))
+    data = tmp_path / "chunks.txt"
+    data.write_text("\n".join(lines))
+
+    opts = flags[0]
+    selected = [(i + 1, line) for i, line in enumerate(lines) if ("gamma" in line) != ("v" in opts)]
+    for threads in ["2", "5"]:
+        result = run_minigrep(executable, flags + ["-j", threads, "gamma", str(data)])
+        if "c" in opts:
+            assert result.stdout == f"Matches found: {len(selected)}\n"
+        else:
+            assert result.stdout.splitlines() == [f"{n}: {line}" for n, line in selected]
+    assert run_minigrep(executable, ["-j", "0", "gamma", str(data)]).returncode == 2
+
+def test_standard_input_and_mapped_files(executable, tmp_path):
+    """Test "-" for standard input against the mapped path on the same large file"""
+    lines = [f"line {i} {'match' if i % 7 == 0 else 'other'}" for i in range(200000)]
+    data = tmp_path / "big.txt"
+    data.write_text("\n".join(lines))
+    expected = "".join(f"{i + 1}: {line}\n" for i, line in enumerate(lines) if "match" in line)
+
+    mapped = run_minigrep(executable, ["-n", "match", str(data)])
+    assert mapped.returncode == 0 and mapped.stdout == expected
+    piped = subprocess.run([executable, "-n", "match", "-"], input=data.read_text(),
+                           capture_output=True, text=True)
+    assert piped.returncode == 0 and piped.stdout == expected
+
+    nothing = subprocess.run([executable, "-c", "absent", "-"], input="a\nb\n", capture_output=True, text=True)
+    assert nothing.returncode == 1 and nothing.stdout == "No matches found\n"
+
+@pytest.mark.parametrize("flags", [["-n"], ["-j", "4", "-n"], ["-c"]])
+def test_partly_read_standard_input(executable, tmp_path, flags):
+    """Test that a large regular file on standard input is searched from its current offset"""
+    lines = [f"{i} {'needle' if i % 1000 == 0 else 'hay'}" for i in range(400000)]
+    data = tmp_path / "big.txt"
+    data.write_text("\n".join(lines) + "\n")
+    rest = [line for line in lines[1:] if "needle" in line]
+    expected = f"Matches found: {len(rest)}\n" if "-c" in flags else "".join(
+        f"{i}: {line}\n" for i, line in enumerate(lines[1:], 1) if "needle" in line)
+
+    result = subprocess.run(f"(head -n 1 >/dev/null; {executable} {' '.join(flags)} needle -) < {data}",
+                            shell=True, capture_output=True, text=True)
+    assert result.returncode == 0 and result.stdout == expected
+
+def test_bulk_output_to_pipe_and_file(executable, tmp_path):
+    """Test output of short and long lines written to a pipe and to a regular file"""
+    lines = [("x" * (i % 5 * 300)) + f" row {i}" + (" hit" if i % 3 else "") for i in range(30000)]
+    data = tmp_path / "long.txt"
+    data.write_text("\n".join(lines) + "\n")
+    expected = "".join(f"{i + 1}: {line}\n" for i, line in enumerate(lines) if "hit" in line)
+
+    for args in (["-n", "hit", str(data)], ["-n", "hit", "-"], ["-j", "3", "-n", "hit", str(data)]):
+        source = data.open() if "-" in args else None
+        piped = subprocess.run([executable] + args, stdin=source, capture_output=True, text=True)
+        assert piped.returncode == 0 and piped.stdout == expected, args
+
+        out_file = tmp_path / "out.txt"
+        with out_file.open("w") as out:
+            to_file = subprocess.run([executable] + args, stdin=data.open() if source else None, stdout=out)
+        assert to_file.returncode == 0 and out_file.read_text() == expected, args
+        if source:
+            source.close()
+
+def test_early_exit_options(executable, tmp_path):
+    """Test -m, -l and -q, alone and with -c, -v and -r"""
+    lines = [f"{i} {'hit' if i % 4 == 0 else 'miss'}" for i in range(100000)]
+    data = tmp_path / "data.txt"
+    data.write_text("\n".join(lines) + "\n")
+    hits = [line for line in lines if "hit" in line]
+    misses = [line for line in lines if "hit" not in line]
+
+    assert run_minigrep(executable, ["-m", "3", "hit", str(data)]).stdout == "".join(f"{l}\n" for l in hits[:3])
+    assert run_minigrep(executable, ["-vm2", "hit", str(data)]).stdout == "".join(f"{l}\n" for l in misses[:2])
+    assert run_minigrep(executable, ["-c", "-m", "5", "hit", str(data)]).stdout == "Matches found: 5\n"
+    assert run_minigrep(executable, ["-vc", "-m", "7", "hit", str(data)]).stdout == "Matches found: 7\n"
+    assert run_minigrep(executable, ["-m", "0", "hit", str(data)]).returncode == 1
+    assert run_minigrep(executable, ["-m", "x", "hit", str(data)]).returncode == 2
+
+    listed = run_minigrep(executable, ["-l", "hit", str(data)])
+    assert listed.returncode == 0 and listed.stdout == f"{data}\n"
+    assert run_minigrep(executable, ["-l", "absent", str(data)]).stdout == ""
+
+    quiet = run_minigrep(executable, ["-qn", "hit", str(data)])
+    assert quiet.returncode == 0 and quiet.stdout == ""
+    assert run_minigrep(executable, ["-q", "absent", str(data)]).returncode == 1
+    # Standard input is left unread after the first match
+    piped = subprocess.run([executable, "-q", "hit", "-"], input="\n".join(lines), capture_output=True, text=True)
+    assert piped.returncode == 0 and piped.stdout == ""
+
+    (tmp_path / "sub").mkdir()
+    (tmp_path / "sub" / "other.txt").write_text("no\nhit\nhit\n")
+    recursive = run_minigrep(executable, ["-r", "-l", "hit", str(tmp_path)])
+    assert sorted(recursive.stdout.splitlines()) == [str(data), str(tmp_path / "sub" / "other.txt")]
+    assert run_minigrep(executable, ["-r", "-c", "-m", "1", "hit", str(tmp_path)]).stdout == "Matches found: 2\n"
+    # Threads stop at the first selected line; the exit code comes from the main thread
+    for args, target in ((["-q", "-r", "-j", "4"], tmp_path), (["-qv", "-j", "4"], data)):
+        result = run_minigrep(executable, args + ["hit", str(target)])
+        assert result.returncode == 0 and result.stdout == ""
+    assert run_minigrep(executable, ["-q", "-r", "-j", "4", "absent", str(tmp_path)]).returncode == 1
+
+def test_trigram_index(executable, source_tree):
+    """Test --index searches against -r, before and after an incremental update"""
+    root, files = source_tree
+    queries = [(["-n"], ["foo bar"]), (["-i"], ["FOO BAZ"]), ([], ["baz foo baz"]), (["-c"], ["bar"]),
+               (["-v"], ["o"]), (["-e", "bar foo", "-e", "Foo Foo"], []), (["-E"], ["ba[rz] Foo"]),
+               ([], ["fo"]), (["-l"], ["Foo"]), ([], ["absent"])]
+
+    def check():
+        for flags, pattern in queries:
+            indexed = run_minigrep(executable, flags + ["--index", str(root)] + pattern)
+            full = run_minigrep(executable, ["-r"] + flags + pattern + [str(root)])
+            assert indexed.returncode == full.returncode, flags + pattern
+            assert sorted(indexed.stdout.splitlines()) == sorted(full.stdout.splitlines()), flags + pattern
+
+    assert run_minigrep(executable, ["--index", str(root), "foo"]).returncode == 3
+    assert run_minigrep(executable, ["--hidden", "--index", "build", str(root)]).returncode == 2
+    assert run_minigrep(executable, ["--binary", "--index", str(root), "foo"]).returncode == 2
+    built = run_minigrep(executable, ["--index", "build", str(root)])
+    assert built.returncode == 0 and f"Indexed {len(files) + 1} files ({len(files) + 1} read" in built.stdout
+    check()
+
+    # A stale index still finds what -r finds
+    changed, removed, same_size = sorted(files)[:3]
+    Path(changed).write_text("new foo bar text\nbaz foo baz\n")
+    Path(removed).unlink()
+    (root / "added.txt").write_text("Foo Foo added\n")
+    text = Path(same_size).read_text()
+    Path(same_size).write_text("o" * (len(text) - 1) + "\n")
+    check()
+
+    built = run_minigrep(executable, ["--index", "build", str(root)])
+    assert built.returncode == 0 and f"Indexed {len(files) + 1} files (3 read" in built.stdout
+    check()
+
 # ============================================================================
 # UTILITY FUNCTIONS FOR GRADING
 # ============================================================================